@@ -2,46 +2,34 @@
 #define ABSTRACTBLOCK_H_
 
 #include <iostream>	//NOTE: REMOVE
+#include <cstdint>	//uint32_t
 
 #include "Vector4.h"
-#include "Matrix44.h"
-#include "Cube.h"
 
 /**
   * @brief This class describes the interface for all blocks in the game.
+  * A block holds only its state.  Its position follows from its cell in the BlockStructure, and it is drawn and shadowed
+  * with the rest of the structure.
   */
 class Block
 {
 	private:
 		bool touched;
-		const GLfloat size;
-		Matrix44 globalOrientation; //NOTE: REMOVE
-
-		Cube model;
 		bool isPenatrable;
+		uint32_t instance;
 
 	public:
-		Block(bool isPenatrable, GLfloat size = 1.0, const Matrix44& globalOrientation = Matrix44()) : isPenatrable(isPenatrable), touched(false), size(size), globalOrientation(globalOrientation), model(this -> size, globalOrientation)
-		{
-			if (isPenatrable) {
-				setColor(Vector4(0.5, 0.0, 1.0, 1.0));
-			}
-			else {
-				setColor(Vector4(1.0, 1.0, 1.0, 1.0));
-			}
-		}
+		//Palette indices for a block's appearance
+		enum { UNTOUCHED_COLOR, TOUCHED_COLOR, IMPENETRABLE_COLOR, PALETTE_SIZE };
+
+		Block(bool isPenatrable) : touched(false), isPenatrable(isPenatrable), instance(0) {}
 		
 		/**
-		  * Sets the state of the block to "touched"
+		  * Sets the state of the block to "touched."
+		  * The block's colour follows from its state, so only the structure's instance entry for the block needs updating.
+		  * @see getPaletteIndex
 		  */
-		void touch()
-		{
-			touched = true;
-			
-			if (isPenatrable) {
-				setColor(Vector4(1.0, 0.5, 0.0, 1.0));
-			}
-		}
+		void touch() { touched = true; }
 
 		
 		/**
@@ -55,18 +43,7 @@ class Block
 		bool isImpenetrable() {
 			return !isPenatrable;
 		}
-		
-		
-		/**
-		  * Draws the block
-		  */
-		void draw() const { model.draw(); }
-		
-		/**
-		  * Draws a "Shadow Volume" for use with the stenciled shadow volume algorithm
-		  * @param lightPosition the light source which determines how edges are extruded to form the shadow volume
-		  */
-		void drawShadowVolume(const Vector4& lightPosition) const { model.drawShadowVolume(lightPosition); }
+
 		
 		/**
 		  * @return A Vector4 containing the x, y, and z coordinates of the block with respect to the standard basis
@@ -78,21 +55,34 @@ class Block
 		}*/
 		
 		/**
-		  * @return the block's Modelview transformation
+		  * @return the index of the block's current color in the palette
+		  * @see getPaletteColor
 		  */
-		const Matrix44& getOrientation() const { return model.getOrientation(); }
-		
+		unsigned getPaletteIndex() const { return !isPenatrable ? IMPENETRABLE_COLOR : touched ? TOUCHED_COLOR : UNTOUCHED_COLOR; }
+
 		/**
-		  * @return the size of the block
+		  * @return the block's current color
 		  */
-		const GLfloat& getSize() const { return size; }
-		
+		const Vector4& getColor() const { return getPaletteColor(getPaletteIndex()); }
+
 		/**
-		  * Sets the block's color for when it is drawn
-		  * @see draw
-		  * @param color a vector containing the red, green, blue, and alpha components of the color
+		  * @return the index of the block in its structure's instance buffer
 		  */
-		void setColor(const Vector4& color) { model.setColor(color); }
+		uint32_t getInstance() const { return instance; }
+
+		void setInstance(uint32_t instance) { this -> instance = instance; }
+
+		/**
+		  * @return the colors of untouched, touched and impenetrable blocks, indexed by getPaletteIndex()
+		  */
+		static const Vector4 (&getPalette())[PALETTE_SIZE]
+		{
+			static const Vector4 palette[PALETTE_SIZE] = { Vector4(0.5, 0.0, 1.0, 1.0), Vector4(1.0, 0.5, 0.0, 1.0), Vector4(1.0, 1.0, 1.0, 1.0) };
+
+			return palette;
+		}
+
+		static const Vector4& getPaletteColor(unsigned index) { return getPalette()[index]; }
 		
 		/*virtual bool equals (const AbstractBlock& other) const
        	{
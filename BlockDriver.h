@@ -4,12 +4,14 @@
 #include <vector>		//vector
 #include <cassert>		//assert
 #include <iostream>		//REMOVE
-#include <cmath>		//abs
+#include <cmath>		//abs and floor
 #include <memory>		//auto_ptr
+#include <atomic>		//atomic
 #include <stdexcept>	//runtime_error
-#include <time.h>
+#include <chrono>		//steady_clock
 
 #include "BlockStructure.h"
+#include "LineStrip.h"
 #include "Matrix44.h"
 #include "Vector4.h"
 
@@ -27,7 +29,7 @@ class BlockDriver
 		enum { x, y, z, w };
 		bool loaded;
 		const GLfloat thresholdRatio;
-		BlockStructure* blockStructure;
+		atomic<BlockStructure*> blockStructure;
 		
 		/**
 		  * This struct assists in organizing the space of the game.
@@ -83,17 +85,53 @@ class BlockDriver
 			public:
 				enum Direction {UP, DOWN, LEFT, RIGHT};
 				
+				virtual ~Laser() {}
+
 				virtual void turn(Direction turnDirection) = 0;
-				
-				virtual void move() = 0;
+
+				/**
+				  * Advances a mobile laser by one move.  The laser is moved by the Simulation at a fixed rate, or step by step for replays.
+				  * Neither this nor turn makes GL calls, so both may run on any thread.
+				  * @see Simulation
+				  */
+				virtual void step() = 0;
 				
 				virtual void setMobile(bool mobile) = 0;
-				
-				virtual void draw() const = 0;
 
 				virtual bool isIdle() const = 0;
 				
 				virtual bool isMobile() const = 0;
+
+				/**
+				  * @return the path drawn for the laser, three coordinates per vertex of a line strip
+				  */
+				virtual const vector<GLfloat>& getPath() const = 0;
+
+				/**
+				  * @return how many vertices at the start of the path are the same as when this was last called
+				  */
+				virtual size_type takeUnchangedPath() = 0;
+
+				/**
+				  * @return the cells the laser has entered, as (height * rows + row) * columns + column, in the order they were first entered
+				  */
+				virtual const vector<size_type>& getTouchedCells() const = 0;
+
+				/**
+				  * @return true if the laser has entered every penetrable block
+				  */
+				virtual bool hasTouchedAllPenetrable() const = 0;
+
+				/**
+				  * Gets the centers of the voxels at the ends of each straight run of the laser's path, in order, ending with the voxel the laser is in.
+				  * Every voxel between two consecutive ones was visited too.
+				  */
+				virtual void getVisitedCorners(vector<Vector4>& locations) const = 0;
+
+				/**
+				  * Gets the centers of the voxels the laser can enter next without losing, whichever way it is turned.
+				  */
+				virtual void getFrontier(vector<Vector4>& locations) const = 0;
 		};
 		
 	private:
@@ -101,8 +139,6 @@ class BlockDriver
 		{
 			private:
 				static const GLfloat secondsToIdle;
-				static const GLfloat laserWidth; 
-				static const GLfloat moveInterval;
 
 				bool mobile;
 				BlockDriver& blockDriver;
@@ -112,7 +148,16 @@ class BlockDriver
 				Matrix44 currentOrientation, nextOrientation;
 				Voxel currentVoxel;
 				vector<Voxel > visitedLocations;
-				clock_t  lastMoved;
+				chrono::steady_clock::time_point lastMoved;
+
+				//The drawn path: the centers of the visited voxels but the last, that voxel's center once passed, then currentLocation
+				LineStrip path;
+				bool pathHasCenter;
+
+				//The structure's blocks are drawn by the render thread, so the laser keeps its own record of those it has touched
+				vector<bool> touched;
+				vector<size_type> touchedCells;
+				size_type untouchedPenetrable;
 				
 			public:
 				LaserImplementation(BlockDriver& blockDriver,
@@ -130,8 +175,17 @@ class BlockDriver
 									currentOrientation(),
 									nextOrientation(currentOrientation),
 									currentVoxel(currentVoxel),
-									lastMoved(clock())
+									lastMoved(chrono::steady_clock::now()),
+									pathHasCenter(false),
+									touched(blockStructure -> getHeight() * blockStructure -> getRows() * blockStructure -> getColumns(), false),
+									untouchedPenetrable(0)
 				{
+					for(size_type i = 0; i < blockStructure -> getHeight(); i++)
+						for(size_type j = 0; j < blockStructure -> getRows(); j++)
+							for(size_type k = 0; k < blockStructure -> getColumns(); k++)
+								if(blockStructure -> hasBlock(i, j, k) && !blockStructure -> hasImpenetrableBlock(i, j, k))
+									untouchedPenetrable++;
+
 					visitedLocations.push_back(this -> currentVoxel);
 					
 					currentVoxelLocation = blockDriver.getVoxelLocation(this -> currentVoxel);
@@ -140,6 +194,8 @@ class BlockDriver
 					currentLocation[y] = currentVoxelLocation[y] - this -> currentDirection[y] * blockStructure -> getBlockSize() / 2.0;
 					currentLocation[z] = currentVoxelLocation[z] - this -> currentDirection[z] * blockStructure -> getBlockSize() / 2.0;
 					currentLocation[w] = 1.0;
+
+					path.push_back(currentLocation);
 				}
 				
 				virtual void turn(Direction turnDirection)
@@ -151,51 +207,44 @@ class BlockDriver
 
 						//NOTE: Too expensive (We avoid needlessly copying currentOrientation.)
 						nextDirection = currentOrientation * nextDirection;
-						
-						glPushMatrix();
-							glLoadIdentity();
-							glMultMatrixf(currentOrientation);
-						
-							switch(turnDirection)
-							{
-								case UP:	glRotatef(90.0, 0, 0, 1);
-											break;
-											
-								case DOWN:	glRotatef(-90.0, 0, 0, 1);	
-											break;
-								
-								case RIGHT:	glRotatef(-90.0, 0, 1, 0);
-											break;
-											
-								case LEFT:	glRotatef(90.0, 0, 1, 0);
-											break;
-							}
-						
-							glGetFloatv(GL_MODELVIEW_MATRIX, nextOrientation);
-						glPopMatrix();
+
+						//The rotations are applied as glRotatef would apply them to currentOrientation, without the GL matrix stack
+						switch(turnDirection)
+						{
+							case UP:	nextOrientation = Matrix44::getRotation(90.0, 0, 0, 1) * currentOrientation;
+										break;
+										
+							case DOWN:	nextOrientation = Matrix44::getRotation(-90.0, 0, 0, 1) * currentOrientation;
+										break;
+							
+							case RIGHT:	nextOrientation = Matrix44::getRotation(-90.0, 0, 1, 0) * currentOrientation;
+										break;
+										
+							case LEFT:	nextOrientation = Matrix44::getRotation(90.0, 0, 1, 0) * currentOrientation;
+										break;
+						}
 			
 						//NOTE: Too expensive
 						//Change of basis back to the standard basis	
 						nextDirection = nextOrientation.getTranspose() * nextDirection;
 						
-						//Fixes rounding errors
+						//Fixes rounding errors, which may leave a component just short of 1 or -1
 						for(Vector4::iterator i = nextDirection.begin(); i != nextDirection.end(); i++)
-							*i = (GLint)(*i);
+							*i = floor(*i + 0.5f);
 					}
 				}
 				
 				virtual void setMobile(bool mobile) { this -> mobile = mobile; }
 				
-				virtual void move()
+				virtual void step()
 				{
 					assert(blockDriver.isLoaded());
 
 					currentVoxelLocation = blockDriver.getVoxelLocation(currentVoxel);
-					GLfloat elapsedTime = (GLfloat)(clock() - lastMoved) / CLOCKS_PER_SEC;
 					
-					if(isMobile() && elapsedTime > moveInterval)
+					if(isMobile())
 					{
-						lastMoved = clock();
+						lastMoved = chrono::steady_clock::now();
 						moveProgress += speed;
 						
 						if(!hasPassedBlockCenter())
@@ -223,7 +272,7 @@ class BlockDriver
 								
 								if(blockStructure -> hasBlock(currentVoxel.height, currentVoxel.row, currentVoxel.column))
 								{
-									blockStructure -> touchBlock(currentVoxel.height, currentVoxel.row, currentVoxel.column);
+									touch(currentVoxel);
 									
 									//We lost.
 									if(blockStructure -> hasImpenetrableBlock(currentVoxel.height, currentVoxel.row, currentVoxel.column))
@@ -232,7 +281,7 @@ class BlockDriver
 
 									}
 									//We won!
-									else if(blockDriver.hasTouchedAllPenetrable())
+									else if(hasTouchedAllPenetrable())
 									{
 										setMobile(false);
 
@@ -242,9 +291,15 @@ class BlockDriver
 								//NOTE: May need to comment out this optimization to visualize bugs involving the lazer path
 								//No need to store the midpoint along a line segment where the points change with respect to one axis.
 								if(visitedLocations.size() > 1 && currentVoxel.isAlongSameAxis(visitedLocations[visitedLocations.size() - 2]))
+								{
 									visitedLocations.pop_back();
+
+									//The center of the voxel we left is dropped too; the head takes its place below.
+									path.pop_back();
+								}
 									
 								visitedLocations.push_back(currentVoxel);
+								pathHasCenter = false;
 							}
 						}
 						
@@ -260,51 +315,90 @@ class BlockDriver
 							setMobile(false);
 
 						}
+
+						//Only the head of the path moves between turns.
+						if(hasPassedBlockCenter() && !pathHasCenter)
+						{
+							path.setBack(blockDriver.getVoxelLocation(currentVoxel));
+							path.push_back(currentLocation);
+							pathHasCenter = true;
+						}
+
+						path.setBack(currentLocation);
 					}
 				}
 				
-				virtual void draw() const
+				virtual bool isIdle() const { return chrono::duration<GLfloat>(chrono::steady_clock::now() - lastMoved).count() >= secondsToIdle; }
+
+				virtual bool isMobile() const { return mobile; }
+
+				virtual const vector<GLfloat>& getPath() const { return path.getVertices(); }
+
+				virtual size_type takeUnchangedPath() { return path.takeUnchanged(); }
+
+				virtual const vector<size_type>& getTouchedCells() const { return touchedCells; }
+
+				virtual bool hasTouchedAllPenetrable() const { return untouchedPenetrable == 0; }
+
+				virtual void getVisitedCorners(vector<Vector4>& locations) const
 				{
-					assert(visitedLocations.back() == currentVoxel);
-					
-					glMatrixMode(GL_MODELVIEW);
-					
-					if(isMobile())									glColor3f(1.0, 0.5, 0.0);
-					else if(blockDriver.hasTouchedAllPenetrable())	glColor3f(0.0, 1.0, 0.0);
-					else											glColor3f(1.0, 0.0, 0.0);
-						
-					glEnable(GL_LINE_SMOOTH);
-					glLineWidth(laserWidth);
-					glBegin(GL_LINE_STRIP);
-					
-						for(vector<Voxel>::const_iterator i = visitedLocations.begin(); i != visitedLocations.end() - 1; i++)
-							glVertex3fv(blockDriver.getVoxelLocation(*i).data());
-						
-						//Don't draw the line to the current voxel's center until we have passed this location.
-						if(hasPassedBlockCenter())
-							glVertex3fv(blockDriver.getVoxelLocation(*(visitedLocations.end() - 1)).data());
-						
-						glVertex3fv(currentLocation.data());
-						
-					glEnd();
-					glDisable(GL_LINE_SMOOTH);
+					locations.clear();
+
+					for(vector<Voxel>::const_iterator i = visitedLocations.begin(); i != visitedLocations.end(); i++)
+						locations.push_back(blockDriver.getVoxelLocation(*i));
 				}
-				
-				virtual bool isIdle() const { return (GLfloat)(clock() - lastMoved) / CLOCKS_PER_SEC >= secondsToIdle; }
 
-				virtual bool isMobile() const { return mobile; }
+				virtual void getFrontier(vector<Vector4>& locations) const
+				{
+					static const GLint steps[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+					locations.clear();
+
+					//A turn leaves the laser heading straight on or along one of the four directions across its path, never back
+					for(size_type i = 0; i < 6; i++)
+					{
+						if(steps[i][x] == -currentDirection[x] && steps[i][y] == -currentDirection[y] && steps[i][z] == -currentDirection[z])
+							continue;
+
+						const Voxel next(currentVoxel.height + steps[i][y], currentVoxel.row + steps[i][z], currentVoxel.column + steps[i][x]);
+
+						if(!hasVisited(next) && !blockStructure -> hasImpenetrableBlock(next.height, next.row, next.column))
+							locations.push_back(blockDriver.getVoxelLocation(next));
+					}
+				}
 				
 			private:
+				/**
+				  * @return true if voxel is on the laser's path
+				  */
+				bool hasVisited(const Voxel& voxel) const
+				{
+					for(vector<Voxel>::const_iterator i = visitedLocations.begin(); i != visitedLocations.end(); i++)
+						if(voxel == *i || (i + 1 != visitedLocations.end() && voxel.isInBetween(*i, *(i + 1))))
+							return true;
+
+					return false;
+				}
+
+				void touch(const Voxel& voxel)
+				{
+					const size_type cell = (voxel.height * blockStructure -> getRows() + voxel.row) * blockStructure -> getColumns() + voxel.column;
+
+					if(touched[cell])
+						return;
+
+					touched[cell] = true;
+					touchedCells.push_back(cell);
+
+					if(!blockStructure -> hasImpenetrableBlock(voxel.height, voxel.row, voxel.column))
+						untouchedPenetrable--;
+				}
+
 				virtual bool isAtPastLocation() const
 				{
 					for(vector<Voxel>::const_iterator i = visitedLocations.begin(); i != visitedLocations.end() - 1; i++)
 						if(currentVoxel == *i || currentVoxel.isInBetween(*i, *(i + 1)))
-						{
-							Vector4 voxel1 = blockDriver.getVoxelLocation(*i);
-							Vector4 voxel2 = blockDriver.getVoxelLocation(*(i + 1));
-							
 							return true;
-						}
 					
 					return false;
 				}
@@ -320,8 +414,6 @@ class BlockDriver
 				
 				virtual bool isWithinTurnThreshold() const
 				{
-					Vector4 currentVoxelLocation = blockDriver.getVoxelLocation(currentVoxel);
-					
 					//NOTE: Consider these if necessary
 					//NOTE: This takes the 1-norm (Manhattan distance) distance which only works in this special case.  Consider the 2-norm distance if necessary.
 					//return (abs(currentLocation[x] - currentVoxelLocation[x]) + abs(currentLocation[y] - currentVoxelLocation[y]) + abs(currentLocation[z] - currentVoxelLocation[z])) < turnThreshold;
@@ -353,12 +445,27 @@ class BlockDriver
 			loaded = true;
 		}
 
+		/**
+		  * Atomically replaces the attached BlockStructure, for instance with one built by a background loader.
+		  * Any Laser obtained from getLaser() must be released before the swap.
+		  * @param blockStructure the new instance of BlockStructure
+		  * @return the previously attached BlockStructure, which the caller now owns and may free on any thread
+		  */
+		BlockStructure* exchangeBlockStructure(BlockStructure* blockStructure)
+		{
+			BlockStructure* previous = this -> blockStructure.exchange(blockStructure);
+
+			loaded = (blockStructure != NULL);
+
+			return previous;
+		}
+
 		void unload() { loaded = false; }
 
 		/**
 		  * deletes any existing BlockStructure associated with the BlockDriver
 		  */
-		void reset() { if(blockStructure != NULL) delete blockStructure; }
+		void reset() { delete blockStructure.exchange(NULL); }
 		
 		/**
 		  * @return an auto_ptr to an instance of Laser, which can be controlled by the player
@@ -370,49 +477,6 @@ class BlockDriver
 			return auto_ptr<Laser>(new LaserImplementation(*this, Vector4(1.0, 0.0, 0.0, 1.0), Voxel(0, 0, -5)));
 		}
 		
-		/**
-		  * This method, which can be used for debugging purposes, draws a grid around the BlockStructure associated with the BlockDriver.
-		  * It will throw a runtime_error if no BlockStructure has been loaded.
-		  */
-		void drawVoxelGrid() const
-		{
-			if(!isLoaded())
-				throw runtime_error("There is no BlockStructure associated with this BlockDriver.");
-
-			assert(isLoaded());
-
-			const Vector4& base = blockStructure -> getBase();
-			const GLfloat& blockSize = blockStructure -> getBlockSize();
-			const size_type& height = blockStructure -> getHeight();
-			const size_type& rows = blockStructure -> getRows();
-			const size_type& columns = blockStructure -> getColumns();
-			
-			//NOTE: Need to stop computing this so many times
-			GLfloat upperLeftCornerX = base[x] + (columns / 2) * -blockSize, upperLeftCornerZ = base[z] + (rows / 2) * -blockSize;
-
-			//This computes the absolute upper left hand corner of the base of the structure.
-			if(columns % 2 == 0)
-				upperLeftCornerX += blockSize / 2.0;
-
-			if(rows % 2 == 0)
-				upperLeftCornerZ += blockSize / 2.0;
-			
-			glColor3f(1.0, 1.0, 1.0);
-			glPushMatrix();	
-				
-				for(size_type i = 0; i < height; i++)
-					for(size_type j = 0; j < rows; j++)
-						for(size_type k = 0; k < columns; k++)
-						{
-							glPushMatrix();
-								glTranslatef(upperLeftCornerX + k * blockSize, base[y] + blockSize / 2.0 + blockSize * i, upperLeftCornerZ + j * blockSize);
-								//glutWireCube(blockSize);
-							glPopMatrix();
-						}
-						
-			glPopMatrix();
-		}
-		
 		/**
 		  * @param height The height of the Voxel
 		  * @param row The row of the Voxel
@@ -423,23 +487,13 @@ class BlockDriver
 		{
 			assert(isLoaded());
 			
-			const Vector4& base = blockStructure -> getBase();
+			const BlockStructure* blockStructure = getBlockStructure();
+			const Vector4& origin = blockStructure -> getOrigin();
 			const GLfloat& blockSize = blockStructure -> getBlockSize();
-			const size_type& rows = blockStructure -> getRows();
-			const size_type& columns = blockStructure -> getColumns();
-			
-			//NOTE: Need to stop computing this so many times
-			GLfloat upperLeftCornerX = base[x] - (columns / 2) * blockSize, upperLeftCornerZ = base[z] - (rows / 2) * blockSize;
-
-			if(columns % 2 == 0)
-				upperLeftCornerX += blockSize / 2.0;
-
-			if(rows % 2 == 0)
-				upperLeftCornerZ += blockSize / 2.0;
 			
-			return Vector4(	upperLeftCornerX + column * blockSize,
-							base[y] + blockSize / 2.0 + blockSize * height,
-							upperLeftCornerZ + row * blockSize,
+			return Vector4(	origin[x] + column * blockSize,
+							origin[y] + height * blockSize,
+							origin[z] + row * blockSize,
 							1.0);
 		}
 		
@@ -447,98 +501,30 @@ class BlockDriver
 		  * @param an instance of Voxel
 		  * @return a positional vector describing the location of the Voxel
 		  */
-		const Vector4 getVoxelLocation(const Voxel& voxel) const
-		{
-			assert(isLoaded());
-			
-			const Vector4& base = blockStructure -> getBase();
-			const GLfloat& blockSize = blockStructure -> getBlockSize();
-			const size_type& rows = blockStructure -> getRows();
-			const size_type& columns = blockStructure -> getColumns();
-			
-			//NOTE: Need to stop computing this so many times
-			GLfloat upperLeftCornerX = base[x] - (columns / 2) * blockSize, upperLeftCornerZ = base[z] - (rows / 2) * blockSize;
-
-			if(columns % 2 == 0)
-				upperLeftCornerX += blockSize / 2.0;
+		const Vector4 getVoxelLocation(const Voxel& voxel) const { return getVoxelLocation(voxel.height, voxel.row, voxel.column); }
 
-			if(rows % 2 == 0)
-				upperLeftCornerZ += blockSize / 2.0;
-			
-			return Vector4(	upperLeftCornerX + voxel.column * blockSize,
-							base[y] + blockSize / 2.0 + blockSize * voxel.height,
-							upperLeftCornerZ + voxel.row * blockSize,
-							1.0);
-		}
-
-		bool hasTouchedAllPenetrable() const
-		{
-			assert(isLoaded());
-
-			const size_type& height = blockStructure -> getHeight();
-			const size_type& rows = blockStructure -> getRows();
-			const size_type& columns = blockStructure -> getColumns();
-
-			for(size_type i = 0; i < height; i++)
-				for(size_type j = 0; j < rows; j++)
-					for(size_type k = 0; k < columns; k++)
-						if(blockStructure -> hasBlock(i, j, k) && !blockStructure -> hasImpenetrableBlock(i, j, k) && !blockStructure -> hasTouchedBlock(i, j, k))
-							return false;
-
-			return true;
-		}
-
-		
 		/**
-		  * This method, which can be used for debugging purposes, highlights a Voxel existing in the space defined by the BlockStructure grid.
-		  * @param height The height of the Voxel
-		  * @param row The row of the Voxel
-		  * @param column The column of the Voxel
+		  * @return true if the BlockDriver has an instance of BlockStructure associated with it
 		  */
-		void highlightVoxel(GLint height, GLint row, GLint column) const
-		{
-			const GLfloat& blockSize = blockStructure -> getBlockSize();
-			Vector4 voxelLocation = getVoxelLocation(height, row, column);
-				
-			glPushMatrix();
-				glTranslatef(voxelLocation[x], voxelLocation[y], voxelLocation[z]);
-				//glutSolidCube(blockSize);
-			glPopMatrix();
-		}
-		
-		//NOTE: Reconsider placement of this method.
+		bool isLoaded() const { return loaded; }
+
 		/**
-		  * This method, which can be used for debugging purposes, draws the area in which an instance of Laser can successfully turn.
-		  * @see Laser
+		  * @return the fraction of a voxel's width, centered on the voxel, within which a Laser can turn
 		  * @see Laser::turn
 		  */
-		void showVoxelTurnThreshold(GLint height, GLint row, GLint column) const
-		{
-			const GLfloat& blockSize = blockStructure -> getBlockSize();
-			Vector4 voxelLocation = getVoxelLocation(height, row, column);
-				
-			glPushMatrix();
-				glTranslatef(voxelLocation[x], voxelLocation[y], voxelLocation[z]);
-				//glutSolidCube(blockSize * thresholdRatio);
-			glPopMatrix();
-		}
-		
-		/**
-		  * @return true if the BlockDriver has an instance of BlockStructure associated with it
-		  */
-		bool isLoaded() const { return loaded; }
+		GLfloat getThresholdRatio() const { return thresholdRatio; }
 		
 		//NOTE: This method is used by Laser and should be removed.
 		//Instead, new methods should be added to the interface of BlockDriver for manipulating the BlockStructure.
 		/**
 		  * @return a pointer to the associated BlockStructure
 		  */
-		BlockStructure* getBlockStructure() { return blockStructure; }
+		BlockStructure* getBlockStructure() { return blockStructure.load(); }
+
+		const BlockStructure* getBlockStructure() const { return blockStructure.load(); }
 };
 
 const GLfloat BlockDriver::LaserImplementation::secondsToIdle = 5.0;
-const GLfloat BlockDriver::LaserImplementation::laserWidth = 5.0;
-const GLfloat BlockDriver::LaserImplementation::moveInterval = 0.01;
 
 #endif /*BLOCKDRIVER_H_*/
  
\ No newline at end of file
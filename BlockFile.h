@@ -0,0 +1,269 @@
+#ifndef BLOCKFILE_H_
+#define BLOCKFILE_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint32_t and uint64_t
+#include <cstring>		//memcmp and memcpy
+#include <vector>		//vector
+#include <fstream>		//ofstream
+#include <string>		//string
+#include <stdexcept>	//runtime_error
+
+#include "BlockGrid.h"
+#include "BlockParser.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+/**
+  * The fixed header at the start of every .blockb file.  Fields are stored little endian, in the order they are declared, whatever the
+  * byte order of the machine.
+  */
+struct BlockFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t height, rows, columns;
+	uint32_t flags;
+	uint64_t contentHash;
+	uint64_t payloadSize;
+};
+
+static_assert(sizeof(BlockFileHeader) == 40, "BlockFileHeader must not contain padding");
+
+/**
+  * @brief This class gives read access to a puzzle stored in the binary .blockb format.
+  * The file is memory mapped and, unless it was written with run-length encoding, cells are read straight out of the mapping.
+  * @see BlockGrid
+  */
+class BlockFile
+{
+	public:
+		typedef BlockGrid::size_type size_type;
+
+		static const uint32_t currentVersion = 1;
+
+		enum Flags { RUN_LENGTH_ENCODED = 1 };
+
+	private:
+		MappedFile file;
+		BlockFileHeader header;
+		const uint8_t* cells;
+		vector<uint8_t> decoded;
+
+	public:
+		/**
+		  * Maps the file at filePath.  This throws a runtime_error if the file is not a valid .blockb file, including when its dimensions
+		  * are too large to hold or its cells do not match the content hash in its header.
+		  */
+		BlockFile(const string& filePath) : file(filePath), cells(NULL)
+		{
+			if(file.getSize() < sizeof(BlockFileHeader))
+				throw runtime_error("The file '" + filePath + "' is too short to be a .blockb file.");
+
+			readHeader(file.data(), header);
+
+			if(memcmp(header.magic, "BLKB", 4) != 0 || header.version != currentVersion)
+				throw runtime_error("The file '" + filePath + "' is not a supported .blockb file.");
+
+			if(header.payloadSize != file.getSize() - sizeof(BlockFileHeader))
+				throw runtime_error("The file '" + filePath + "' is truncated.");
+
+			size_type cellCount;
+
+			if(!BlockGrid::countCells(header.height, header.rows, header.columns, cellCount))
+				throw runtime_error("The file '" + filePath + "' has invalid dimensions.");
+
+			const uint8_t* payload = file.data() + sizeof(BlockFileHeader);
+			const size_type packedSize = (cellCount + BlockGrid::cellsPerByte - 1) / BlockGrid::cellsPerByte;
+
+			if(header.flags & RUN_LENGTH_ENCODED)
+			{
+				//Each pair of bytes in the payload decodes to at most 255 bytes, so larger dimensions cannot be right
+				if(packedSize > header.payloadSize / 2 * 255)
+					throw runtime_error("The file '" + filePath + "' has a run-length encoded payload which does not match its dimensions.");
+
+				decoded.reserve(packedSize);
+
+				for(size_type i = 0; i + 1 < header.payloadSize && decoded.size() < packedSize; i += 2)
+					decoded.insert(decoded.end(), (size_type)payload[i], payload[i + 1]);
+
+				if(decoded.size() != packedSize)
+					throw runtime_error("The file '" + filePath + "' has a corrupt run-length encoded payload.");
+
+				cells = decoded.data();
+			}
+			else
+			{
+				if(header.payloadSize != packedSize)
+					throw runtime_error("The file '" + filePath + "' has a payload which does not match its dimensions.");
+
+				cells = payload;
+			}
+
+			if(BlockGrid::hash(header.height, header.rows, header.columns, cells) != header.contentHash)
+				throw runtime_error("The file '" + filePath + "' does not match its content hash.");
+		}
+
+		BlockGrid::CellType getCellType(size_type height, size_type row, size_type column) const
+		{
+			assert(height < header.height && row < header.rows && column < header.columns);
+
+			return BlockGrid::unpackCell(cells, (height * header.rows + row) * header.columns + column);
+		}
+
+		size_type getHeight() const { return header.height; }
+
+		size_type getRows() const { return header.rows; }
+
+		size_type getColumns() const { return header.columns; }
+
+		uint64_t getContentHash() const { return header.contentHash; }
+
+		/**
+		  * Copies the cells into grid.
+		  */
+		void copyTo(BlockGrid& grid) const
+		{
+			grid = BlockGrid(getHeight(), getRows(), getColumns());
+
+			memcpy(grid.getPackedCells(), cells, grid.getPackedSize());
+		}
+
+		/**
+		  * @return true if filePath names a .blockb file
+		  */
+		static bool isBinaryPath(const string& filePath)
+		{
+			const string extension = ".blockb";
+
+			return filePath.size() >= extension.size() && filePath.compare(filePath.size() - extension.size(), extension.size(), extension) == 0;
+		}
+
+		/**
+		  * Writes grid to filePath in the .blockb format, optionally run-length encoding the packed cells.
+		  */
+		static void write(const string& filePath, const BlockGrid& grid, bool compress)
+		{
+			vector<uint8_t> payload;
+			const uint8_t* packedCells = grid.getPackedCells();
+
+			if(compress)
+			{
+				for(size_type i = 0; i < grid.getPackedSize(); )
+				{
+					size_type run = 1;
+
+					while(run < 255 && i + run < grid.getPackedSize() && packedCells[i + run] == packedCells[i])
+						run++;
+
+					payload.push_back((uint8_t)run);
+					payload.push_back(packedCells[i]);
+					i += run;
+				}
+			}
+			else
+				payload.assign(packedCells, packedCells + grid.getPackedSize());
+
+			BlockFileHeader header;
+
+			memcpy(header.magic, "BLKB", 4);
+			header.version = currentVersion;
+			header.height = (uint32_t)grid.getHeight();
+			header.rows = (uint32_t)grid.getRows();
+			header.columns = (uint32_t)grid.getColumns();
+			header.flags = compress ? RUN_LENGTH_ENCODED : 0;
+			header.contentHash = grid.hash();
+			header.payloadSize = payload.size();
+
+			vector<uint8_t> headerBytes;
+
+			writeHeader(header, headerBytes);
+
+			ofstream out(filePath.c_str(), ios::binary);
+
+			if(out.fail())
+				throw runtime_error("The file '" + filePath + "' could not be created.");
+
+			out.write((const char*)headerBytes.data(), headerBytes.size());
+			out.write((const char*)payload.data(), payload.size());
+
+			if(out.fail())
+				throw runtime_error("The file '" + filePath + "' could not be written.");
+		}
+
+	private:
+		static void readHeader(const uint8_t* bytes, BlockFileHeader& header)
+		{
+			memcpy(header.magic, bytes, 4);
+			bytes += 4;
+
+			header.version = readLittleEndian<uint32_t>(bytes);
+			header.height = readLittleEndian<uint32_t>(bytes);
+			header.rows = readLittleEndian<uint32_t>(bytes);
+			header.columns = readLittleEndian<uint32_t>(bytes);
+			header.flags = readLittleEndian<uint32_t>(bytes);
+			header.contentHash = readLittleEndian<uint64_t>(bytes);
+			header.payloadSize = readLittleEndian<uint64_t>(bytes);
+		}
+
+		static void writeHeader(const BlockFileHeader& header, vector<uint8_t>& bytes)
+		{
+			bytes.insert(bytes.end(), header.magic, header.magic + 4);
+
+			appendLittleEndian(bytes, header.version);
+			appendLittleEndian(bytes, header.height);
+			appendLittleEndian(bytes, header.rows);
+			appendLittleEndian(bytes, header.columns);
+			appendLittleEndian(bytes, header.flags);
+			appendLittleEndian(bytes, header.contentHash);
+			appendLittleEndian(bytes, header.payloadSize);
+		}
+
+		template<typename T>
+		static T readLittleEndian(const uint8_t*& bytes)
+		{
+			T value = 0;
+
+			for(size_t i = 0; i < sizeof(T); i++)
+				value |= (T)*bytes++ << (i * 8);
+
+			return value;
+		}
+
+		template<typename T>
+		static void appendLittleEndian(vector<uint8_t>& bytes, T value)
+		{
+			for(size_t i = 0; i < sizeof(T); i++)
+				bytes.push_back((uint8_t)(value >> (i * 8)));
+		}
+};
+
+/**
+  * Converts between the text .block format and the binary .blockb format.  The direction is chosen from the extension of inputPath.
+  * @param compress whether a .blockb output should be run-length encoded
+  */
+inline void convertBlockFile(const string& inputPath, const string& outputPath, bool compress)
+{
+	BlockGrid grid;
+
+	if(BlockFile::isBinaryPath(inputPath))
+	{
+		BlockFile(inputPath).copyTo(grid);
+
+		ofstream out(outputPath.c_str());
+
+		if(out.fail())
+			throw runtime_error("The file '" + outputPath + "' could not be created.");
+
+		out << grid;
+	}
+	else
+	{
+		inputPath >> grid;
+
+		BlockFile::write(outputPath, grid, compress);
+	}
+}
+
+#endif /*BLOCKFILE_H_*/
@@ -0,0 +1,176 @@
+#ifndef BLOCKGRID_H_
+#define BLOCKGRID_H_
+
+#include <cstddef>		//size_t
+#include <cassert>		//assert
+#include <cstdint>		//uint8_t and uint64_t
+#include <vector>		//vector
+#include <limits>		//numeric_limits
+#include <string>		//string
+#include <iostream>		//ostream
+
+using namespace std;
+
+/**
+  * @brief This class holds the cell types of a puzzle without any of the rendering state attached to a BlockStructure.
+  * Cells are packed two bits apiece in height, row, column order, which is also the layout used by the binary .blockb format.
+  * @see BlockStructure
+  */
+class BlockGrid
+{
+	public:
+		typedef size_t size_type;
+
+		enum CellType { EMPTY = 0, PENETRABLE = 1, IMPENETRABLE = 2 };
+
+		static const unsigned cellsPerByte = 4;
+		static const unsigned bitsPerCell = 2;
+
+	private:
+		size_type height, rows, columns;
+		vector<uint8_t> cells;
+
+	public:
+		BlockGrid(size_type height = 0, size_type rows = 0, size_type columns = 0) : height(height), rows(rows), columns(columns), cells(getPackedSize(height, rows, columns), 0) {}
+
+		/**
+		  * @return the type of the cell at the specified location
+		  */
+		CellType getCellType(size_type height, size_type row, size_type column) const
+		{
+			assert(height < this -> height && row < rows && column < columns);
+
+			return unpackCell(cells.data(), getIndex(height, row, column));
+		}
+
+		void setCellType(size_type height, size_type row, size_type column, CellType type)
+		{
+			assert(height < this -> height && row < rows && column < columns);
+
+			size_type index = getIndex(height, row, column);
+			unsigned shift = (index % cellsPerByte) * bitsPerCell;
+
+			cells[index / cellsPerByte] = (uint8_t)((cells[index / cellsPerByte] & ~(3u << shift)) | ((unsigned)type << shift));
+		}
+
+		const size_type& getHeight() const { return height; }
+
+		const size_type& getRows() const { return rows; }
+
+		const size_type& getColumns() const { return columns; }
+
+		size_type getCellCount() const { return height * rows * columns; }
+
+		/**
+		  * @return the bit-packed cells, which are getPackedSize() bytes long
+		  */
+		const uint8_t* getPackedCells() const { return cells.data(); }
+
+		uint8_t* getPackedCells() { return cells.data(); }
+
+		size_type getPackedSize() const { return cells.size(); }
+
+		/**
+		  * @return a hash which identifies the content of the grid regardless of the format it was stored in
+		  */
+		uint64_t hash() const { return hash(height, rows, columns, cells.data()); }
+
+		/**
+		  * FNV-1a over the dimensions and the packed cells.
+		  * Unused bits in the last byte are always zero, so equal grids hash equally.
+		  */
+		static uint64_t hash(size_type height, size_type rows, size_type columns, const uint8_t* packedCells)
+		{
+			const uint64_t prime = 1099511628211ULL;
+			uint64_t result = 14695981039346656037ULL;
+			const uint64_t dimensions[3] = { height, rows, columns };
+
+			for(size_type i = 0; i < 3; i++)
+				for(unsigned j = 0; j < 8; j++)
+					result = (result ^ ((dimensions[i] >> (j * 8)) & 0xFF)) * prime;
+
+			for(size_type i = 0, size = getPackedSize(height, rows, columns); i < size; i++)
+				result = (result ^ packedCells[i]) * prime;
+
+			return result;
+		}
+
+		static size_type getPackedSize(size_type height, size_type rows, size_type columns)
+		{
+			return (height * rows * columns + cellsPerByte - 1) / cellsPerByte;
+		}
+
+		/**
+		  * Multiplies out the number of cells in a grid of the given dimensions, as read from a file which may be malformed.
+		  * @return false if a dimension is zero or the grid is too large to be packed in memory, in which case cellCount is left unchanged
+		  */
+		static bool countCells(size_type height, size_type rows, size_type columns, size_type& cellCount)
+		{
+			//Parenthesized so that the max macro from Windows.h is not expanded
+			const size_type largest = (numeric_limits<size_type>::max)() - (cellsPerByte - 1);
+
+			if(height == 0 || rows == 0 || columns == 0 || rows > largest / height || columns > largest / (height * rows))
+				return false;
+
+			cellCount = height * rows * columns;
+
+			return true;
+		}
+
+		static CellType unpackCell(const uint8_t* packedCells, size_type index)
+		{
+			return (CellType)((packedCells[index / cellsPerByte] >> ((index % cellsPerByte) * bitsPerCell)) & 3u);
+		}
+
+		static CellType fromChar(char blockType)
+		{
+			switch(blockType)
+			{
+				case 'P':	return PENETRABLE;
+
+				case 'I':	return IMPENETRABLE;
+
+				default:	return EMPTY;
+			}
+		}
+
+		static char toChar(CellType type)
+		{
+			switch(type)
+			{
+				case PENETRABLE:	return 'P';
+
+				case IMPENETRABLE:	return 'I';
+
+				default:			return '.';
+			}
+		}
+
+		/**
+		  * Writes the grid in the text .block format.
+		  */
+		friend ostream& operator << (ostream& out, const BlockGrid& grid)
+		{
+			out << grid.height << " " << grid.rows << " " << grid.columns << "\n";
+
+			for(size_type i = 0; i < grid.height; i++)
+			{
+				out << "\n";
+
+				for(size_type j = 0; j < grid.rows; j++)
+				{
+					for(size_type k = 0; k < grid.columns; k++)
+						out << toChar(grid.getCellType(i, j, k));
+
+					out << "\n";
+				}
+			}
+
+			return out;
+		}
+
+	private:
+		size_type getIndex(size_type height, size_type row, size_type column) const { return (height * rows + row) * columns + column; }
+};
+
+#endif /*BLOCKGRID_H_*/
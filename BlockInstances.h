@@ -0,0 +1,303 @@
+#ifndef BLOCKINSTANCES_H_
+#define BLOCKINSTANCES_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint32_t
+#include <cassert>		//assert
+#include <vector>		//vector
+#include <memory>		//unique_ptr
+#include <stdexcept>	//runtime_error
+#include <iostream>		//cerr
+
+#include "Vector4.h"
+#include "Cube.h"
+#include "ShaderProgram.h"
+#include "SceneLighting.h"
+
+using namespace std;
+
+/**
+  * @brief This class draws every block of a structure as an instance of one shared cube with a single instanced draw call.
+  * Each instance is a single 32-bit word holding the block's column, row and height (10 bits each) and its palette index (2 bits),
+  * so touching a block rewrites four bytes of the instance buffer.  A structure with a side of 1024 blocks or more cannot be packed,
+  * and draw() then leaves it to the batched mesh.  The colour of each block comes from its palette index, and it is lit
+  * in the shader from the lights and material of SceneLighting, so the result matches the other render paths.
+  * @see BlockStructure
+  */
+class BlockInstances
+{
+	public:
+		typedef size_t size_type;
+
+		static const unsigned coordinateBits = 10;
+		static const unsigned paletteSize = 3;
+
+	private:
+		enum { x, y, z, w };
+		enum { positionAttribute, normalAttribute, instanceAttribute };
+
+		vector<uint32_t> instances;
+		Vector4 origin;
+		GLfloat blockSize;
+		Vector4 palette[paletteSize];
+		bool packable;
+
+		//Instances whose palette index changed since the buffer was last updated
+		mutable vector<uint32_t> changedInstances;
+
+		mutable GLuint vertexArray, cubeBuffer, instanceBuffer;
+		mutable GLsizei cubeVertexCount;
+		mutable unique_ptr<ShaderProgram> program;
+		mutable bool failed;
+
+		BlockInstances(const BlockInstances&);
+		BlockInstances& operator = (const BlockInstances&);
+
+	public:
+		BlockInstances() : blockSize(1.0), packable(true), vertexArray(0), cubeBuffer(0), instanceBuffer(0), cubeVertexCount(0), failed(false) {}
+
+		~BlockInstances() { release(); }
+
+		/**
+		  * Removes every instance.  This makes no GL calls.
+		  * @param origin the center of the cell at height, row and column 0
+		  * @param blockSize the length of a block's side
+		  * @param palette the colours selected by each instance's palette index
+		  * @param height the height of the structure whose blocks are added next
+		  * @param rows the rows of that structure
+		  * @param columns the columns of that structure
+		  */
+		void clear(const Vector4& origin, GLfloat blockSize, const Vector4 (&palette)[paletteSize], size_type height, size_type rows, size_type columns)
+		{
+			release();
+
+			instances.clear();
+			changedInstances.clear();
+
+			this -> origin = origin;
+			this -> blockSize = blockSize;
+			packable = height < (1u << coordinateBits) && rows < (1u << coordinateBits) && columns < (1u << coordinateBits);
+
+			for(unsigned i = 0; i < paletteSize; i++)
+				this -> palette[i] = palette[i];
+		}
+
+		/**
+		  * @return false if the dimensions given to clear() are too large to pack, in which case no block may be added
+		  */
+		bool isPackable() const { return packable; }
+
+		/**
+		  * Adds a block.  This makes no GL calls.
+		  * This method throws a runtime_error if the block's cell cannot be packed.
+		  * @return the index of the new instance
+		  */
+		uint32_t add(size_type height, size_type row, size_type column, unsigned paletteIndex)
+		{
+			assert(paletteIndex < paletteSize);
+
+			if(!packable || height >= (1u << coordinateBits) || row >= (1u << coordinateBits) || column >= (1u << coordinateBits))
+				throw runtime_error("The block is too far from the origin to be drawn instanced.");
+
+			instances.push_back(pack(height, row, column, paletteIndex));
+
+			return (uint32_t)(instances.size() - 1);
+		}
+
+		/**
+		  * Changes the palette index of one instance.  Only that instance is uploaded on the next draw.
+		  */
+		void setPaletteIndex(uint32_t instance, unsigned paletteIndex)
+		{
+			assert(instance < instances.size() && paletteIndex < paletteSize);
+
+			instances[instance] = (instances[instance] & ~(3u << 3 * coordinateBits)) | (paletteIndex << 3 * coordinateBits);
+			changedInstances.push_back(instance);
+		}
+
+		/**
+		  * Draws every block, lit by the uniform buffer of SceneLighting, which must be bound.  This must be called on the thread which owns the GL context.
+		  * @return false if instanced drawing is not available or the structure is too large to pack, in which case nothing was drawn
+		  */
+		bool draw() const
+		{
+			if(failed || !packable)
+				return false;
+
+			if(instances.empty())
+				return true;
+
+			if(vertexArray == 0 && !upload())
+				return false;
+
+			updateChangedInstances();
+
+			GLint previousProgram;
+
+			glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+			program -> use();
+
+			glBindVertexArray(vertexArray);
+			glDrawArraysInstanced(GL_TRIANGLES, 0, cubeVertexCount, (GLsizei)instances.size());
+			glBindVertexArray(0);
+
+			glUseProgram(previousProgram);
+
+			return true;
+		}
+
+		/**
+		  * Frees the buffers and the shader.  This must be called on the thread which owns the GL context.
+		  */
+		void release() const
+		{
+			if(vertexArray != 0)
+				glDeleteVertexArrays(1, &vertexArray);
+
+			if(cubeBuffer != 0)
+				glDeleteBuffers(1, &cubeBuffer);
+
+			if(instanceBuffer != 0)
+				glDeleteBuffers(1, &instanceBuffer);
+
+			vertexArray = cubeBuffer = instanceBuffer = 0;
+			program.reset();
+		}
+
+		size_type getInstanceCount() const { return instances.size(); }
+
+	private:
+		static uint32_t pack(size_type height, size_type row, size_type column, unsigned paletteIndex)
+		{
+			return (uint32_t)column | (uint32_t)row << coordinateBits | (uint32_t)height << 2 * coordinateBits | (uint32_t)paletteIndex << 3 * coordinateBits;
+		}
+
+		bool upload() const
+		{
+			try
+			{
+				ShaderProgram::AttributeList attributes;
+
+				attributes.push_back(make_pair((GLuint)positionAttribute, string("position")));
+				attributes.push_back(make_pair((GLuint)normalAttribute, string("normal")));
+				attributes.push_back(make_pair((GLuint)instanceAttribute, string("instance")));
+
+				program.reset(new ShaderProgram(string("#version 130\n") + SceneLighting::shadingSource + vertexSource, fragmentSource, attributes));
+			}
+			catch(const runtime_error& e)
+			{
+				cerr << e.what() << endl;
+				failed = true;
+
+				return false;
+			}
+
+			//One unit cube, scaled by the shader, with a normal for every vertex
+			Cube cube(1.0);
+			vector<GLfloat> cubeVertices;
+
+			for(size_type i = 0; i < cube.getVertices().size(); i++)
+			{
+				const Vector4& position = cube.getVertices()[i];
+				const Vector4& normal = cube.getNormals()[i / 3];
+
+				cubeVertices.insert(cubeVertices.end(), position.begin(), position.begin() + 3);
+				cubeVertices.insert(cubeVertices.end(), normal.begin(), normal.begin() + 3);
+			}
+
+			cubeVertexCount = (GLsizei)cube.getVertices().size();
+
+			glGenVertexArrays(1, &vertexArray);
+			glGenBuffers(1, &cubeBuffer);
+			glGenBuffers(1, &instanceBuffer);
+
+			glBindVertexArray(vertexArray);
+
+			glBindBuffer(GL_ARRAY_BUFFER, cubeBuffer);
+			glBufferData(GL_ARRAY_BUFFER, cubeVertices.size() * sizeof(GLfloat), cubeVertices.data(), GL_STATIC_DRAW);
+			glEnableVertexAttribArray(positionAttribute);
+			glVertexAttribPointer(positionAttribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)0);
+			glEnableVertexAttribArray(normalAttribute);
+			glVertexAttribPointer(normalAttribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)(3 * sizeof(GLfloat)));
+
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(uint32_t), instances.data(), GL_DYNAMIC_DRAW);
+			glEnableVertexAttribArray(instanceAttribute);
+			glVertexAttribIPointer(instanceAttribute, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (const void*)0);
+			glVertexAttribDivisor(instanceAttribute, 1);
+
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			GLint previousProgram;
+
+			glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+			program -> use();
+			glUniform3f(program -> getUniformLocation("origin"), origin[x], origin[y], origin[z]);
+			glUniform1f(program -> getUniformLocation("blockSize"), blockSize);
+			glUniform4fv(program -> getUniformLocation("palette"), paletteSize, palette[0].data());
+			glUseProgram(previousProgram);
+
+			SceneLighting::bindBlock(*program);
+			changedInstances.clear();
+
+			return true;
+		}
+
+		void updateChangedInstances() const
+		{
+			if(changedInstances.empty())
+				return;
+
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+			for(vector<uint32_t>::const_iterator i = changedInstances.begin(); i != changedInstances.end(); i++)
+				glBufferSubData(GL_ARRAY_BUFFER, *i * sizeof(uint32_t), sizeof(uint32_t), &instances[*i]);
+
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			changedInstances.clear();
+		}
+
+		static const char* const vertexSource;
+		static const char* const fragmentSource;
+};
+
+//Follows SceneLighting::shadingSource, which supplies the version's extensions and shade()
+const char* const BlockInstances::vertexSource = R"(
+in vec3 position;
+in vec3 normal;
+in uint instance;
+
+uniform vec3 origin;
+uniform float blockSize;
+uniform vec4 palette[3];
+
+out vec4 color;
+
+void main()
+{
+	vec3 cell = vec3(float(instance & 1023u), float((instance >> 20) & 1023u), float((instance >> 10) & 1023u));
+	vec4 worldPosition = vec4(origin + (cell + position) * blockSize, 1.0);
+	vec4 materialColor = palette[instance >> 30];
+
+	color = shade(vec3(gl_ModelViewMatrix * worldPosition), normalize(gl_NormalMatrix * normal), materialColor);
+
+	gl_Position = gl_ModelViewProjectionMatrix * worldPosition;
+}
+)";
+
+const char* const BlockInstances::fragmentSource = R"(
+#version 130
+
+in vec4 color;
+
+void main()
+{
+	gl_FragColor = color;
+}
+)";
+
+#endif /*BLOCKINSTANCES_H_*/
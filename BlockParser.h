@@ -0,0 +1,277 @@
+#ifndef BLOCKPARSER_H_
+#define BLOCKPARSER_H_
+
+#include <cstddef>		//size_t
+#include <cstdio>		//FILE, fopen and fread
+#include <cstdint>		//uint8_t
+#include <vector>		//vector
+#include <string>		//string
+#include <sstream>		//ostringstream
+#include <stdexcept>	//runtime_error
+#include <functional>	//function
+
+#include "BlockGrid.h"
+
+using namespace std;
+
+/**
+  * @brief This exception is thrown by BlockParser for malformed input and records where the problem was found.
+  */
+class BlockParseError : public runtime_error
+{
+	private:
+		size_t line, column;
+
+	public:
+		BlockParseError(const string& filePath, size_t line, size_t column, const string& message) : runtime_error(format(filePath, line, column, message)), line(line), column(column) {}
+
+		size_t getLine() const { return line; }
+
+		size_t getColumn() const { return column; }
+
+	private:
+		static string format(const string& filePath, size_t line, size_t column, const string& message)
+		{
+			ostringstream out;
+
+			out << "'" << filePath << "' line " << line << ", column " << column << ": " << message;
+
+			return out.str();
+		}
+};
+
+/**
+  * @brief This class reads the text .block format through a large buffer and writes cells straight into a BlockGrid.
+  * Besides the three dimensions, only 'P', 'I', '.' and whitespace are accepted, and the number of cells must match the dimensions exactly.
+  * @see BlockGrid
+  */
+class BlockParser
+{
+	public:
+		typedef size_t size_type;
+
+		/**
+		  * Called after each buffer is consumed with the number of bytes read so far and the size of the file.
+		  */
+		typedef function<void (size_type bytesRead, size_type totalBytes)> ProgressCallback;
+
+	private:
+		static const size_type bufferSize = 1 << 20;
+
+		//Character classes; the cell types share their BlockGrid::CellType values.
+		enum { INVALID = 3, SPACE, NEWLINE, DIGIT };
+
+		string filePath;
+		ProgressCallback progress;
+		FILE* file;
+		vector<char> buffer;
+		const char* current;
+		const char* end;
+		size_type bytesRead, totalBytes;
+		size_type line, lineStart;
+
+		BlockParser(const BlockParser&);
+		BlockParser& operator = (const BlockParser&);
+
+	public:
+		/**
+		  * Opens filePath for parsing.  This throws a runtime_error if the file does not exist.
+		  */
+		BlockParser(const string& filePath, const ProgressCallback& progress = ProgressCallback()) : filePath(filePath), progress(progress), file(fopen(filePath.c_str(), "rb")), buffer(bufferSize), current(NULL), end(NULL), bytesRead(0), totalBytes(0), line(1), lineStart(0)
+		{
+			if(file == NULL)
+				throw runtime_error("The specified file '" + filePath + "' does not exist.");
+
+			if(fseek(file, 0, SEEK_END) == 0)
+			{
+				long size = ftell(file);
+
+				totalBytes = size > 0 ? (size_type)size : 0;
+				fseek(file, 0, SEEK_SET);
+			}
+		}
+
+		~BlockParser() { fclose(file); }
+
+		/**
+		  * Replaces the contents of grid with the parsed puzzle.  This throws a BlockParseError if the input is malformed.
+		  */
+		void parse(BlockGrid& grid)
+		{
+			size_type height = readDimension("height");
+			size_type rows = readDimension("rows");
+			size_type columns = readDimension("columns");
+
+			if(height == 0 || rows == 0 || columns == 0)
+				fail("dimensions must be positive");
+
+			size_type cellCount;
+
+			if(!BlockGrid::countCells(height, rows, columns, cellCount))
+				fail("the puzzle is too large");
+
+			//Every cell takes at least one byte, so dimensions the rest of the file cannot fill are rejected before the grid is allocated
+			const size_type offset = getOffset(current);
+			const size_type remaining = totalBytes > offset ? totalBytes - offset : 0;
+
+			if(cellCount > remaining)
+			{
+				ostringstream message;
+
+				message << "a " << height << "x" << rows << "x" << columns << " puzzle needs " << cellCount << " cells but only " << remaining << " bytes remain";
+				fail(message.str());
+			}
+
+			grid = BlockGrid(height, rows, columns);
+
+			const unsigned char* classes = getClasses();
+			uint8_t* cells = grid.getPackedCells();
+			size_type cellIndex = 0;
+
+			while(fill())
+			{
+				for(const char* i = current; i != end; i++)
+				{
+					unsigned char type = classes[(unsigned char)*i];
+
+					if(type <= BlockGrid::IMPENETRABLE)
+					{
+						if(cellIndex == cellCount)
+						{
+							current = i;
+							fail("more cells than the dimensions allow");
+						}
+
+						cells[cellIndex / BlockGrid::cellsPerByte] |= (uint8_t)(type << ((cellIndex % BlockGrid::cellsPerByte) * BlockGrid::bitsPerCell));
+						cellIndex++;
+					}
+					else if(type == NEWLINE)
+					{
+						line++;
+						lineStart = getOffset(i) + 1;
+					}
+					else if(type != SPACE)
+					{
+						current = i;
+						fail(string("unexpected character '") + *i + "'");
+					}
+				}
+
+				current = end;
+			}
+
+			if(cellIndex != cellCount)
+			{
+				ostringstream message;
+
+				message << "expected " << cellCount << " cells for a " << height << "x" << rows << "x" << columns << " puzzle but found " << cellIndex;
+				fail(message.str());
+			}
+		}
+
+	private:
+		/**
+		  * Makes sure there is unread input in the buffer.
+		  * @return false at the end of the file
+		  */
+		bool fill()
+		{
+			if(current != end)
+				return true;
+
+			size_type count = fread(buffer.data(), 1, buffer.size(), file);
+
+			if(count == 0)
+				return false;
+
+			bytesRead += count;
+			current = buffer.data();
+			end = current + count;
+
+			if(progress)
+				progress(bytesRead, totalBytes < bytesRead ? bytesRead : totalBytes);
+
+			return true;
+		}
+
+		size_type readDimension(const char* name)
+		{
+			const unsigned char* classes = getClasses();
+
+			//Skip leading whitespace
+			for(; fill() && classes[(unsigned char)*current] >= SPACE && classes[(unsigned char)*current] <= NEWLINE; current++)
+				if(classes[(unsigned char)*current] == NEWLINE)
+				{
+					line++;
+					lineStart = getOffset(current) + 1;
+				}
+
+			if(!fill() || classes[(unsigned char)*current] != DIGIT)
+				fail(string("expected the puzzle ") + name);
+
+			size_type value = 0;
+
+			for(; fill() && classes[(unsigned char)*current] == DIGIT; current++)
+			{
+				if(value > (size_type)1 << 24)
+					fail(string("the puzzle ") + name + " is too large");
+
+				value = value * 10 + (*current - '0');
+			}
+
+			return value;
+		}
+
+		/**
+		  * @return the offset of position within the whole file
+		  */
+		size_type getOffset(const char* position) const { return bytesRead - (end - position); }
+
+		void fail(const string& message) const
+		{
+			size_type offset = current != NULL ? getOffset(current) : bytesRead;
+
+			throw BlockParseError(filePath, line, offset - lineStart + 1, message);
+		}
+
+		static const unsigned char* getClasses()
+		{
+			struct ClassTable
+			{
+				unsigned char classes[256];
+
+				ClassTable()
+				{
+					for(unsigned i = 0; i < 256; i++)
+						classes[i] = INVALID;
+
+					for(unsigned i = '0'; i <= '9'; i++)
+						classes[i] = DIGIT;
+
+					classes[(unsigned char)'.'] = BlockGrid::EMPTY;
+					classes[(unsigned char)'P'] = BlockGrid::PENETRABLE;
+					classes[(unsigned char)'I'] = BlockGrid::IMPENETRABLE;
+					classes[(unsigned char)' '] = SPACE;
+					classes[(unsigned char)'\t'] = SPACE;
+					classes[(unsigned char)'\r'] = SPACE;
+					classes[(unsigned char)'\n'] = NEWLINE;
+				}
+			};
+
+			//Initialized once, even when several puzzles are parsed on different threads
+			static const ClassTable table;
+
+			return table.classes;
+		}
+};
+
+/**
+  * Reads a grid in the text .block format.
+  * @see BlockParser
+  */
+inline void operator >> (const string filePath, BlockGrid& grid)
+{
+	BlockParser(filePath).parse(grid);
+}
+
+#endif /*BLOCKPARSER_H_*/
@@ -3,19 +3,28 @@
 
 #include <cstddef>		//size_t
 #include <cassert>		//assert
-#include <fstream>		//ifstream
+#include <cmath>		//sqrt
+#include <algorithm>	//min and max
 #include <string>		//string
 #include <stdexcept>	//runtime_error
 #include <iostream>		//istream
+#include <functional>	//function
 
 #include "Block.h"
+#include "BlockGrid.h"
+#include "BlockParser.h"
+#include "BlockFile.h"
+#include "StructureMesh.h"
+#include "StructureShadowVolume.h"
+#include "BlockInstances.h"
+#include "WorkerPool.h"
 #include "Vector4.h"
-#include "Matrix44.h"
 
 using namespace std;
 
 /**
   * @brief This class models a structure of block objects.
+  * Structures are read from either the text .block format or the binary .blockb format.
   * @see AbstractBlock
   */
 class BlockStructure
@@ -23,19 +32,30 @@ class BlockStructure
 	public:
 		typedef size_t size_type;
 
+		typedef function<void (float fraction)> ProgressCallback;
+
+		/**
+		  * BATCHED draws a single vertex buffer holding every block's triangles; INSTANCED draws one shared cube once per block.
+		  */
+		enum RenderMode { BATCHED, INSTANCED };
+
 	private:
 		enum { x, y, z, w };
 		size_type height, rows, columns;
 		GLfloat blockSize;
 		Vector4 base;
+		Vector4 origin;
 		Block**** blocks;
+		StructureMesh mesh;
+		StructureShadowVolume shadowVolume;
+		BlockInstances instances;
 
 	public:
-		BlockStructure(const string filePath, GLfloat blockSize = 1.0, const Vector4& base = Vector4(0.0, 0.0, 0.0, 1.0)) : height(0.0), rows(0.0), columns(0.0), blockSize(blockSize), base(base[x], base[y], base[z], 0.0), blocks(0)
+		BlockStructure(const string filePath, GLfloat blockSize = 1.0, const Vector4& base = Vector4(0.0, 0.0, 0.0, 1.0), const ProgressCallback& progress = ProgressCallback()) : height(0.0), rows(0.0), columns(0.0), blockSize(blockSize), base(base[x], base[y], base[z], 0.0), blocks(0)
 		{
 			assert(base[w] == 1.0);
 
-			filePath >> *this;
+			load(filePath, progress);
 		}
 
 		~BlockStructure()
@@ -52,29 +72,37 @@ class BlockStructure
 		}
 
 		/**
-		  * Draws the BlockStructure
+		  * Draws the BlockStructure from buffers built when the structure was loaded.
+		  * The batched mesh holds only faces which can be seen, merged into larger quads where they share a plane and colour,
+		  * and skips the bricks of cells outside the view or hidden behind nearer bricks.
+		  * Instanced drawing falls back to the batched mesh if the driver cannot compile its shader or a side of the structure is too long to pack.
+		  * @param occlusionCulling false to draw every brick in the view frustum, for instance when drawing back faces into a shadow map
 		  */
-		void draw() const
+		void draw(RenderMode mode = BATCHED, bool occlusionCulling = true) const
 		{
-			for(size_type i = 0; i < height; i++)
-				for(size_type j = 0; j < rows; j++)
-					for(size_type k = 0; k < columns; k++)
-						if(hasBlock(i, j, k))
-							blocks[i][j][k] -> draw();
+			if(mode == INSTANCED && instances.draw())
+				return;
+
+			mesh.draw(occlusionCulling);
+		}
+
+		/**
+		  * Frees the structure's vertex buffers.  Call this on the thread which owns the GL context before the structure is deleted on another thread.
+		  */
+		void releaseGraphics() const
+		{
+			mesh.release();
+			shadowVolume.release();
+			instances.release();
 		}
 		
 		/**
 		  * Draws a "Shadow Volume" for use with the stenciled shadow volume algorithm
+		  * The whole structure casts a single volume, extruded from the silhouette of its outer faces.  Only the parts cast by bricks whose
+		  * shadow can reach the view are drawn.
 		  * @param lightPosition the light source which determines how edges are extruded to form the shadow volume
 		  */
-		void drawShadowVolume(const Vector4& lightPosition) const
-		{
-			for(size_type i = 0; i < height; i++)
-				for(size_type j = 0; j < rows; j++)
-					for(size_type k = 0; k < columns; k++)
-						if(hasBlock(i, j, k))
-							blocks[i][j][k] -> drawShadowVolume(lightPosition);
-		}
+		void drawShadowVolume(const Vector4& lightPosition) const { shadowVolume.draw(lightPosition); }
 		
 		/**
 		  * Sets the state of a particular block to "touched."
@@ -91,7 +119,14 @@ class BlockStructure
 
 			assert(hasBlock(height, row, column));
 
-			blocks[height][row][column] -> touch();
+			Block& block = *blocks[height][row][column];
+
+			block.touch();
+
+			if(instances.isPackable())
+				instances.setPaletteIndex(block.getInstance(), block.getPaletteIndex());
+
+			mesh.setPaletteIndex((height * rows + row) * columns + column, block.getPaletteIndex());
 		}
 
 		/**
@@ -112,7 +147,7 @@ class BlockStructure
 			return isInBounds(height, row, column) && blocks[height][row][column] != NULL && blocks[height][row][column] -> isImpenetrable();
 		}
 
-		bool hasTouchedBlock(size_type height, size_type row, size_type column)
+		bool hasTouchedBlock(size_type height, size_type row, size_type column) const
 		{
 			return hasBlock(height, row, column) && blocks[height][row][column] -> hasBeenTouched();
 		}
@@ -132,21 +167,32 @@ class BlockStructure
 			if(!hasBlock(height, row, column))
 				throw runtime_error("A block does not exist at the specified location.");
 			
-			//NOTE: WE SHOULD BE ABLE TO REPLACE THIS WITH A CALL TO A GETLOCATION METHOD THAT RESIDES WITHIN BLOCK 
-			//NOTE: Need to stop computing this so many times
-			GLfloat upperLeftCornerX = base[x] - (columns / 2) * blockSize, upperLeftCornerZ = base[z] - (rows / 2) * blockSize;
+			return Vector4(	origin[x] + column * blockSize,
+							origin[y] + blockSize * height,
+							origin[z] + row * blockSize,
+							1.0);
+		}
 
-			if(columns % 2 == 0)
-				upperLeftCornerX += blockSize / 2.0;
+		/**
+		  * @return the center of the cell at height, row and column 0, with respect to the standard basis
+		  */
+		const Vector4& getOrigin() const { return origin; }
 
-			if(rows % 2 == 0)
-				upperLeftCornerZ += blockSize / 2.0;
-			
-			return Vector4(	upperLeftCornerX + column * blockSize,
-							base[y] + blockSize / 2.0 + blockSize * height,
-							upperLeftCornerZ + row * blockSize,
+		/**
+		  * @return the center of the box holding every cell, with respect to the standard basis
+		  */
+		const Vector4 getCenter() const
+		{
+			return Vector4(	origin[x] + (columns - 1.0f) * blockSize / 2.0f,
+							origin[y] + (height - 1.0f) * blockSize / 2.0f,
+							origin[z] + (rows - 1.0f) * blockSize / 2.0f,
 							1.0);
 		}
+
+		/**
+		  * @return the radius of the smallest sphere about getCenter() which holds every cell
+		  */
+		GLfloat getBoundingRadius() const { return blockSize / 2.0f * sqrt((GLfloat)(columns * columns + height * height + rows * rows)); }
 		
 		/**
 		  * @return the size of the blocks that exist within the structure
@@ -175,89 +221,123 @@ class BlockStructure
 
 		friend void operator >> (const string filePath, BlockStructure& blockStructure)
 		{
-			ifstream in(filePath.c_str());
-			
-			if(in.fail())
-				throw runtime_error("The specified file '" + string(filePath) + "' does not exist.");
+			blockStructure.load(filePath, ProgressCallback());
+		}
+		
+		/**
+		  * Replaces the blocks with the puzzle at filePath.  This makes no GL calls and may run on any thread.
+		  * @param progress if set, receives the fraction of the load completed, from 0 to 1
+		  */
+		void load(const string& filePath, const ProgressCallback& progress)
+		{
+			//Binary puzzles are mapped and read in place, without parsing.
+			if(BlockFile::isBinaryPath(filePath))
+			{
+				BlockFile file(filePath);
+
+				build(file, progress);
+			}
+			else
+			{
+				BlockGrid grid;
+				BlockParser::ProgressCallback parserProgress;
+
+				//Reading the text accounts for the first half of the progress, building the blocks for the second.
+				if(progress)
+					parserProgress = [&progress](size_t bytesRead, size_t totalBytes) { progress(0.5f * bytesRead / totalBytes); };
 
-			cout << "file exists " << filePath << endl;
-	
+				BlockParser(filePath, parserProgress).parse(grid);
 
+				build(grid, progress);
+			}
+		}
+
+	private:
+		/**
+		  * Replaces any existing blocks with the cells supplied by source.
+		  * @param source any type providing getHeight(), getRows(), getColumns() and getCellType(height, row, column), such as BlockGrid or BlockFile
+		  */
+		template<typename CellSource>
+		void build(const CellSource& source, const ProgressCallback& progress)
+		{
 			//Deallocate any existing blocks
-			for(size_type i = 0; i < blockStructure.height; i++)
+			for(size_type i = 0; i < height; i++)
 			{
-				for(size_type j = 0; j < blockStructure.rows; j++)
-					delete[] blockStructure.blocks[i][j];
+				for(size_type j = 0; j < rows; j++)
+					delete[] blocks[i][j];
 
-				delete[] blockStructure.blocks[i];
+				delete[] blocks[i];
 			}
 
-			delete[] blockStructure.blocks;
+			delete[] blocks;
 
-			Matrix44 blockOrientation;
 			GLfloat upperLeftCornerX, upperLeftCornerZ;
 
-			in >> blockStructure.height;
-			in >> blockStructure.rows;
-			in >> blockStructure.columns;
-
-			cout << "height " << blockStructure.height << endl;
+			height = source.getHeight();
+			rows = source.getRows();
+			columns = source.getColumns();
 
-			blockStructure.blocks = new Block ***[blockStructure.height];
+			blocks = new Block ***[height];
 			
-			upperLeftCornerX = (blockStructure.columns / 2) * -blockStructure.blockSize;
-			upperLeftCornerZ = (blockStructure.rows / 2) * -blockStructure.blockSize;
+			upperLeftCornerX = (columns / 2) * -blockSize;
+			upperLeftCornerZ = (rows / 2) * -blockSize;
 
-			if(blockStructure.columns % 2 == 0)
-				upperLeftCornerX += blockStructure.blockSize / 2.0;
+			if(columns % 2 == 0)
+				upperLeftCornerX += blockSize / 2.0;
 
-			if(blockStructure.rows % 2 == 0)
-				upperLeftCornerZ += blockStructure.blockSize / 2.0;
-			
-			glMatrixMode(GL_MODELVIEW);
+			if(rows % 2 == 0)
+				upperLeftCornerZ += blockSize / 2.0;
+
+			origin = Vector4(base[x] + upperLeftCornerX, base[y] + blockSize / 2.0f, base[z] + upperLeftCornerZ, 1.0);
+			instances.clear(origin, blockSize, Block::getPalette(), height, rows, columns);
 			
-			glPushMatrix();
-				glLoadIdentity();
-				glTranslatef(blockStructure.base[x], blockStructure.base[y], blockStructure.base[z]);
-				
-				for(size_type i = 0; i < blockStructure.height; i++)
+			WorkerPool& pool = WorkerPool::getShared();
+
+			//Layers are built in parallel, a group at a time so that progress is reported from this thread
+			const size_type layersPerGroup = max(pool.getThreadCount() * 4, height / 16);
+
+			for(size_type group = 0; group < height; group += layersPerGroup)
+			{
+				pool.parallelFor(min(layersPerGroup, height - group), [&, group](size_t layer)
 				{
-					blockStructure.blocks[i] = new Block * *[blockStructure.rows];
-	
-					for(size_type j = 0; j < blockStructure.rows; j++)
-					{	
-						blockStructure.blocks[i][j] = new Block * [blockStructure.columns];
-	
-						for(size_type k = 0; k < blockStructure.columns; k++)
-						{
-							glPushMatrix();
-								glTranslatef(upperLeftCornerX + k * blockStructure.blockSize, blockStructure.blockSize / 2.0 + blockStructure.blockSize * i, upperLeftCornerZ + j * blockStructure.blockSize);
-								glGetFloatv(GL_MODELVIEW_MATRIX, blockOrientation);
-							glPopMatrix();
-	
-							char blockType;
-	
-							in >> blockType;
-	
-							switch(blockType)
+					const size_type i = group + layer;
+
+					blocks[i] = new Block * *[rows];
+
+					for(size_type j = 0; j < rows; j++)
+					{
+						blocks[i][j] = new Block * [columns];
+
+						for(size_type k = 0; k < columns; k++)
+							switch(source.getCellType(i, j, k))
 							{
-							case 'P':	
-											blockStructure.blocks[i][j][k] = new Block(true, blockStructure.blockSize, blockOrientation);	
-											break;
-											
-								case 'I' :	blockStructure.blocks[i][j][k] = new Block(false, blockStructure.blockSize, blockOrientation);	
-											break;
-								
-								default :	blockStructure.blocks[i][j][k] = NULL;
+								case BlockGrid::PENETRABLE :	blocks[i][j][k] = new Block(true);
+																break;
+
+								case BlockGrid::IMPENETRABLE :	blocks[i][j][k] = new Block(false);
+																break;
+
+								default :						blocks[i][j][k] = NULL;
 							}
-						}
 					}
-				}
-				
-			glPopMatrix();
+				});
+
+				if(progress)
+					progress(0.5f + 0.5f * min(group + layersPerGroup, height) / height);
+			}
+
+			//Instances are numbered in cell order, so they are added once every layer is built.  A structure too large to pack is only drawn batched.
+			if(instances.isPackable())
+				for(size_type i = 0; i < height; i++)
+					for(size_type j = 0; j < rows; j++)
+						for(size_type k = 0; k < columns; k++)
+							if(blocks[i][j][k] != NULL)
+								blocks[i][j][k] -> setInstance(instances.add(i, j, k, blocks[i][j][k] -> getPaletteIndex()));
+
+			mesh.build(*this, origin, blockSize, Block::getPalette());
+			shadowVolume.build(*this, origin, blockSize);
 		}
-		
-	private:
+
 		/**
 		  * @param height the height in the grid
 		  * @param row the row in the grid
@@ -0,0 +1,386 @@
+#ifndef BRICKCULLER_H_
+#define BRICKCULLER_H_
+
+#include <cstddef>		//size_t
+#include <cstring>		//memcmp and memcpy
+#include <cmath>		//floor and ceil
+#include <algorithm>	//min and max
+#include <vector>		//vector
+#include <limits>		//numeric_limits
+
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class decides which bricks of a structure can be seen with the current GL projection and modelview matrices.
+  * A brick is a cube of cells, up to brickSize along each side, with the bounding box of what it draws.
+  *
+  * Bricks outside the view frustum are culled first.  The rest can be tested against a coarse depth buffer drawn on the CPU
+  * from the faces of the nearest bricks: a texel only takes a face's depth if the face covers all of it, and its depth is the
+  * farthest the face reaches inside the texel, so the test never hides a brick which can be seen.  Coarser levels keep the
+  * farthest depth of the four texels under them, which lets a brick of any size be tested against a handful of texels.
+  * @see StructureMesh
+  * @see StructureShadowVolume
+  */
+class BrickCuller
+{
+	public:
+		typedef size_t size_type;
+
+		enum { brickSize = 16 };
+
+		struct Box
+		{
+			GLfloat minimum[3], maximum[3];
+		};
+
+	private:
+		enum { x, y, z, w };
+		enum { depthWidth = 128, depthHeight = 96 };
+
+		//The most texels along each side a box is tested against
+		enum { testSpan = 8 };
+
+		//Clip coordinates of points closer to the eye than this are not projected
+		static const GLfloat nearestW;
+
+		GLfloat clip[16];			//Projection times modelview, column major
+		GLfloat planes[6][4];		//Inward facing
+		GLfloat pixelScale;			//Pixels covered by one unit at a clip w of one, vertically
+		bool valid;
+
+		//Level 0 is depthWidth by depthHeight; each level after it is half the size, rounded up
+		vector<vector<GLfloat> > depthLevels;
+		vector<size_type> levelWidths, levelHeights;
+
+		//Scratch space for the lattice of texel corners under one face
+		vector<GLfloat> cornerDepths;
+		vector<char> cornerInside;
+
+	public:
+		BrickCuller() : pixelScale(0.0f), valid(false) {}
+
+		/**
+		  * Takes the view from the current GL projection and modelview matrices and viewport.  This must be called on the thread which owns the GL context.
+		  * @return true if the view differs from the one taken last time
+		  */
+		bool setView()
+		{
+			GLfloat projection[16], modelview[16], product[16];
+			GLint viewport[4];
+
+			glGetFloatv(GL_PROJECTION_MATRIX, projection);
+			glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+			glGetIntegerv(GL_VIEWPORT, viewport);
+
+			const GLfloat scale = viewport[3] / 2.0f * projection[5];
+
+			for(unsigned column = 0; column < 4; column++)
+				for(unsigned row = 0; row < 4; row++)
+				{
+					product[column * 4 + row] = 0.0f;
+
+					for(unsigned k = 0; k < 4; k++)
+						product[column * 4 + row] += projection[k * 4 + row] * modelview[column * 4 + k];
+				}
+
+			if(valid && memcmp(product, clip, sizeof(clip)) == 0 && scale == pixelScale)
+				return false;
+
+			memcpy(clip, product, sizeof(clip));
+			pixelScale = scale;
+			valid = true;
+
+			//Each plane is the last row of the matrix plus or minus one of the others
+			for(unsigned i = 0; i < 6; i++)
+				for(unsigned k = 0; k < 4; k++)
+					planes[i][k] = clip[k * 4 + w] + (i % 2 == 0 ? 1.0f : -1.0f) * clip[k * 4 + i / 2];
+
+			return true;
+		}
+
+		/**
+		  * Forgets the view, so the next call to setView() reports a change.
+		  */
+		void invalidate() { valid = false; }
+
+		/**
+		  * @return false if box lies wholly outside the view frustum
+		  */
+		bool isInFrustum(const Box& box) const
+		{
+			for(unsigned i = 0; i < 6; i++)
+				if(getFarthestDistance(planes[i], box) < 0.0f)
+					return false;
+
+			return true;
+		}
+
+		/**
+		  * @return false if neither box nor the shadow it casts away from lightPosition can reach the view frustum
+		  */
+		bool isShadowInFrustum(const Box& box, const Vector4& lightPosition) const
+		{
+			for(unsigned i = 0; i < 6; i++)
+			{
+				const GLfloat* plane = planes[i];
+				const GLfloat farthest = getFarthestDistance(plane, box) - plane[w];
+				const GLfloat light = plane[x] * lightPosition[x] + plane[y] * lightPosition[y] + plane[z] * lightPosition[z];
+
+				//Every corner is outside and moving away from the light only takes it further out
+				if(farthest + plane[w] < 0.0f && farthest <= light)
+					return false;
+			}
+
+			return true;
+		}
+
+		/**
+		  * @return the distance from the eye to the center of box along the view direction, for sorting bricks front to back
+		  */
+		GLfloat getDepth(const Box& box) const
+		{
+			GLfloat center[3];
+
+			for(unsigned i = 0; i < 3; i++)
+				center[i] = (box.minimum[i] + box.maximum[i]) / 2.0f;
+
+			return clip[x * 4 + w] * center[x] + clip[y * 4 + w] * center[y] + clip[z * 4 + w] * center[z] + clip[w * 4 + w];
+		}
+
+		/**
+		  * @return the most pixels a unit of length anywhere in box can cover on screen, or a huge number if box reaches the eye
+		  */
+		GLfloat getPixelsPerUnit(const Box& box) const
+		{
+			GLfloat nearest = clip[w * 4 + w];
+
+			//The corner with the least clip w
+			for(unsigned k = 0; k < 3; k++)
+				nearest += clip[k * 4 + w] * (clip[k * 4 + w] < 0.0f ? box.maximum[k] : box.minimum[k]);
+
+			if(nearest <= nearestW)
+				return (numeric_limits<GLfloat>::max)();
+
+			return pixelScale / nearest;
+		}
+
+		/**
+		  * Empties the coarse depth buffer.
+		  */
+		void clearDepth()
+		{
+			if(depthLevels.empty())
+			{
+				for(size_type width = depthWidth, height = depthHeight; ; width = (width + 1) / 2, height = (height + 1) / 2)
+				{
+					levelWidths.push_back(width);
+					levelHeights.push_back(height);
+					depthLevels.push_back(vector<GLfloat>(width * height));
+
+					if(width == 1 && height == 1)
+						break;
+				}
+			}
+
+			depthLevels[0].assign(depthLevels[0].size(), 1.0f);
+		}
+
+		/**
+		  * Draws a planar convex quad into the coarse depth buffer.
+		  * @param corners the quad's corners in order around it, in world coordinates
+		  */
+		void addOccluder(const GLfloat (&corners)[4][3])
+		{
+			GLfloat window[4][3];
+
+			for(unsigned i = 0; i < 4; i++)
+				if(!project(corners[i], window[i]))
+					return;
+
+			//Twice the signed area; the face is seen from the front when its corners turn counterclockwise on screen
+			GLfloat area = 0.0f;
+
+			for(unsigned i = 0; i < 4; i++)
+				area += window[i][x] * window[(i + 1) % 4][y] - window[(i + 1) % 4][x] * window[i][y];
+
+			if(area <= 0.0f)
+				return;
+
+			GLfloat lowest[2] = { window[0][x], window[0][y] }, highest[2] = { window[0][x], window[0][y] };
+
+			for(unsigned i = 1; i < 4; i++)
+				for(unsigned k = 0; k < 2; k++)
+				{
+					lowest[k] = min(lowest[k], window[i][k]);
+					highest[k] = max(highest[k], window[i][k]);
+				}
+
+			//Only texels the quad covers completely are written, so the range is rounded inwards
+			const long left = max(0L, (long)ceil(lowest[x])), bottom = max(0L, (long)ceil(lowest[y]));
+			const long right = min((long)depthWidth, (long)floor(highest[x])), top = min((long)depthHeight, (long)floor(highest[y]));
+
+			if(right - left < 1 || top - bottom < 1)
+				return;
+
+			//The depth of a plane is an affine function of the window position
+			const GLfloat ax = window[1][x] - window[0][x], ay = window[1][y] - window[0][y], az = window[1][z] - window[0][z];
+			const GLfloat bx = window[2][x] - window[0][x], by = window[2][y] - window[0][y], bz = window[2][z] - window[0][z];
+			const GLfloat determinant = ax * by - ay * bx;
+
+			if(determinant == 0.0f)
+				return;
+
+			const GLfloat slopeX = (az * by - bz * ay) / determinant, slopeY = (bz * ax - az * bx) / determinant;
+			const size_type latticeWidth = right - left + 1, latticeHeight = top - bottom + 1;
+
+			cornerDepths.resize(latticeWidth * latticeHeight);
+			cornerInside.resize(latticeWidth * latticeHeight);
+
+			for(size_type j = 0; j < latticeHeight; j++)
+				for(size_type i = 0; i < latticeWidth; i++)
+				{
+					const GLfloat px = (GLfloat)(left + (long)i), py = (GLfloat)(bottom + (long)j);
+					bool inside = true;
+
+					for(unsigned k = 0; k < 4 && inside; k++)
+					{
+						const GLfloat* from = window[k];
+						const GLfloat* to = window[(k + 1) % 4];
+
+						inside = (to[x] - from[x]) * (py - from[y]) - (to[y] - from[y]) * (px - from[x]) >= 0.0f;
+					}
+
+					cornerInside[j * latticeWidth + i] = inside;
+					cornerDepths[j * latticeWidth + i] = window[0][z] + slopeX * (px - window[0][x]) + slopeY * (py - window[0][y]);
+				}
+
+			vector<GLfloat>& depth = depthLevels[0];
+
+			for(size_type j = 0; j + 1 < latticeHeight; j++)
+				for(size_type i = 0; i + 1 < latticeWidth; i++)
+				{
+					const size_type corner = j * latticeWidth + i;
+
+					if(!cornerInside[corner] || !cornerInside[corner + 1] || !cornerInside[corner + latticeWidth] || !cornerInside[corner + latticeWidth + 1])
+						continue;
+
+					const GLfloat farthest = max(max(cornerDepths[corner], cornerDepths[corner + 1]), max(cornerDepths[corner + latticeWidth], cornerDepths[corner + latticeWidth + 1]));
+					GLfloat& texel = depth[(bottom + j) * depthWidth + left + i];
+
+					texel = min(texel, farthest);
+				}
+		}
+
+		/**
+		  * Fills the coarser levels of the depth buffer.  Call this after the last occluder and before isOccluded().
+		  */
+		void buildHierarchy()
+		{
+			for(size_type level = 1; level < depthLevels.size(); level++)
+			{
+				const vector<GLfloat>& finer = depthLevels[level - 1];
+				const size_type finerWidth = levelWidths[level - 1], finerHeight = levelHeights[level - 1];
+
+				for(size_type j = 0; j < levelHeights[level]; j++)
+					for(size_type i = 0; i < levelWidths[level]; i++)
+					{
+						GLfloat farthest = 0.0f;
+
+						for(size_type l = 2 * j; l < min(2 * j + 2, finerHeight); l++)
+							for(size_type k = 2 * i; k < min(2 * i + 2, finerWidth); k++)
+								farthest = max(farthest, finer[l * finerWidth + k]);
+
+						depthLevels[level][j * levelWidths[level] + i] = farthest;
+					}
+			}
+		}
+
+		/**
+		  * @return true if everything in box lies behind the occluders drawn into the depth buffer
+		  */
+		bool isOccluded(const Box& box) const
+		{
+			GLfloat lowest[2] = { 0.0f, 0.0f }, highest[2] = { 0.0f, 0.0f }, nearest = 1.0f;
+
+			for(unsigned i = 0; i < 8; i++)
+			{
+				const GLfloat corner[3] = { i & 1 ? box.maximum[x] : box.minimum[x], i & 2 ? box.maximum[y] : box.minimum[y], i & 4 ? box.maximum[z] : box.minimum[z] };
+				GLfloat window[3];
+
+				//A box reaching behind the eye is never hidden
+				if(!project(corner, window))
+					return false;
+
+				for(unsigned k = 0; k < 2; k++)
+				{
+					lowest[k] = i == 0 ? window[k] : min(lowest[k], window[k]);
+					highest[k] = i == 0 ? window[k] : max(highest[k], window[k]);
+				}
+
+				nearest = min(nearest, window[z]);
+			}
+
+			const long left = max(0L, (long)floor(lowest[x])), bottom = max(0L, (long)floor(lowest[y]));
+			const long right = min((long)depthWidth - 1, (long)floor(highest[x])), top = min((long)depthHeight - 1, (long)floor(highest[y]));
+
+			if(right < left || top < bottom)
+				return false;
+
+			//Pick the finest level at which the box covers at most a few texels along each side.  Coarser texels reach further past the box.
+			size_type level = 0;
+
+			while(level + 1 < depthLevels.size() && ((right >> level) - (left >> level) >= testSpan || (top >> level) - (bottom >> level) >= testSpan))
+				level++;
+
+			const vector<GLfloat>& depth = depthLevels[level];
+			const size_type width = levelWidths[level], height = levelHeights[level];
+
+			for(size_type j = min((size_type)bottom >> level, height - 1); j <= min((size_type)top >> level, height - 1); j++)
+				for(size_type i = min((size_type)left >> level, width - 1); i <= min((size_type)right >> level, width - 1); i++)
+					if(depth[j * width + i] >= nearest)
+						return false;
+
+			return true;
+		}
+
+	private:
+		/**
+		  * @return the signed distance from plane to the corner of box farthest along its normal
+		  */
+		static GLfloat getFarthestDistance(const GLfloat* plane, const Box& box)
+		{
+			GLfloat distance = plane[w];
+
+			for(unsigned k = 0; k < 3; k++)
+				distance += plane[k] * (plane[k] > 0.0f ? box.maximum[k] : box.minimum[k]);
+
+			return distance;
+		}
+
+		/**
+		  * Projects a point to the coarse depth buffer: x and y in texels and z as window depth between 0 and 1.
+		  * @return false if the point is too close to or behind the eye
+		  */
+		bool project(const GLfloat (&point)[3], GLfloat (&window)[3]) const
+		{
+			GLfloat clipped[4];
+
+			for(unsigned row = 0; row < 4; row++)
+				clipped[row] = clip[x * 4 + row] * point[x] + clip[y * 4 + row] * point[y] + clip[z * 4 + row] * point[z] + clip[w * 4 + row];
+
+			if(clipped[w] < nearestW)
+				return false;
+
+			window[x] = (clipped[x] / clipped[w] * 0.5f + 0.5f) * depthWidth;
+			window[y] = (clipped[y] / clipped[w] * 0.5f + 0.5f) * depthHeight;
+			window[z] = clipped[z] / clipped[w] * 0.5f + 0.5f;
+
+			return true;
+		}
+};
+
+const GLfloat BrickCuller::nearestW = 1e-3f;
+
+#endif /*BRICKCULLER_H_*/
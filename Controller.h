@@ -3,10 +3,22 @@
 
 #include <string>	//string and rfind
 #include <iostream>	//cout
-#include <memory>	//auto_ptr
 #include <cassert>	//assert
+#include <thread>	//this_thread
+#include <chrono>	//milliseconds
+#include <functional>	//function
 
 #include "Vector4.h"
+#include "PuzzleCatalog.h"
+#include "LevelLoader.h"
+#include "TextureCache.h"
+#include "ShadowMap.h"
+#include "GLStateCache.h"
+#include "SceneLighting.h"
+#include "Simulation.h"
+#include "LineStrip.h"
+#include "DebugRenderer.h"
+#include "ThumbnailCache.h"
 
 using namespace std;
 
@@ -19,6 +31,12 @@ string path;
   */
 class Controller
 {
+	public:
+		/**
+		  * SHADOW_VOLUMES counts stencil shadow volumes; SHADOW_MAP tests against a depth map rendered from the light.
+		  */
+		enum ShadowMode { SHADOW_VOLUMES, SHADOW_MAP };
+
 	private:
 		static const GLfloat paddingRatio;
 		static const GLfloat blockSize;
@@ -31,6 +49,7 @@ class Controller
 		static const double angle;
 		static const double angle2;
 		static const float radius;
+		static const GLfloat laserWidth;
 
 		//Point Light
 		static const GLfloat light0Position[4];
@@ -45,31 +64,48 @@ class Controller
 		static const GLfloat light1DiffuseIntensity[4];
 		static const GLfloat light1AmbientIntensity[4];
 
-		//Dim Point Light (at same position as first point light)
+		//Dim Directional Light (shining from the eye along the view direction)
 		static const GLfloat light2Position[4];
 		static const GLfloat light2SpecularIntensity[4];
 		static const GLfloat light2DiffuseIntensity[4];
 		static const GLfloat light2AmbientIntensity[4];
 
+		//The ambient and diffuse colour of both materials is the colour of what is drawn
+		enum { blockMaterial, groundMaterial };
+
 		static const GLfloat Material1Specular[4];
-		static const GLfloat Material1Diffuse[4];
-		static const GLfloat Material1Ambient[4];
 		static const GLfloat Material1Shininess;
 
 		static const GLfloat Material2Specular[4];
-		static const GLfloat Material2Diffuse[4];
-		static const GLfloat Material2Ambient[4];
 		static const GLfloat Material2Shininess;
 
 
 
 
 		bool mainMenuEnabled, debugViewEnabled;
+		BlockStructure::RenderMode renderMode;
+		ShadowMode shadowMode;
 		GLfloat originalWindowWidth, originalWindowHeight, currentWindowWidth, currentWindowHeight;
 		BlockDriver blockDriver;
-		auto_ptr<BlockDriver::Laser> laser;
 		const BlockStructure* blockStructure;
+
+		//The laser moves on the simulation's thread; the render thread draws the path and touches the blocks it publishes
+		Simulation simulation;
+		bool manualStepping;
+		LineStrip laserPath;
+		size_t appliedTouches;
+
+		TextureCache textureCache;
 		GLuint groundTexture;
+		ShadowMap shadowMap;
+
+		//Mutable so the const debug view can draw through them
+		mutable GLStateCache stateCache;
+		mutable SceneLighting lighting;
+		mutable DebugRenderer debugRenderer;
+		PuzzleCatalog puzzleCatalog;
+		ThumbnailCache thumbnails;
+		LevelLoader levelLoader;
 
 	public:
 		Controller(	const GLfloat& windowWidth,
@@ -77,64 +113,41 @@ class Controller
 		
 					mainMenuEnabled(true),
 					debugViewEnabled(false),
+					renderMode(BlockStructure::BATCHED),
+					shadowMode(SHADOW_VOLUMES),
 
 					originalWindowWidth(windowWidth), originalWindowHeight(windowHeight),
 					currentWindowWidth(windowWidth), currentWindowHeight(windowHeight),
 
-					groundTexture(loadRawTexture("textures/psycho2.raw", 1))
-		{
-
-				//assert(fs::exists(blockStructurePath) && fs::is_directory(blockStructurePath));
-
-
-				WIN32_FIND_DATA ffd;
-				HANDLE hFind = INVALID_HANDLE_VALUE;
-				LARGE_INTEGER filesize;
-				hFind = FindFirstFile(L"puzzles\\*", &ffd);
-
+					simulation(blockDriver),
+					manualStepping(false),
+					appliedTouches(0),
 
+					groundTexture(textureCache.get("textures/psycho2.raw")),
 
-
-				blockStructure = blockDriver.getBlockStructure();
-
-		}
-
-		//Credit: http://www.nullterminator.net/gltexture.html
-		static GLuint loadRawTexture(const char* filename, int wrap)
+				puzzleCatalog("puzzles"),
+				thumbnails("thumbnails", blockSize, base)
 		{
-			GLuint texture;
-			int width, height;
-			void* data;
-			FILE* file;
-
-			// open texture data
-			file = fopen(filename, "rb");
-			if (file == NULL) return 0;
-
-			// allocate buffer
-			width = 512;
-			height = 512;
-			data = malloc(width * height * 3);
-
-			// read texture data
-			fread(data, width * height * 3, 1, file);
-			fclose(file);
-
-			// allocate a texture name
-			glGenTextures(1, &texture);
+				blockStructure = blockDriver.getBlockStructure();
 
-			// select our current texture
-			glBindTexture(GL_TEXTURE_2D, texture);
+				//The lights and materials never change, so they are written to the lighting buffer once
+				lighting.setPosition(0, light0Position);
+				lighting.setColors(0, light0AmbientIntensity, light0DiffuseIntensity, light0SpecularIntensity);
 
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+				lighting.setPosition(1, light1Position);
+				lighting.setColors(1, light1AmbientIntensity, light1DiffuseIntensity, light1SpecularIntensity);
+				lighting.setSpot(1, light1Direction, 90.0f, 1.0f);
+				lighting.setAttenuation(1, 1.0f, 0.0f, 0.0f);
 
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+				lighting.setPosition(2, light2Position, true);
+				lighting.setColors(2, light2AmbientIntensity, light2DiffuseIntensity, light2SpecularIntensity);
 
-			// free buffer
-			free(data);
+				lighting.setEnabled(0, true);
+				lighting.setEnabled(1, false);
+				lighting.setEnabled(2, true);
 
-			return texture;
+				lighting.setMaterial(blockMaterial, Material1Specular, Material1Shininess);
+				lighting.setMaterial(groundMaterial, Material2Specular, Material2Shininess);
 		}
 
 		void sendKeyPress(int key)
@@ -147,75 +160,145 @@ class Controller
 		
 
 											mainMenuEnabled = true;
-											laser.reset();
+											simulation.stop();
 											blockDriver.unload();
 										}
 										break;
 
 				case GLFW_KEY_F2:		debugViewEnabled = !debugViewEnabled;
-					
+
+										//The simulation only finds the overlays while they are shown, so they are filled in by the next snapshot
+										simulation.setDebugView(debugViewEnabled);
+
+										if(debugViewEnabled && simulation.isStarted())
+											updateDebugView();
+										break;
+
+				case GLFW_KEY_F3:		renderMode = renderMode == BlockStructure::BATCHED ? BlockStructure::INSTANCED : BlockStructure::BATCHED;
+										break;
+
+				case GLFW_KEY_F4:		shadowMode = shadowMode == SHADOW_VOLUMES ? SHADOW_MAP : SHADOW_VOLUMES;
 										break;
 
-				case GLFW_KEY_P:		if(laser.get() != 0 && blockDriver.isLoaded()) laser -> setMobile(!laser -> isMobile());
+				case GLFW_KEY_P:		if(simulation.isStarted()) simulation.send(Simulation::TOGGLE_MOBILE);
 										break;
 
-				case GLFW_KEY_UP:		if(laser.get() != 0 && blockDriver.isLoaded()) laser -> turn(BlockDriver::Laser::UP);
+				case GLFW_KEY_UP:		if(simulation.isStarted()) simulation.send(Simulation::TURN_UP);
 										break;
 
-				case GLFW_KEY_DOWN:		if(laser.get() != 0 && blockDriver.isLoaded()) laser -> turn(BlockDriver::Laser::DOWN);
+				case GLFW_KEY_DOWN:		if(simulation.isStarted()) simulation.send(Simulation::TURN_DOWN);
 										break;
 
-				case GLFW_KEY_LEFT:		if(laser.get() != 0 && blockDriver.isLoaded()) laser -> turn(BlockDriver::Laser::LEFT);
+				case GLFW_KEY_LEFT:		if(simulation.isStarted()) simulation.send(Simulation::TURN_LEFT);
 										break;
 
-				case GLFW_KEY_RIGHT:	if(laser.get() != 0 && blockDriver.isLoaded()) laser -> turn(BlockDriver::Laser::RIGHT);
+				case GLFW_KEY_RIGHT:	if(simulation.isStarted()) simulation.send(Simulation::TURN_RIGHT);
 										break;
 			}
 		}
 
 		void update()
 		{
+			textureCache.update();
+
+			//Puzzles are built in the background; the menu keeps drawing until the structure is ready.
 			if (pathset) {
 				pathset = false;
-				blockDriver.reset();
-				blockDriver.loadBlockStructure(new BlockStructure(path, 30.0, Vector4(0.0, 50.0, 0.0, 1.0)));
+				levelLoader.load(path, 30.0, Vector4(0.0, 50.0, 0.0, 1.0));
+			}
+
+			BlockStructure* loadedStructure = levelLoader.takeResult();
+
+			if (loadedStructure != NULL) {
+				simulation.stop();
+				debugRenderer.clearStructure();
+				LevelLoader::release(blockDriver.exchangeBlockStructure(loadedStructure));
 			}
 
 			if(blockDriver.isLoaded())
 			{
 				//We already have a game in progress.
-				if(laser.get() != 0)
+				if(simulation.isStarted())
 				{
-					if(laser -> isMobile())
-					{
-						laser -> move();
-					}
-					//Return to the main menu if we are not in debug mode
-					else if(!debugViewEnabled && laser -> isIdle())
-					{
+					applySnapshot();
 
+					const Simulation::Snapshot& snapshot = simulation.getSnapshot();
 
+					//Return to the main menu if we are not in debug mode
+					if(!snapshot.mobile && !debugViewEnabled && snapshot.idle)
+					{
 						mainMenuEnabled = true;
-						laser.reset();
+						simulation.stop();
 						blockDriver.unload();
 					}
 				}
-				//We must have just loaded a block structure, so let's get a new laser.
+				//We must have just loaded a block structure, so let's start a new game.
 				else
 				{
-					laser.reset();
-					laser = blockDriver.getLaser();
+					appliedTouches = 0;
+					simulation.start(!manualStepping);
 					mainMenuEnabled = false;
-
 				}
 			}
 		}
 
+		/**
+		  * Takes the latest snapshot from the simulation, touching the blocks the laser has entered since the last one.
+		  * This must be called on the thread which owns the GL context.
+		  */
+		void applySnapshot()
+		{
+			if(!simulation.acquire())
+				return;
+
+			const Simulation::Snapshot& snapshot = simulation.getSnapshot();
+			BlockStructure* structure = blockDriver.getBlockStructure();
+			const size_t rows = structure -> getRows(), columns = structure -> getColumns();
+
+			//Cells are only ever added to the list during a game, and a snapshot starts no later than the cells already applied
+			assert(snapshot.touchedStart <= appliedTouches);
+
+			for(; appliedTouches < snapshot.touchedStart + snapshot.touchedCells.size(); appliedTouches++)
+			{
+				const size_t cell = snapshot.touchedCells[appliedTouches - snapshot.touchedStart];
+
+				structure -> touchBlock(cell / (rows * columns), cell / columns % rows, cell % columns);
+			}
+
+			laserPath.assign(snapshot.pathStart, snapshot.path);
+
+			if(debugViewEnabled)
+				updateDebugView();
+		}
+
+		void updateDebugView()
+		{
+			const Simulation::Snapshot& snapshot = simulation.getSnapshot();
+			const BlockStructure* structure = blockDriver.getBlockStructure();
+
+			debugRenderer.setStructure(*structure);
+			debugRenderer.setProgress(snapshot.visitedCorners, snapshot.frontier, structure -> getBlockSize(), blockDriver.getThresholdRatio());
+		}
+
+		void drawLaser() const
+		{
+			const Simulation::Snapshot& snapshot = simulation.getSnapshot();
+
+			glMatrixMode(GL_MODELVIEW);
+
+			if(snapshot.mobile)			glColor3f(1.0, 0.5, 0.0);
+			else if(snapshot.won)		glColor3f(0.0, 1.0, 0.0);
+			else						glColor3f(1.0, 0.0, 0.0);
+
+			glEnable(GL_LINE_SMOOTH);
+			glLineWidth(laserWidth);
+			laserPath.draw();
+			glDisable(GL_LINE_SMOOTH);
+		}
+
 		void draw_menu() {
-			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			stateCache.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			glEnable(GL_DEPTH_BUFFER_BIT);
-			glDisable(GL_LIGHTING);
 
 			glMatrixMode(GL_MODELVIEW);
 			glPushMatrix();
@@ -226,14 +309,16 @@ class Controller
 
 			glLoadIdentity();
 			glOrtho(0, getWindowWidth(), 0, getWindowHeight(), -1, 1);
-			glDisable(GL_LIGHTING);
-			glDisable(GL_DEPTH_TEST);
-			glDepthFunc(GL_ALWAYS);
-			glEnable(GL_BLEND);
-
-			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			stateCache.disable(GL_DEPTH_TEST);
+			stateCache.depthFunc(GL_ALWAYS);
+			stateCache.enable(GL_BLEND);
 
+			stateCache.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+			//Draw the pictures of the puzzles shown in the last frame, within the menu's frame budget
+			lighting.selectMaterial(blockMaterial);
+			lighting.setTextured(false);
+			thumbnails.update(lighting);
 
 			ImGui_ImplOpenGL3_NewFrame();
 			ImGui_ImplGlfw_NewFrame();
@@ -245,37 +330,58 @@ class Controller
 			ImGui::Begin("Levels");                          // Create a window called "Hello, world!" and append into it.
 
 
-			WIN32_FIND_DATA ffd;
-			HANDLE hFind = INVALID_HANDLE_VALUE;
-			LARGE_INTEGER filesize;
-			hFind = FindFirstFile(L"puzzles\\*", &ffd);
+			//Pick up any puzzles added, changed or removed since the last frame
+			puzzleCatalog.refresh();
+
+			const vector<PuzzleCatalog::Entry>& puzzles = puzzleCatalog.getEntries();
+
+			if (levelLoader.isLoading())
+				ImGui::ProgressBar(levelLoader.getProgress());
+			else if (!levelLoader.getError().empty())
+				ImGui::TextWrapped("%s", levelLoader.getError().c_str());
 
+			ImGui::BeginDisabled(levelLoader.isLoading());
 
-			do
+			//Only the rows in view are laid out, so only their pictures are asked for
+			ImGuiListClipper clipper;
+
+			clipper.Begin((int)puzzles.size());
+
+			while (clipper.Step())
 			{
-				if (ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				for (vector<PuzzleCatalog::Entry>::const_iterator i = puzzles.begin() + clipper.DisplayStart; i != puzzles.begin() + clipper.DisplayEnd; i++)
 				{
-				}
-				else {
-					filesize.LowPart = ffd.nFileSizeLow;
-					filesize.HighPart = ffd.nFileSizeHigh;
+					ImGui::PushID(i -> fileName.c_str());
 
-					wstring ws(ffd.cFileName);
-					string str(ws.begin(), ws.end());
-					size_t dot = str.find_last_of(".");
-					string nameWithoutExt = str.substr(0, dot);
+					ThumbnailCache::Tile tile;
+					const ImVec2 thumbnailSize((float)ThumbnailCache::tileSize, (float)ThumbnailCache::tileSize);
 
+					if (thumbnails.get(*i, tile))
+						ImGui::Image((ImTextureID)(intptr_t)thumbnails.getAtlas(), thumbnailSize, ImVec2(tile.left, tile.top), ImVec2(tile.right, tile.bottom));
+					else
+						ImGui::Dummy(thumbnailSize);
 
+					ImGui::SameLine();
 
-					if (ImGui::Button(nameWithoutExt.c_str())) {
+					if (ImGui::Button(i -> name.c_str(), ImVec2(0.0f, thumbnailSize.y))) {
 						pathset = true;
-						path = string("puzzles/") + str;
+						path = i -> path;
 					}
 
-				}
+					if (ImGui::IsItemHovered()) {
+						if (i -> valid)
+							ImGui::SetTooltip("%u x %u x %u, %llu bytes", (unsigned)i -> height, (unsigned)i -> rows, (unsigned)i -> columns, (unsigned long long)i -> fileSize);
+						else if (i -> pending)
+							ImGui::SetTooltip("This puzzle is still being read.");
+						else
+							ImGui::SetTooltip("This puzzle could not be read.");
+					}
 
+					ImGui::PopID();
+				}
+			}
 
-			} while (FindNextFile(hFind, &ffd) != 0);
+			ImGui::EndDisabled();
 
 
 			ImGui::End();
@@ -286,16 +392,15 @@ class Controller
 			//glfwGetFramebufferSize(window, &display_w, &display_h);
 			glViewport(0, 0, 640, 480);
 			ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
-			glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
+			stateCache.clearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
 			glClear(GL_COLOR_BUFFER_BIT);
 			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
 
 
-			glDisable(GL_BLEND);
-			glDepthFunc(GL_LEQUAL);
-			glEnable(GL_DEPTH_TEST);
-			glEnable(GL_LIGHTING);
+			stateCache.disable(GL_BLEND);
+			stateCache.depthFunc(GL_LEQUAL);
+			stateCache.enable(GL_DEPTH_TEST);
 
 			glPopMatrix();
 
@@ -309,6 +414,9 @@ class Controller
 				draw_menu();
 			}
 			else {
+				if (simulation.isStarted())
+					applySnapshot();
+
 				blockStructure = blockDriver.getBlockStructure();
 				if (debugViewEnabled) {
 					display_debug();
@@ -325,133 +433,169 @@ class Controller
 		void blocks_display()
 		{
 
-			glClearDepth(1.0f);
-			glDepthFunc(GL_LEQUAL);
-			glEnable(GL_DEPTH_TEST);
-			glEnable(GL_STENCIL_TEST);
-
-			glShadeModel(GL_SMOOTH);
-			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-
-			glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
-			glEnable(GL_COLOR_MATERIAL);
-			glEnable(GL_NORMALIZE);
-			glEnable(GL_CULL_FACE);
-
-			glLightfv(GL_LIGHT0, GL_POSITION, light0Position);
-			glLightfv(GL_LIGHT0, GL_SPECULAR, light0SpecularIntensity);
-			glLightfv(GL_LIGHT0, GL_DIFFUSE, light0DiffuseIntensity);
-			glLightfv(GL_LIGHT0, GL_AMBIENT, light0AmbientIntensity);
-
-			glLightfv(GL_LIGHT1, GL_POSITION, light1Position);
-			glLightfv(GL_LIGHT1, GL_SPECULAR, light1SpecularIntensity);
-			glLightfv(GL_LIGHT1, GL_DIFFUSE, light1DiffuseIntensity);
-			glLightfv(GL_LIGHT1, GL_AMBIENT, light1AmbientIntensity);
-			glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, 1.0f);
-			glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 1.0f);
-			glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.0f);
-			glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.0f);
-			glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, light1Direction);
-			glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 90.0);
-
-			glLightfv(GL_LIGHT2, GL_SPECULAR, light2SpecularIntensity);
-			glLightfv(GL_LIGHT2, GL_DIFFUSE, light2DiffuseIntensity);
-			glLightfv(GL_LIGHT2, GL_AMBIENT, light2AmbientIntensity);
-
-
-			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-			glClearStencil(0);
+			stateCache.clearDepth(1.0f);
+			stateCache.depthFunc(GL_LEQUAL);
+			stateCache.enable(GL_DEPTH_TEST);
+			stateCache.enable(GL_STENCIL_TEST);
+
+			stateCache.shadeModel(GL_SMOOTH);
+			stateCache.enable(GL_CULL_FACE);
+
+			stateCache.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			stateCache.clearStencil(0);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-			glEnable(GL_DEPTH_BUFFER_BIT);
-			glEnable(GL_STENCIL_BUFFER_BIT);
-			glEnable(GL_LIGHTING);
-			glEnable(GL_LIGHT0);
-			glDisable(GL_LIGHT1);
-			glEnable(GL_LIGHT2);
 
 			glMatrixMode(GL_MODELVIEW);
 
 
 			if (blockStructure != NULL)
 			{
-				glPushAttrib(GL_DEPTH_BUFFER_BIT | GL_LIGHTING_BIT | GL_STENCIL_BUFFER_BIT);
+				const Vector4 lightPosition(light0Position[x], light0Position[y], light0Position[z], light0Position[w]);
+
+				//The shadow map needs only the structure's depth from the light, drawn before the scene
+				const bool mapped = shadowMode == SHADOW_MAP && renderShadowMap(lightPosition);
+
+				stateCache.pushAttrib(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-				glDisable(GL_LIGHT0);
+				//Pre-pass: lay down depth along with the colour every pixel has in shadow, which is the scene without light 0.
+				//Shadowed pixels are finished after this pass, so the lighting pass below only touches lit ones.  A depth-only
+				//pre-pass would need another submission with light 0 off for the shadowed pixels.
+				lighting.setEnabled(0, false);
 
 				drawScene();
 
-				glEnable(GL_LIGHT0);
+				lighting.setEnabled(0, true);
 
-				glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_POLYGON_BIT | GL_STENCIL_BUFFER_BIT);
+				markShadows(lightPosition, mapped);
 
-				glColorMask(0, 0, 0, 0);
+				//Lighting pass: only lit pixels at exactly the depth laid down by the pre-pass are shaded again
+				stateCache.depthFunc(GL_EQUAL);
 				glDepthMask(0);
-				glEnable(GL_CULL_FACE);
-				glEnable(GL_STENCIL_TEST);
-
-				glStencilFunc(GL_ALWAYS, 0, ~0);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-				glCullFace(GL_BACK);
+				stateCache.enable(GL_STENCIL_TEST);
+				glStencilFunc(GL_EQUAL, 0, ~0);
+				glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
-				blockStructure->drawShadowVolume(Vector4(light0Position[x], light0Position[y], light0Position[z], light0Position[w]));
+				drawScene(false);
 
-				glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
-				glCullFace(GL_FRONT);
+				stateCache.popAttrib();
+			}
+			else
+				drawScene();
+		}
 
-				blockStructure->drawShadowVolume(Vector4(light0Position[x], light0Position[y], light0Position[z], light0Position[w]));
+		/**
+		  * Sets the stencil to non-zero wherever the depth laid down so far is in the shadow of light 0.  Colour and depth are left as they were.
+		  * @param mapped true to test against the shadow map rendered this frame, false to count the structure's shadow volume
+		  */
+		void markShadows(const Vector4& lightPosition, bool mapped) const
+		{
+			stateCache.pushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT | GL_STENCIL_BUFFER_BIT);
 
-				glPopAttrib();
+			glColorMask(0, 0, 0, 0);
+			glDepthMask(0);
+			stateCache.enable(GL_CULL_FACE);
+			stateCache.enable(GL_STENCIL_TEST);
 
-				glDepthFunc(GL_EQUAL);
-				glEnable(GL_STENCIL_TEST);
-				glStencilFunc(GL_EQUAL, 0, ~0);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+			if (mapped)
+			{
+				//Mark the shadowed fragments of what was just drawn.  The offset lets them pass the depth test against themselves.
+				glStencilFunc(GL_ALWAYS, 1, ~0);
+				glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+				glCullFace(GL_BACK);
+				stateCache.enable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(-1.0f, -1.0f);
 
+				shadowMap.beginShadowTest();
 
-				drawScene();
+				blockStructure->draw();
+				drawGround();
 
-				glPopAttrib();
+				shadowMap.endShadowTest();
 			}
 			else
-				drawScene();
+			{
+				//Two-sided stencil counts front and back faces of the volume in a single draw.
+				//Wrapping keeps the count exact however many volumes overlap, so only its zero test matters.
+				stateCache.disable(GL_CULL_FACE);
+				glStencilFunc(GL_ALWAYS, 0, ~0);
+				glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+				glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+
+				blockStructure->drawShadowVolume(lightPosition);
+			}
+
+			stateCache.popAttrib();
 		}
 
-		void drawScene()
+		/**
+		  * @param drawUnlit false to skip the laser, which is drawn without lighting and so is already final after the pre-pass
+		  */
+		void drawScene(bool drawUnlit = true)
 		{
 			glMatrixMode(GL_MODELVIEW);
 
 			//Draw the block structure
 			if (blockStructure != NULL)
 			{
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glMaterialfv(GL_FRONT, GL_SPECULAR, Material1Specular);
-				glMaterialfv(GL_FRONT, GL_DIFFUSE, Material1Diffuse);
-				glMaterialfv(GL_FRONT, GL_AMBIENT, Material1Ambient);
-				glMaterialf(GL_FRONT, GL_SHININESS, Material1Shininess);
+				stateCache.enable(GL_BLEND);
+				stateCache.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				lighting.selectMaterial(blockMaterial);
+				lighting.setTextured(false);
+				lighting.use();
 
-				blockStructure->draw();
+				blockStructure->draw(renderMode);
 
-				glDisable(GL_BLEND);
+				glUseProgram(0);
+				stateCache.disable(GL_BLEND);
 			}
 
 			//Draw the laser
-			glDisable(GL_LIGHTING);
+			if (drawUnlit)
+				drawLaser();
 
-			laser->draw();
+			drawLitGround();
+		}
+
+
+
+		/**
+		  * Renders the structure's depth from the light into the shadow map.
+		  * @return false if shadow maps are not available
+		  */
+		bool renderShadowMap(const Vector4& lightPosition)
+		{
+			if (!shadowMap.beginDepthPass(lightPosition, blockStructure->getCenter(), blockStructure->getBoundingRadius()))
+				return false;
 
-			glEnable(GL_LIGHTING);
+			//The map holds the depth of back faces, which are not always behind the front faces of nearer bricks
+			blockStructure->draw(BlockStructure::BATCHED, false);
 
-			//Draw the ground
-			glEnable(GL_TEXTURE_2D);
+			shadowMap.endDepthPass();
+
+			return true;
+		}
+
+		/**
+		  * Draws the textured ground through the lighting shader, or unlit if the shader is not available.
+		  */
+		void drawLitGround() const
+		{
+			stateCache.enable(GL_TEXTURE_2D);
 			glBindTexture(GL_TEXTURE_2D, groundTexture);
 
-			glMaterialfv(GL_FRONT, GL_SPECULAR, Material2Specular);
-			glMaterialfv(GL_FRONT, GL_DIFFUSE, Material2Diffuse);
-			glMaterialfv(GL_FRONT, GL_AMBIENT, Material2Ambient);
-			glMaterialf(GL_FRONT, GL_SHININESS, Material2Shininess);
+			lighting.selectMaterial(groundMaterial);
+			lighting.setTextured(true);
+			lighting.use();
 			glColor3f(1.0, 1.0, 1.0);
 
+			drawGround();
+
+			glUseProgram(0);
+			stateCache.disable(GL_TEXTURE_2D);
+		}
+
+		void drawGround() const
+		{
 			glBegin(GL_QUADS);
 
 			glNormal3f(0.0, 1.0, 0.0);
@@ -461,98 +605,47 @@ class Controller
 			glTexCoord2f(0.0, 1.0); glVertex3f(-groundPlaneSize, 0.0, -groundPlaneSize);
 
 			glEnd();
-
-			glDisable(GL_TEXTURE_2D);
 		}
 
-
-
 		virtual void display_debug() const
 		{
-			glClearDepth(1.0f);
-			glDepthFunc(GL_LEQUAL);
-			glEnable(GL_DEPTH_TEST);
-			glEnable(GL_STENCIL_TEST);
-
-			glShadeModel(GL_SMOOTH);
-			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-
-			glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
-			glEnable(GL_COLOR_MATERIAL);
-			glEnable(GL_NORMALIZE);
-			glEnable(GL_CULL_FACE);
-
-			glLightfv(GL_LIGHT0, GL_POSITION, light0Position);
-			glLightfv(GL_LIGHT0, GL_SPECULAR, light0SpecularIntensity);
-			glLightfv(GL_LIGHT0, GL_DIFFUSE, light0DiffuseIntensity);
-			glLightfv(GL_LIGHT0, GL_AMBIENT, light0AmbientIntensity);
-
-			glLightfv(GL_LIGHT1, GL_POSITION, light1Position);
-			glLightfv(GL_LIGHT1, GL_SPECULAR, light1SpecularIntensity);
-			glLightfv(GL_LIGHT1, GL_DIFFUSE, light1DiffuseIntensity);
-			glLightfv(GL_LIGHT1, GL_AMBIENT, light1AmbientIntensity);
-			glLightf(GL_LIGHT1, GL_SPOT_EXPONENT, 1.0f);
-			glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 1.0f);
-			glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 0.0f);
-			glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.0f);
-			glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, light1Direction);
-			glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, 90.0);
-
-			glLightfv(GL_LIGHT2, GL_SPECULAR, light2SpecularIntensity);
-			glLightfv(GL_LIGHT2, GL_DIFFUSE, light2DiffuseIntensity);
-			glLightfv(GL_LIGHT2, GL_AMBIENT, light2AmbientIntensity);
-
-
-			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-			glClearStencil(0);
+			stateCache.clearDepth(1.0f);
+			stateCache.depthFunc(GL_LEQUAL);
+			stateCache.enable(GL_DEPTH_TEST);
+			stateCache.enable(GL_STENCIL_TEST);
+
+			stateCache.shadeModel(GL_SMOOTH);
+			stateCache.enable(GL_CULL_FACE);
+
+			stateCache.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			stateCache.clearStencil(0);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-			glEnable(GL_DEPTH_BUFFER_BIT);
-			glEnable(GL_STENCIL_BUFFER_BIT);
-			glEnable(GL_LIGHTING);
-			glEnable(GL_LIGHT0);
-			glDisable(GL_LIGHT1);
-			glEnable(GL_LIGHT2);
 
 			glMatrixMode(GL_MODELVIEW);
 
 			if (blockStructure != NULL)
 			{
-				glPushAttrib(GL_DEPTH_BUFFER_BIT | GL_LIGHTING_BIT | GL_STENCIL_BUFFER_BIT);
+				stateCache.pushAttrib(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-				glDisable(GL_LIGHT0);
+				lighting.setEnabled(0, false);
 
 				drawScene_debug();
 
-				glEnable(GL_LIGHT0);
-
-				glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_POLYGON_BIT | GL_STENCIL_BUFFER_BIT);
-
-				glColorMask(0, 0, 0, 0);
-				glDepthMask(0);
-				glEnable(GL_CULL_FACE);
-				glEnable(GL_STENCIL_TEST);
-
-				glStencilFunc(GL_ALWAYS, 0, ~0);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-				glCullFace(GL_BACK);
-
-				blockStructure->drawShadowVolume(Vector4(light0Position[x], light0Position[y], light0Position[z], light0Position[w]));
+				lighting.setEnabled(0, true);
 
-				glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
-				glCullFace(GL_FRONT);
+				markShadows(Vector4(light0Position[x], light0Position[y], light0Position[z], light0Position[w]), false);
 
-				blockStructure->drawShadowVolume(Vector4(light0Position[x], light0Position[y], light0Position[z], light0Position[w]));
-
-				glPopAttrib();
-
-				glDepthFunc(GL_EQUAL);
-				glEnable(GL_STENCIL_TEST);
+				stateCache.depthFunc(GL_EQUAL);
+				stateCache.enable(GL_STENCIL_TEST);
 				glStencilFunc(GL_EQUAL, 0, ~0);
 				glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
 				drawScene_debug();
 
-				glPopAttrib();
+				stateCache.popAttrib();
+
+				//Drawn once, after the shadow passes, so the lit pass cannot paint over the see-through voxels
+				debugRenderer.draw();
 			}
 			else
 				drawScene_debug();
@@ -565,61 +658,20 @@ class Controller
 			//Draw the block structure
 			if (blockStructure != NULL)
 			{
-				glEnable(GL_BLEND);
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glMaterialfv(GL_FRONT, GL_SPECULAR, Material1Specular);
-				glMaterialfv(GL_FRONT, GL_DIFFUSE, Material1Diffuse);
-				glMaterialfv(GL_FRONT, GL_AMBIENT, Material1Ambient);
-				glMaterialf(GL_FRONT, GL_SHININESS, Material1Shininess);
+				stateCache.enable(GL_BLEND);
+				stateCache.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 				//blockStructure->draw();
 
-				glDisable(GL_LIGHTING);
-
 				//blockStructure->drawShadowVolume(Vector4(light0Position[x], light0Position[y], light0Position[z], light0Position[w]));
 
-				glEnable(GL_LIGHTING);
-
-				glDisable(GL_BLEND);
-
-				glLineWidth(1.0);
-				glDisable(GL_LIGHTING);
-
-				blockDriver.drawVoxelGrid();
-				blockDriver.highlightVoxel(1, 1, 1);
-				blockDriver.showVoxelTurnThreshold(2, 2, 2);
-
-				glEnable(GL_LIGHTING);
+				stateCache.disable(GL_BLEND);
 			}
 
 			//Draw the laser
-			glDisable(GL_LIGHTING);
-
-			laser->draw();
+			drawLaser();
 
-			glEnable(GL_LIGHTING);
-
-			//Draw the ground
-			glEnable(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, groundTexture);
-
-			glMaterialfv(GL_FRONT, GL_SPECULAR, Material2Specular);
-			glMaterialfv(GL_FRONT, GL_DIFFUSE, Material2Diffuse);
-			glMaterialfv(GL_FRONT, GL_AMBIENT, Material2Ambient);
-			glMaterialf(GL_FRONT, GL_SHININESS, Material2Shininess);
-			glColor3f(1.0, 1.0, 1.0);
-
-			glBegin(GL_QUADS);
-
-			glNormal3f(0.0, 1.0, 0.0);
-			glTexCoord2f(0.0, 0.0);	glVertex3f(-groundPlaneSize, 0.0, groundPlaneSize);
-			glTexCoord2f(1.0, 0.0); glVertex3f(groundPlaneSize, 0.0, groundPlaneSize);
-			glTexCoord2f(1.0, 1.0); glVertex3f(groundPlaneSize, 0.0, -groundPlaneSize);
-			glTexCoord2f(0.0, 1.0); glVertex3f(-groundPlaneSize, 0.0, -groundPlaneSize);
-
-			glEnd();
-
-			glDisable(GL_TEXTURE_2D);
+			drawLitGround();
 		}
 
 
@@ -642,6 +694,70 @@ class Controller
 		const GLfloat& getWindowHeight() const { return currentWindowHeight; }
 
 		bool isMainMenuEnabled() const { return mainMenuEnabled; }
+
+		/**
+		  * @return true while the picture changes without input: while the laser moves or a puzzle or texture is loading.
+		  * At other times the frame only needs drawing again after input or a call to the wake callback.
+		  * @see setWakeCallback
+		  */
+		bool isAnimating() const
+		{
+			if(pathset || levelLoader.isLoading() || levelLoader.hasResult() || textureCache.isPending())
+				return true;
+
+			//The menu redraws while the puzzles it lists, or pictures of them, are still coming in
+			if(mainMenuEnabled)
+				return puzzleCatalog.isPending() || thumbnails.isPending();
+
+			return !simulation.isStarted() || simulation.getSnapshot().mobile;
+		}
+
+		/**
+		  * @param wake called, possibly on another thread, when the game changes in a way isAnimating() does not foresee,
+		  * such as the laser being set moving or coming to rest
+		  */
+		void setWakeCallback(const function<void ()>& wake) { simulation.setWakeCallback(wake); }
+
+		/**
+		  * @return the reason the last puzzle could not be loaded, or an empty string while it is loading or if it loaded
+		  */
+		string getLoadError() const { return levelLoader.isLoading() ? string() : levelLoader.getError(); }
+
+		/**
+		  * Advances the laser by one move at once, for replays which must not depend on the clock.
+		  * This only moves a laser started after setManualStepping(true).
+		  */
+		void stepLaser()
+		{
+			if(manualStepping && simulation.isStarted())
+				simulation.step();
+		}
+
+		/**
+		  * @param manualStepping true for games started from now on to move only through stepLaser(), rather than on the simulation's thread
+		  */
+		void setManualStepping(bool manualStepping) { this -> manualStepping = manualStepping; }
+
+		/**
+		  * Waits until every texture requested so far has been uploaded or has failed, so the next frame is drawn as it will stay.
+		  */
+		void waitForTextures()
+		{
+			while(textureCache.isPending())
+			{
+				textureCache.update();
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+		}
+
+		ShadowMode getShadowMode() const { return shadowMode; }
+
+		void setShadowMode(ShadowMode shadowMode) { this -> shadowMode = shadowMode; }
+
+		/**
+		  * @return the cache the fixed-function state changes of the game views go through, which counts the calls it skipped
+		  */
+		GLStateCache& getStateCache() const { return stateCache; }
 };
 
 const GLfloat Controller::paddingRatio = .02;
@@ -653,6 +769,7 @@ const double Controller::PI = 3.141592654;
 const double Controller::angle = PI / 4.0;
 const double Controller::angle2 = 5.0 * PI / 4.0;
 const float Controller::radius = 300.0;
+const GLfloat Controller::laserWidth = 5.0;
 
 const GLfloat Controller::light0Position[4] = { radius * cos(angle), 600.0, radius * sin(angle), 1.0f };
 const GLfloat Controller::light0SpecularIntensity[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
@@ -666,20 +783,16 @@ const GLfloat Controller::light1SpecularIntensity[4] = { 1.0f, 1.0f, 1.0f, 1.0f
 const GLfloat Controller::light1DiffuseIntensity[4] = { 1.0, 1.0, 1.0, 1.0 };
 const GLfloat Controller::light1AmbientIntensity[4] = { 0.2f, 0.2f, 0.2f, 1.0f };
 
-//Dim Point Light (at same position as first point light)
-const GLfloat Controller::light2Position[4] = { radius * cos(angle), 600.0, radius * sin(angle), 1.0f };
+//Dim Directional Light (shining from the eye along the view direction)
+const GLfloat Controller::light2Position[4] = { 0.0, 0.0, 1.0, 0.0f };
 const GLfloat Controller::light2SpecularIntensity[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 const GLfloat Controller::light2DiffuseIntensity[4] = { 0.2, 0.2, 0.2, 1.0 };
 const GLfloat Controller::light2AmbientIntensity[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 
 const GLfloat Controller::Material1Specular[4] = { 1.0, 1.0, 1.0, 1.0 };
-const GLfloat Controller::Material1Diffuse[4] = { 0.2, 0.2, 0.2, 1.0 };
-const GLfloat Controller::Material1Ambient[4] = { 0.2, 0.2, 0.2, 1.0 };
 const GLfloat Controller::Material1Shininess = 70.0;
 
 const GLfloat Controller::Material2Specular[4] = { 0.2, 0.2, 0.2, 1.0 };
-const GLfloat Controller::Material2Diffuse[4] = { 1.0, 1.0, 1.0, 1.0 };
-const GLfloat Controller::Material2Ambient[4] = { 0.2, 0.2, 0.2, 1.0 };
 const GLfloat Controller::Material2Shininess = 10.0;
 
 #endif /*CONTROLLER_H_*/
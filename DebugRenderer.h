@@ -0,0 +1,296 @@
+#ifndef DEBUGRENDERER_H_
+#define DEBUGRENDERER_H_
+
+#include <cstddef>		//size_t
+#include <cmath>		//fabs
+#include <vector>		//vector
+
+#include "BlockStructure.h"
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class draws the debug view's overlays: the voxel grid, the boxes within which the laser can turn, the voxels the laser has
+  * visited and the frontier of voxels it can enter next.
+  * Each overlay is kept in one vertex buffer and drawn with a single call.  The grid is built from one line per row of cell boundaries
+  * rather than a box per cell, so it costs O(n^2) lines for a level n cells across and stays usable on large levels.
+  * Building the overlays makes no GL calls; buffers are created and filled the first time they are drawn after a change.
+  */
+class DebugRenderer
+{
+	private:
+		enum { x, y, z, w };
+		enum { GRID, TURN_THRESHOLDS, VISITED, FRONTIER, BATCH_COUNT };
+
+		//The visited and frontier voxels are drawn smaller than a cell so the grid and threshold lines stay visible around them
+		static const GLfloat voxelScale;
+
+		struct Batch
+		{
+			vector<GLfloat> vertices;
+			GLenum mode;
+			bool changed;
+			GLuint vertexArray, vertexBuffer;
+		};
+
+		mutable Batch batches[BATCH_COUNT];
+		const BlockStructure* gridStructure;
+
+		DebugRenderer(const DebugRenderer&);
+		DebugRenderer& operator = (const DebugRenderer&);
+
+	public:
+		DebugRenderer() : gridStructure(NULL)
+		{
+			for(size_t i = 0; i < BATCH_COUNT; i++)
+			{
+				batches[i].mode = i == VISITED || i == FRONTIER ? GL_QUADS : GL_LINES;
+				batches[i].changed = false;
+				batches[i].vertexArray = batches[i].vertexBuffer = 0;
+			}
+		}
+
+		~DebugRenderer() { release(); }
+
+		/**
+		  * Builds the grid around the cells of blockStructure, unless it was built for that structure already.
+		  */
+		void setStructure(const BlockStructure& blockStructure)
+		{
+			if(gridStructure == &blockStructure)
+				return;
+
+			gridStructure = &blockStructure;
+
+			const GLfloat blockSize = blockStructure.getBlockSize();
+			const size_t counts[3] = { blockStructure.getColumns(), blockStructure.getHeight(), blockStructure.getRows() };
+			const Vector4& origin = blockStructure.getOrigin();
+			GLfloat start[3], end[3];
+			vector<GLfloat>& vertices = batches[GRID].vertices;
+
+			//The cells' boundaries start half a cell before the center of the first
+			for(size_t d = 0; d < 3; d++)
+			{
+				start[d] = origin[d] - blockSize / 2.0f;
+				end[d] = start[d] + counts[d] * blockSize;
+			}
+
+			vertices.clear();
+
+			//Lines along each axis, one through every boundary of the other two
+			for(size_t d = 0; d < 3; d++)
+			{
+				const size_t u = (d + 1) % 3, v = (d + 2) % 3;
+
+				for(size_t i = 0; i <= counts[u]; i++)
+					for(size_t j = 0; j <= counts[v]; j++)
+					{
+						GLfloat from[3], to[3];
+
+						from[d] = start[d];
+						to[d] = end[d];
+						from[u] = to[u] = start[u] + i * blockSize;
+						from[v] = to[v] = start[v] + j * blockSize;
+
+						vertices.insert(vertices.end(), from, from + 3);
+						vertices.insert(vertices.end(), to, to + 3);
+					}
+			}
+
+			batches[GRID].changed = true;
+		}
+
+		/**
+		  * Forgets the grid, for instance because the structure it was built for is about to be freed.
+		  */
+		void clearStructure()
+		{
+			gridStructure = NULL;
+			batches[GRID].vertices.clear();
+			batches[GRID].changed = true;
+		}
+
+		/**
+		  * Rebuilds the overlays of the laser's progress.
+		  * @param visitedCorners the ends of each straight run of the laser's path, ending with the voxel the laser is in
+		  * @param frontier the voxels the laser can enter next
+		  * @param thresholdRatio the fraction of a voxel's width within which the laser can turn
+		  * @see BlockDriver::Laser::getVisitedCorners
+		  */
+		void setProgress(const vector<Vector4>& visitedCorners, const vector<Vector4>& frontier, GLfloat blockSize, GLfloat thresholdRatio)
+		{
+			for(size_t i = TURN_THRESHOLDS; i < BATCH_COUNT; i++)
+			{
+				batches[i].vertices.clear();
+				batches[i].changed = true;
+			}
+
+			for(size_t i = 0; i < visitedCorners.size(); i++)
+			{
+				addBox(VISITED, visitedCorners[i], blockSize * voxelScale);
+
+				if(i + 1 == visitedCorners.size())
+					break;
+
+				//Fill in the voxels along the straight run to the next corner
+				const Vector4& from = visitedCorners[i];
+				const Vector4& to = visitedCorners[i + 1];
+				const GLfloat length = fabs(to[x] - from[x]) + fabs(to[y] - from[y]) + fabs(to[z] - from[z]);
+				const size_t steps = (size_t)(length / blockSize + 0.5f);
+
+				for(size_t k = 1; k < steps; k++)
+				{
+					const GLfloat t = (GLfloat)k / steps;
+
+					addBox(VISITED, Vector4(from[x] + (to[x] - from[x]) * t, from[y] + (to[y] - from[y]) * t, from[z] + (to[z] - from[z]) * t, 1.0), blockSize * voxelScale);
+				}
+			}
+
+			//The laser can turn in the voxel it is in and in each voxel it can enter next
+			if(!visitedCorners.empty())
+				addWireBox(TURN_THRESHOLDS, visitedCorners.back(), blockSize * thresholdRatio);
+
+			for(vector<Vector4>::const_iterator i = frontier.begin(); i != frontier.end(); i++)
+			{
+				addBox(FRONTIER, *i, blockSize * voxelScale);
+				addWireBox(TURN_THRESHOLDS, *i, blockSize * thresholdRatio);
+			}
+		}
+
+		/**
+		  * Draws the overlays with the fixed-function pipeline.  This must be called on the thread which owns the GL context.
+		  */
+		void draw() const
+		{
+			glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_LINE_BIT);
+
+			glDisable(GL_TEXTURE_2D);
+			glDisable(GL_CULL_FACE);
+
+			glLineWidth(1.0);
+			glColor4f(1.0, 1.0, 1.0, 0.5);
+			drawBatch(GRID);
+
+			glLineWidth(2.0);
+			glColor4f(1.0, 1.0, 0.0, 1.0);
+			drawBatch(TURN_THRESHOLDS);
+
+			//The voxels are see-through, so they are blended over everything else without hiding each other
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glDepthMask(GL_FALSE);
+
+			glColor4f(0.0, 0.5, 1.0, 0.3);
+			drawBatch(VISITED);
+
+			glColor4f(0.0, 1.0, 0.0, 0.4);
+			drawBatch(FRONTIER);
+
+			glPopAttrib();
+		}
+
+		/**
+		  * Frees the vertex buffers.  They are filled again if the overlays are drawn afterwards.
+		  * This must be called on the thread which owns the GL context.
+		  */
+		void release() const
+		{
+			for(size_t i = 0; i < BATCH_COUNT; i++)
+			{
+				if(batches[i].vertexArray != 0)
+					glDeleteVertexArrays(1, &batches[i].vertexArray);
+
+				if(batches[i].vertexBuffer != 0)
+					glDeleteBuffers(1, &batches[i].vertexBuffer);
+
+				batches[i].vertexArray = batches[i].vertexBuffer = 0;
+				batches[i].changed = true;
+			}
+		}
+
+	private:
+		void drawBatch(size_t index) const
+		{
+			Batch& batch = batches[index];
+
+			if(batch.vertexArray == 0)
+			{
+				glGenVertexArrays(1, &batch.vertexArray);
+				glGenBuffers(1, &batch.vertexBuffer);
+
+				glBindVertexArray(batch.vertexArray);
+				glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBuffer);
+				glEnableClientState(GL_VERTEX_ARRAY);
+				glVertexPointer(3, GL_FLOAT, 0, (const void*)0);
+				glBindVertexArray(0);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+			}
+
+			if(batch.changed)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBuffer);
+				glBufferData(GL_ARRAY_BUFFER, batch.vertices.size() * sizeof(GLfloat), batch.vertices.empty() ? NULL : &batch.vertices[0], index == GRID ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
+				glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+				batch.changed = false;
+			}
+
+			if(batch.vertices.empty())
+				return;
+
+			glBindVertexArray(batch.vertexArray);
+			glDrawArrays(batch.mode, 0, (GLsizei)(batch.vertices.size() / 3));
+			glBindVertexArray(0);
+		}
+
+		/**
+		  * Adds the six faces of a cube of the given width about center, as quads.
+		  */
+		void addBox(size_t index, const Vector4& center, GLfloat width)
+		{
+			static const GLfloat faces[6][4][3] =
+			{
+				{ { -1, -1, -1 }, { -1, 1, -1 }, { 1, 1, -1 }, { 1, -1, -1 } },
+				{ { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } },
+				{ { -1, -1, -1 }, { 1, -1, -1 }, { 1, -1, 1 }, { -1, -1, 1 } },
+				{ { -1, 1, -1 }, { -1, 1, 1 }, { 1, 1, 1 }, { 1, 1, -1 } },
+				{ { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, 1 }, { -1, 1, -1 } },
+				{ { 1, -1, -1 }, { 1, 1, -1 }, { 1, 1, 1 }, { 1, -1, 1 } }
+			};
+
+			vector<GLfloat>& vertices = batches[index].vertices;
+
+			for(size_t i = 0; i < 6; i++)
+				for(size_t j = 0; j < 4; j++)
+					for(size_t d = 0; d < 3; d++)
+						vertices.push_back(center[d] + faces[i][j][d] * width / 2.0f);
+		}
+
+		/**
+		  * Adds the twelve edges of a cube of the given width about center, as lines.
+		  */
+		void addWireBox(size_t index, const Vector4& center, GLfloat width)
+		{
+			vector<GLfloat>& vertices = batches[index].vertices;
+
+			//Each edge runs along one axis, at one of the four corners of the other two
+			for(size_t d = 0; d < 3; d++)
+				for(int corner = 0; corner < 4; corner++)
+					for(int side = -1; side <= 1; side += 2)
+					{
+						const size_t u = (d + 1) % 3, v = (d + 2) % 3;
+						GLfloat vertex[3];
+
+						vertex[d] = center[d] + side * width / 2.0f;
+						vertex[u] = center[u] + (corner & 1 ? 1 : -1) * width / 2.0f;
+						vertex[v] = center[v] + (corner & 2 ? 1 : -1) * width / 2.0f;
+
+						vertices.insert(vertices.end(), vertex, vertex + 3);
+					}
+		}
+};
+
+const GLfloat DebugRenderer::voxelScale = 0.6f;
+
+#endif /*DEBUGRENDERER_H_*/
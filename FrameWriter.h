@@ -0,0 +1,184 @@
+#ifndef FRAMEWRITER_H_
+#define FRAMEWRITER_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint8_t and uint32_t
+#include <cstdio>		//FILE, fopen, fwrite and fclose
+#include <cstring>		//memcpy
+#include <algorithm>	//min
+#include <string>		//string
+#include <vector>		//vector
+#include <stdexcept>	//runtime_error
+
+#include "TextureCache.h"
+
+using namespace std;
+
+/**
+  * @brief This class saves rendered frames, either as PNG images or as raw textures in the format TextureCache reads.
+  * The PNG data is stored without compression, which keeps the writer small and fast and the output exactly what was rendered.
+  * @see OffscreenContext
+  */
+class FrameWriter
+{
+	public:
+		/**
+		  * @return true if filePath names a raw texture rather than a PNG image
+		  */
+		static bool isRawPath(const string& filePath)
+		{
+			return filePath.size() >= 4 && filePath.compare(filePath.size() - 4, 4, ".raw") == 0;
+		}
+
+		/**
+		  * Writes 8-bit RGB pixels, bottom row first, to filePath as a raw texture if it ends in .raw, otherwise as a PNG image.
+		  * This throws a runtime_error if the file cannot be written.
+		  */
+		static void write(const string& filePath, uint32_t width, uint32_t height, const vector<uint8_t>& pixels)
+		{
+			vector<uint8_t> data;
+
+			if(isRawPath(filePath))
+				encodeRaw(width, height, pixels, data);
+			else
+				encodePng(width, height, pixels, data);
+
+			FILE* file = fopen(filePath.c_str(), "wb");
+
+			if(file == NULL)
+				throw runtime_error("The frame '" + filePath + "' could not be opened for writing.");
+
+			const bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+
+			if(fclose(file) != 0 || !written)
+				throw runtime_error("The frame '" + filePath + "' could not be written.");
+		}
+
+	private:
+		static void encodeRaw(uint32_t width, uint32_t height, const vector<uint8_t>& pixels, vector<uint8_t>& data)
+		{
+			TextureCache::TextureHeader header;
+
+			memcpy(header.magic, "BLKT", 4);
+			header.width = width;
+			header.height = height;
+			header.channels = 3;
+
+			data.assign((const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+			data.insert(data.end(), pixels.begin(), pixels.end());
+		}
+
+		static void encodePng(uint32_t width, uint32_t height, const vector<uint8_t>& pixels, vector<uint8_t>& data)
+		{
+			const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+			vector<uint8_t> header, scanlines, deflated;
+
+			data.assign(signature, signature + 8);
+
+			//8-bit RGB, no interlacing
+			appendBigEndian(header, width);
+			appendBigEndian(header, height);
+			header.push_back(8);
+			header.push_back(2);
+			header.push_back(0);
+			header.push_back(0);
+			header.push_back(0);
+			appendChunk(data, "IHDR", header);
+
+			//PNG stores the top row first, each row led by its filter type
+			const size_t rowBytes = (size_t)width * 3;
+
+			for(uint32_t row = height; row-- > 0; )
+			{
+				scanlines.push_back(0);
+				scanlines.insert(scanlines.end(), pixels.begin() + row * rowBytes, pixels.begin() + (row + 1) * rowBytes);
+			}
+
+			//A zlib stream of stored deflate blocks, which hold at most 65535 bytes each
+			deflated.push_back(0x78);
+			deflated.push_back(0x01);
+
+			for(size_t offset = 0; offset < scanlines.size() || offset == 0; )
+			{
+				const size_t length = min(scanlines.size() - offset, (size_t)65535);
+
+				deflated.push_back(offset + length == scanlines.size() ? 1 : 0);
+				deflated.push_back((uint8_t)length);
+				deflated.push_back((uint8_t)(length >> 8));
+				deflated.push_back((uint8_t)~length);
+				deflated.push_back((uint8_t)(~length >> 8));
+				deflated.insert(deflated.end(), scanlines.begin() + offset, scanlines.begin() + offset + length);
+
+				offset += length;
+
+				if(length == 0)
+					break;
+			}
+
+			appendBigEndian(deflated, adler32(scanlines));
+			appendChunk(data, "IDAT", deflated);
+			appendChunk(data, "IEND", vector<uint8_t>());
+		}
+
+		static void appendChunk(vector<uint8_t>& data, const char* type, const vector<uint8_t>& contents)
+		{
+			appendBigEndian(data, (uint32_t)contents.size());
+
+			const size_t start = data.size();
+
+			data.insert(data.end(), type, type + 4);
+			data.insert(data.end(), contents.begin(), contents.end());
+
+			//The checksum covers the type and the contents
+			appendBigEndian(data, crc32(data.data() + start, data.size() - start));
+		}
+
+		static void appendBigEndian(vector<uint8_t>& data, uint32_t value)
+		{
+			for(int shift = 24; shift >= 0; shift -= 8)
+				data.push_back((uint8_t)(value >> shift));
+		}
+
+		static uint32_t crc32(const uint8_t* bytes, size_t size)
+		{
+			static uint32_t table[256];
+			static bool tableBuilt = false;
+
+			if(!tableBuilt)
+			{
+				for(uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t value = i;
+
+					for(unsigned k = 0; k < 8; k++)
+						value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+
+					table[i] = value;
+				}
+
+				tableBuilt = true;
+			}
+
+			uint32_t crc = 0xffffffffu;
+
+			for(size_t i = 0; i < size; i++)
+				crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+
+			return crc ^ 0xffffffffu;
+		}
+
+		static uint32_t adler32(const vector<uint8_t>& bytes)
+		{
+			uint32_t a = 1, b = 0;
+
+			for(size_t i = 0; i < bytes.size(); i++)
+			{
+				a = (a + bytes[i]) % 65521;
+				b = (b + a) % 65521;
+			}
+
+			return b << 16 | a;
+		}
+};
+
+#endif /*FRAMEWRITER_H_*/
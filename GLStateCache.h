@@ -0,0 +1,228 @@
+#ifndef GLSTATECACHE_H_
+#define GLSTATECACHE_H_
+
+#include <cstring>		//memcmp and memcpy
+#include <cassert>		//assert
+#include <map>			//map
+#include <vector>		//vector
+#include <utility>		//pair
+
+using namespace std;
+
+/**
+  * @brief This class remembers the fixed-function state it last sent to GL and skips calls which would not change it.
+  * Enables, blending, the shade model, the depth function and the clear values go through it; anything else is called directly.
+  * State it has not seen set is unknown, so the first call always reaches GL.
+  *
+  * glPushAttrib and glPopAttrib must go through pushAttrib() and popAttrib(), which restore the remembered state of the
+  * attribute groups popped just as GL restores the state itself.  Code which changes tracked state directly must put it back.
+  * @see Controller
+  */
+class GLStateCache
+{
+	public:
+		typedef unsigned long long count_type;
+
+	private:
+		enum Function { ENABLE, SHADE_MODEL, DEPTH_FUNC, BLEND_FUNC, CLEAR_COLOR, CLEAR_DEPTH, CLEAR_STENCIL };
+
+		enum { valueCount = 4 };
+
+		struct Key
+		{
+			Function function;
+			GLenum target, name;
+
+			Key(Function function, GLenum target = 0, GLenum name = 0) : function(function), target(target), name(name) {}
+
+			bool operator < (const Key& key) const
+			{
+				if(function != key.function)	return function < key.function;
+				if(target != key.target)		return target < key.target;
+				return name < key.name;
+			}
+		};
+
+		struct Entry
+		{
+			GLfloat values[valueCount];
+			GLbitfield groups;		//The attribute groups which save this state
+		};
+
+		typedef map<Key, Entry> State;
+
+		State state;
+		vector<pair<GLbitfield, State> > attributeStack;
+		count_type issued, skipped;
+
+		GLStateCache(const GLStateCache&);
+		GLStateCache& operator = (const GLStateCache&);
+
+	public:
+		GLStateCache() : issued(0), skipped(0) {}
+
+		void enable(GLenum capability)
+		{
+			const GLfloat value = 1.0f;
+
+			if(set(Key(ENABLE, capability), &value, 1, getEnableGroups(capability)))
+				glEnable(capability);
+		}
+
+		void disable(GLenum capability)
+		{
+			const GLfloat value = 0.0f;
+
+			if(set(Key(ENABLE, capability), &value, 1, getEnableGroups(capability)))
+				glDisable(capability);
+		}
+
+		void shadeModel(GLenum mode)
+		{
+			const GLfloat value = (GLfloat)mode;
+
+			if(set(Key(SHADE_MODEL), &value, 1, GL_LIGHTING_BIT))
+				glShadeModel(mode);
+		}
+
+		void depthFunc(GLenum function)
+		{
+			const GLfloat value = (GLfloat)function;
+
+			if(set(Key(DEPTH_FUNC), &value, 1, GL_DEPTH_BUFFER_BIT))
+				glDepthFunc(function);
+		}
+
+		void blendFunc(GLenum source, GLenum destination)
+		{
+			const GLfloat values[2] = { (GLfloat)source, (GLfloat)destination };
+
+			if(set(Key(BLEND_FUNC), values, 2, GL_COLOR_BUFFER_BIT))
+				glBlendFunc(source, destination);
+		}
+
+		void clearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+		{
+			const GLfloat values[4] = { red, green, blue, alpha };
+
+			if(set(Key(CLEAR_COLOR), values, 4, GL_COLOR_BUFFER_BIT))
+				glClearColor(red, green, blue, alpha);
+		}
+
+		void clearDepth(GLfloat depth)
+		{
+			if(set(Key(CLEAR_DEPTH), &depth, 1, GL_DEPTH_BUFFER_BIT))
+				glClearDepth(depth);
+		}
+
+		void clearStencil(GLint stencil)
+		{
+			const GLfloat value = (GLfloat)stencil;
+
+			if(set(Key(CLEAR_STENCIL), &value, 1, GL_STENCIL_BUFFER_BIT))
+				glClearStencil(stencil);
+		}
+
+		void pushAttrib(GLbitfield mask)
+		{
+			attributeStack.push_back(make_pair(mask, State()));
+
+			//Only the state in the pushed groups is restored by the pop, so only it is saved
+			State& saved = attributeStack.back().second;
+
+			for(State::const_iterator i = state.begin(); i != state.end(); i++)
+				if((i -> second.groups & mask) != 0)
+					saved.insert(saved.end(), *i);
+
+			glPushAttrib(mask);
+		}
+
+		void popAttrib()
+		{
+			assert(!attributeStack.empty());
+
+			const GLbitfield mask = attributeStack.back().first;
+			const State& saved = attributeStack.back().second;
+
+			//What GL restores is whatever was remembered at the push, including not knowing it at all
+			for(State::iterator i = state.begin(); i != state.end(); )
+				if((i -> second.groups & mask) != 0 && saved.find(i -> first) == saved.end())
+					state.erase(i++);
+				else
+					i++;
+
+			for(State::const_iterator i = saved.begin(); i != saved.end(); i++)
+				if((i -> second.groups & mask) != 0)
+					state[i -> first] = i -> second;
+
+			attributeStack.pop_back();
+			glPopAttrib();
+		}
+
+		/**
+		  * Forgets all remembered state, for instance after code outside the cache changed it.
+		  */
+		void invalidate() { state.clear(); }
+
+		/**
+		  * @return the number of calls passed on to GL
+		  */
+		count_type getIssuedCalls() const { return issued; }
+
+		/**
+		  * @return the number of calls skipped because they would not have changed any state
+		  */
+		count_type getSkippedCalls() const { return skipped; }
+
+		void resetCounters() { issued = skipped = 0; }
+
+	private:
+		/**
+		  * Remembers values under key.
+		  * @return true if the call must be passed on to GL
+		  */
+		bool set(const Key& key, const GLfloat* values, unsigned count, GLbitfield groups)
+		{
+			State::iterator i = state.find(key);
+
+			if(i != state.end() && memcmp(i -> second.values, values, count * sizeof(GLfloat)) == 0)
+			{
+				skipped++;
+				return false;
+			}
+
+			Entry& entry = i != state.end() ? i -> second : state[key];
+
+			memcpy(entry.values, values, count * sizeof(GLfloat));
+			entry.groups = groups;
+			issued++;
+
+			return true;
+		}
+
+		static GLbitfield getEnableGroups(GLenum capability)
+		{
+			GLbitfield groups = GL_ENABLE_BIT;
+
+			if(capability == GL_LIGHTING || capability == GL_COLOR_MATERIAL || (capability >= GL_LIGHT0 && capability <= GL_LIGHT7))
+				groups |= GL_LIGHTING_BIT;
+			else if(capability == GL_DEPTH_TEST)
+				groups |= GL_DEPTH_BUFFER_BIT;
+			else if(capability == GL_STENCIL_TEST)
+				groups |= GL_STENCIL_BUFFER_BIT;
+			else if(capability == GL_BLEND)
+				groups |= GL_COLOR_BUFFER_BIT;
+			else if(capability == GL_CULL_FACE || capability == GL_POLYGON_OFFSET_FILL)
+				groups |= GL_POLYGON_BIT;
+			else if(capability == GL_NORMALIZE)
+				groups |= GL_TRANSFORM_BIT;
+			else if(capability == GL_TEXTURE_2D)
+				groups |= GL_TEXTURE_BIT;
+			else if(capability == GL_LINE_SMOOTH)
+				groups |= GL_LINE_BIT;
+
+			return groups;
+		}
+};
+
+#endif /*GLSTATECACHE_H_*/
@@ -0,0 +1,129 @@
+#ifndef LEVELLOADER_H_
+#define LEVELLOADER_H_
+
+#include <string>		//string
+#include <thread>		//thread
+#include <atomic>		//atomic
+#include <mutex>		//mutex and lock_guard
+#include <exception>	//exception
+
+#include "BlockStructure.h"
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class builds a BlockStructure on a background thread so the render thread never waits on disk or parsing.
+  * The finished structure is published through an atomic pointer and collected with takeResult().
+  */
+class LevelLoader
+{
+	private:
+		thread worker;
+		atomic<bool> loading;
+		atomic<float> progress;
+		atomic<BlockStructure*> result;
+		mutable mutex errorMutex;
+		string error;
+
+		LevelLoader(const LevelLoader&);
+		LevelLoader& operator = (const LevelLoader&);
+
+	public:
+		LevelLoader() : loading(false), progress(0.0f), result(NULL) {}
+
+		~LevelLoader()
+		{
+			if(worker.joinable())
+				worker.join();
+
+			delete result.exchange(NULL);
+		}
+
+		/**
+		  * Starts building the puzzle at filePath.  Requests made while a load is already running are ignored.
+		  * @return true if the load was started
+		  */
+		bool load(const string& filePath, GLfloat blockSize, const Vector4& base)
+		{
+			if(loading)
+				return false;
+
+			if(worker.joinable())
+				worker.join();
+
+			progress = 0.0f;
+			loading = true;
+
+			{
+				lock_guard<mutex> lock(errorMutex);
+				error.clear();
+			}
+
+			worker = thread(&LevelLoader::run, this, filePath, blockSize, base);
+
+			return true;
+		}
+
+		/**
+		  * @return the finished structure, which the caller now owns, or NULL if none is ready
+		  */
+		BlockStructure* takeResult() { return result.exchange(NULL); }
+
+		/**
+		  * @return true if a finished structure is waiting to be taken
+		  */
+		bool hasResult() const { return result.load() != NULL; }
+
+		bool isLoading() const { return loading; }
+
+		/**
+		  * @return the fraction of the current load completed, from 0 to 1
+		  */
+		float getProgress() const { return progress; }
+
+		/**
+		  * @return the reason the last load failed, or an empty string if it did not
+		  */
+		string getError() const
+		{
+			lock_guard<mutex> lock(errorMutex);
+
+			return error;
+		}
+
+		/**
+		  * Deletes a structure on a detached thread, since freeing every block of a large level can take as long as building it.
+		  * Its GL resources are freed first, so this must be called on the thread which owns the GL context.
+		  */
+		static void release(BlockStructure* blockStructure)
+		{
+			if(blockStructure != NULL)
+			{
+				blockStructure -> releaseGraphics();
+
+				thread([blockStructure]() { delete blockStructure; }).detach();
+			}
+		}
+
+	private:
+		void run(string filePath, GLfloat blockSize, Vector4 base)
+		{
+			try
+			{
+				BlockStructure* blockStructure = new BlockStructure(filePath, blockSize, base, [this](float fraction) { progress = fraction; });
+
+				delete result.exchange(blockStructure);
+			}
+			catch(const exception& e)
+			{
+				lock_guard<mutex> lock(errorMutex);
+				error = e.what();
+			}
+
+			progress = 1.0f;
+			loading = false;
+		}
+};
+
+#endif /*LEVELLOADER_H_*/
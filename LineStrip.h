@@ -0,0 +1,186 @@
+#ifndef LINESTRIP_H_
+#define LINESTRIP_H_
+
+#include <cstddef>		//size_t
+#include <cassert>		//assert
+#include <vector>		//vector
+#include <algorithm>	//min
+
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class keeps a growing line strip in a vertex buffer which persists between frames.
+  * Only the vertices added or moved since the last draw are uploaded, so a strip which grows by one vertex at a time
+  * and moves only its last vertex each frame costs a few bytes of transfer per frame however long it gets.
+  * The buffer doubles in size when it fills.  Changing the strip makes no GL calls; the buffer is created the first time it is drawn.
+  * @see BlockDriver
+  */
+class LineStrip
+{
+	public:
+		typedef size_t size_type;
+
+	private:
+		enum { x, y, z, w };
+		enum { initialCapacity = 64 };
+
+		vector<GLfloat> vertices;
+
+		//The vertices before this one are already in the buffer
+		mutable size_type uploaded;
+
+		//The vertices before this one have not changed since takeUnchanged() was last called
+		size_type unchanged;
+
+		mutable size_type capacity;
+		mutable GLuint vertexArray, vertexBuffer;
+
+		LineStrip(const LineStrip&);
+		LineStrip& operator = (const LineStrip&);
+
+	public:
+		LineStrip() : uploaded(0), unchanged(0), capacity(0), vertexArray(0), vertexBuffer(0) {}
+
+		~LineStrip() { release(); }
+
+		void push_back(const Vector4& position)
+		{
+			vertices.push_back(position[x]);
+			vertices.push_back(position[y]);
+			vertices.push_back(position[z]);
+		}
+
+		void pop_back()
+		{
+			assert(!empty());
+
+			vertices.resize(vertices.size() - 3);
+
+			uploaded = min(uploaded, size());
+			unchanged = min(unchanged, size());
+		}
+
+		/**
+		  * Moves the last vertex of the strip.
+		  */
+		void setBack(const Vector4& position)
+		{
+			assert(!empty());
+
+			GLfloat* back = &vertices[vertices.size() - 3];
+
+			back[x] = position[x];
+			back[y] = position[y];
+			back[z] = position[z];
+
+			uploaded = min(uploaded, size() - 1);
+			unchanged = min(unchanged, size() - 1);
+		}
+
+		/**
+		  * Keeps the first vertices of the strip and replaces the rest with tail, for instance the part of another strip which changed.
+		  * Only the replaced vertices are uploaded again.
+		  * @param tail the coordinates of the new vertices, three apiece
+		  */
+		void assign(size_type first, const vector<GLfloat>& tail)
+		{
+			assert(first <= size());
+
+			vertices.resize(first * 3);
+			vertices.insert(vertices.end(), tail.begin(), tail.end());
+
+			uploaded = min(uploaded, first);
+			unchanged = min(unchanged, first);
+		}
+
+		/**
+		  * @return how many vertices at the start of the strip have not been moved or removed since this was last called
+		  */
+		size_type takeUnchanged()
+		{
+			const size_type result = min(unchanged, size());
+
+			unchanged = size();
+
+			return result;
+		}
+
+		/**
+		  * @return the coordinates of the vertices, three apiece
+		  */
+		const vector<GLfloat>& getVertices() const { return vertices; }
+
+		size_type size() const { return vertices.size() / 3; }
+
+		bool empty() const { return vertices.empty(); }
+
+		/**
+		  * Draws the strip with the current colour.  This must be called on the thread which owns the GL context.
+		  */
+		void draw() const
+		{
+			if(size() < 2)
+				return;
+
+			if(vertexArray == 0)
+				create();
+
+			glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+
+			if(size() > capacity)
+			{
+				//Grow the buffer and upload the whole strip again
+				capacity = capacity == 0 ? (size_type)initialCapacity : capacity;
+
+				while(capacity < size())
+					capacity *= 2;
+
+				glBufferData(GL_ARRAY_BUFFER, capacity * 3 * sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+				uploaded = 0;
+			}
+
+			if(uploaded < size())
+				glBufferSubData(GL_ARRAY_BUFFER, uploaded * 3 * sizeof(GLfloat), (vertices.size() - uploaded * 3) * sizeof(GLfloat), &vertices[uploaded * 3]);
+
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			uploaded = size();
+
+			glBindVertexArray(vertexArray);
+			glDrawArrays(GL_LINE_STRIP, 0, (GLsizei)size());
+			glBindVertexArray(0);
+		}
+
+		/**
+		  * Frees the vertex buffer.  The strip is uploaded again if it is drawn afterwards.
+		  * This must be called on the thread which owns the GL context.
+		  */
+		void release() const
+		{
+			if(vertexArray != 0)
+				glDeleteVertexArrays(1, &vertexArray);
+
+			if(vertexBuffer != 0)
+				glDeleteBuffers(1, &vertexBuffer);
+
+			vertexArray = vertexBuffer = 0;
+			uploaded = capacity = 0;
+		}
+
+	private:
+		void create() const
+		{
+			glGenVertexArrays(1, &vertexArray);
+			glGenBuffers(1, &vertexBuffer);
+
+			glBindVertexArray(vertexArray);
+			glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glVertexPointer(3, GL_FLOAT, 0, (const void*)0);
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+};
+
+#endif /*LINESTRIP_H_*/
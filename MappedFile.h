@@ -0,0 +1,132 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstddef>		//size_t
+#include <string>		//string
+#include <stdexcept>	//runtime_error
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>	//mmap
+#include <sys/stat.h>	//fstat
+#include <fcntl.h>		//open
+#include <unistd.h>		//close
+#endif
+
+using namespace std;
+
+/**
+  * @brief This class maps a whole file read-only into memory for as long as the instance lives.
+  */
+class MappedFile
+{
+	public:
+		typedef size_t size_type;
+
+	private:
+		const unsigned char* contents;
+		size_type size;
+
+#ifdef _WIN32
+		HANDLE file, mapping;
+#else
+		int file;
+#endif
+
+		MappedFile(const MappedFile&);
+		MappedFile& operator = (const MappedFile&);
+
+	public:
+		/**
+		  * Maps the file at filePath.  This throws a runtime_error if the file cannot be opened or mapped.
+		  */
+		MappedFile(const string& filePath) : contents(NULL), size(0)
+		{
+#ifdef _WIN32
+			mapping = NULL;
+			file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+			if(file == INVALID_HANDLE_VALUE)
+				throw runtime_error("The specified file '" + filePath + "' does not exist.");
+
+			LARGE_INTEGER fileSize;
+			GetFileSizeEx(file, &fileSize);
+			size = (size_type)fileSize.QuadPart;
+
+			if(size > 0)
+			{
+				mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+				if(mapping != NULL)
+					contents = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+				if(contents == NULL)
+				{
+					close();
+					throw runtime_error("The specified file '" + filePath + "' could not be mapped.");
+				}
+			}
+#else
+			file = open(filePath.c_str(), O_RDONLY);
+
+			if(file < 0)
+				throw runtime_error("The specified file '" + filePath + "' does not exist.");
+
+			struct stat status;
+			fstat(file, &status);
+			size = (size_type)status.st_size;
+
+			if(size > 0)
+			{
+				void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+				if(address == MAP_FAILED)
+				{
+					close();
+					throw runtime_error("The specified file '" + filePath + "' could not be mapped.");
+				}
+
+				contents = (const unsigned char*)address;
+			}
+#endif
+		}
+
+		~MappedFile() { close(); }
+
+		/**
+		  * @return the first byte of the mapped file, or NULL if the file is empty
+		  */
+		const unsigned char* data() const { return contents; }
+
+		size_type getSize() const { return size; }
+
+	private:
+		void close()
+		{
+#ifdef _WIN32
+			if(contents != NULL)
+				UnmapViewOfFile(contents);
+
+			if(mapping != NULL)
+				CloseHandle(mapping);
+
+			if(file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if(contents != NULL)
+				munmap((void*)contents, size);
+
+			if(file >= 0)
+				::close(file);
+
+			file = -1;
+#endif
+			contents = NULL;
+		}
+};
+
+#endif /*MAPPEDFILE_H_*/
@@ -5,6 +5,7 @@
 #include <iostream>		//ostream
 #include <algorithm>	//fill and copy
 #include <cassert>		//assert
+#include <cmath>		//sqrt, cos and sin
 
 #include "Vector4.h"
 
@@ -101,6 +102,46 @@ class Matrix44
 			return product;
 		}
 
+		const Matrix44 operator * (const Matrix44& other) const
+		{
+			Matrix44 product(0.0);
+
+			for(size_t i = 0; i < 4; i++)
+				for(size_t j = 0; j < 4; j++)
+					for(size_t k = 0; k < 4; k++)
+						product[i][j] += matrix[i][k] * other.matrix[k][j];
+
+			return product;
+		}
+
+		/**
+		  * Builds the rotation glRotatef multiplies by, laid out as glGetFloatv returns it, so rotating a matrix read back from GL
+		  * needs no GL calls: the matrix glRotatef would leave on the stack after orientation is getRotation(...) * orientation.
+		  * @param degrees the angle of the rotation, counterclockwise when looking down the axis
+		  */
+		static Matrix44 getRotation(GLfloat degrees, GLfloat axisX, GLfloat axisY, GLfloat axisZ)
+		{
+			const double radians = degrees * 3.14159265358979323846 / 180.0;
+			const double length = sqrt(axisX * axisX + axisY * axisY + axisZ * axisZ);
+			const double a[3] = { axisX / length, axisY / length, axisZ / length };
+			const double c = cos(radians), s = sin(radians);
+			Matrix44 rotation;
+
+			//Each row of the layout is a column of the rotation
+			for(size_t i = 0; i < 3; i++)
+				for(size_t j = 0; j < 3; j++)
+					rotation[j][i] = (GLfloat)(a[i] * a[j] * (1.0 - c) + (i == j ? c : 0.0));
+
+			rotation[0][1] += (GLfloat)(a[2] * s);
+			rotation[1][0] -= (GLfloat)(a[2] * s);
+			rotation[2][0] += (GLfloat)(a[1] * s);
+			rotation[0][2] -= (GLfloat)(a[1] * s);
+			rotation[1][2] += (GLfloat)(a[0] * s);
+			rotation[2][1] -= (GLfloat)(a[0] * s);
+
+			return rotation;
+		}
+
 		friend ostream& operator << (ostream& lhs, const Matrix44& rhs)
 		{
 			for(size_t i = 0; i < 4; i++)
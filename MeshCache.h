@@ -0,0 +1,259 @@
+#ifndef MESHCACHE_H_
+#define MESHCACHE_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint32_t, int32_t and uint64_t
+#include <cstring>		//memcmp and memcpy
+#include <cstdio>		//FILE and fread
+#include <cassert>		//assert
+#include <algorithm>	//lexicographical_compare
+#include <utility>		//make_pair
+#include <vector>		//vector
+#include <map>			//map
+#include <unordered_map>	//unordered_map
+#include <fstream>		//ofstream and fstream
+#include <string>		//string
+#include <stdexcept>	//runtime_error
+
+#include <sys/stat.h>	//stat
+
+#include "MappedFile.h"
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class stores a triangle mesh loaded from a text .model file in a binary cache file beside it.
+  * The cache holds the positions, one normal per triangle and, for each edge of each triangle, the index of the triangle across that edge.
+  * It is memory mapped on load and rebuilt whenever the .model file's size and modification time change and its content hash no longer matches.
+  */
+class MeshCache
+{
+	public:
+		typedef vector<Vector4>::size_type size_type;
+
+		//Marks an edge which is not shared with any other triangle
+		enum { noNeighbour = -1 };
+
+	private:
+		static const uint32_t currentVersion = 1;
+
+		/**
+		  * The fixed header at the start of every cache file, followed by the positions, normals and neighbours.
+		  */
+		struct Header
+		{
+			char magic[4];
+			uint32_t version;
+			uint64_t sourceSize;
+			uint64_t sourceModified;
+			uint64_t sourceHash;
+			uint32_t vertexCount;
+			uint32_t triangleCount;
+		};
+
+		static_assert(sizeof(Header) == 40, "MeshCache::Header must not contain padding");
+
+	public:
+		/**
+		  * @return the path of the cache file kept for the model at filePath
+		  */
+		static string getCachePath(const string& filePath) { return filePath + ".cache"; }
+
+		/**
+		  * Reads the cache for the model at filePath if it is still valid.
+		  * @return false if there is no usable cache, in which case the model must be parsed
+		  */
+		static bool read(const string& filePath, vector<Vector4>& vertices, vector<Vector4>& normals, vector<int32_t>& neighbours)
+		{
+			uint64_t sourceSize, sourceModified;
+			Header header;
+			bool touched;
+
+			if(!getStatus(filePath, sourceSize, sourceModified))
+				return false;
+
+			try
+			{
+				MappedFile cache(getCachePath(filePath));
+
+				if(cache.getSize() < sizeof(Header))
+					return false;
+
+				memcpy(&header, cache.data(), sizeof(Header));
+
+				if(memcmp(header.magic, "BLKM", 4) != 0 || header.version != currentVersion)
+					return false;
+
+				const size_type floatsPerVector = Vector4::static_size;
+				const size_type expectedSize = sizeof(Header) + (header.vertexCount + header.triangleCount) * floatsPerVector * sizeof(GLfloat) + header.triangleCount * 3 * sizeof(int32_t);
+
+				if(cache.getSize() != expectedSize || header.vertexCount != header.triangleCount * 3)
+					return false;
+
+				touched = header.sourceSize != sourceSize || header.sourceModified != sourceModified;
+
+				if(touched && header.sourceHash != hashFile(filePath))
+					return false;
+
+				const GLfloat* positions = (const GLfloat*)(cache.data() + sizeof(Header));
+				const GLfloat* triangleNormals = positions + header.vertexCount * floatsPerVector;
+				const int32_t* triangleNeighbours = (const int32_t*)(triangleNormals + header.triangleCount * floatsPerVector);
+
+				vertices.resize(header.vertexCount);
+				normals.resize(header.triangleCount);
+
+				for(size_type i = 0; i < vertices.size(); i++)
+					memcpy(vertices[i].data(), positions + i * floatsPerVector, floatsPerVector * sizeof(GLfloat));
+
+				for(size_type i = 0; i < normals.size(); i++)
+					memcpy(normals[i].data(), triangleNormals + i * floatsPerVector, floatsPerVector * sizeof(GLfloat));
+
+				neighbours.assign(triangleNeighbours, triangleNeighbours + header.triangleCount * 3);
+			}
+			catch(const runtime_error&)
+			{
+				return false;
+			}
+
+			//A touched but unchanged model keeps its cache, which is told the new size and time so the model is not hashed again next load.
+			//This waits until the cache is unmapped, since Windows will not open a mapped file for writing.
+			if(touched)
+			{
+				header.sourceSize = sourceSize;
+				header.sourceModified = sourceModified;
+
+				fstream out(getCachePath(filePath).c_str(), ios::in | ios::out | ios::binary);
+
+				out.write((const char*)&header, sizeof(header));
+			}
+
+			return true;
+		}
+
+		/**
+		  * Writes the cache for the model at filePath.  Failing to write the cache is not an error; the model is simply parsed again next time.
+		  * @return true if the cache was written
+		  */
+		static bool write(const string& filePath, const vector<Vector4>& vertices, const vector<Vector4>& normals, const vector<int32_t>& neighbours)
+		{
+			Header header;
+
+			if(vertices.size() != normals.size() * 3 || neighbours.size() != vertices.size() || !getStatus(filePath, header.sourceSize, header.sourceModified))
+				return false;
+
+			memcpy(header.magic, "BLKM", 4);
+			header.version = currentVersion;
+			header.sourceHash = hashFile(filePath);
+			header.vertexCount = (uint32_t)vertices.size();
+			header.triangleCount = (uint32_t)normals.size();
+
+			ofstream out(getCachePath(filePath).c_str(), ios::binary);
+
+			if(out.fail())
+				return false;
+
+			out.write((const char*)&header, sizeof(header));
+
+			for(vector<Vector4>::const_iterator i = vertices.begin(); i != vertices.end(); i++)
+				out.write((const char*)i -> data(), Vector4::static_size * sizeof(GLfloat));
+
+			for(vector<Vector4>::const_iterator i = normals.begin(); i != normals.end(); i++)
+				out.write((const char*)i -> data(), Vector4::static_size * sizeof(GLfloat));
+
+			out.write((const char*)neighbours.data(), neighbours.size() * sizeof(int32_t));
+
+			return !out.fail();
+		}
+
+		/**
+		  * Finds, for every edge of every triangle, the triangle which shares that edge in the opposite direction.
+		  * Edge e of triangle t runs from vertex 3t + e to vertex 3t + (e + 1) % 3, and its neighbour is stored at index 3t + e.
+		  * Vertices are matched by position, so the mesh does not need to be indexed.
+		  */
+		static vector<int32_t> computeNeighbours(const vector<Vector4>& vertices)
+		{
+			assert(vertices.size() % 3 == 0);
+
+			//Weld the vertices so edges can be keyed by a pair of indices
+			map<Vector4, uint32_t, VectorLess> welded;
+			vector<uint32_t> indices(vertices.size());
+
+			for(size_type i = 0; i < vertices.size(); i++)
+				indices[i] = welded.insert(make_pair(vertices[i], (uint32_t)welded.size())).first -> second;
+
+			unordered_map<uint64_t, int32_t> edges;
+			vector<int32_t> neighbours(vertices.size(), noNeighbour);
+
+			edges.reserve(vertices.size());
+
+			for(size_type i = 0; i < vertices.size(); i++)
+			{
+				size_type next = i - i % 3 + (i + 1) % 3;
+
+				edges[((uint64_t)indices[i] << 32) | indices[next]] = (int32_t)i;
+			}
+
+			for(size_type i = 0; i < vertices.size(); i++)
+			{
+				size_type next = i - i % 3 + (i + 1) % 3;
+				unordered_map<uint64_t, int32_t>::const_iterator opposite = edges.find(((uint64_t)indices[next] << 32) | indices[i]);
+
+				if(opposite != edges.end())
+					neighbours[i] = opposite -> second / 3;
+			}
+
+			return neighbours;
+		}
+
+	private:
+		struct VectorLess
+		{
+			bool operator () (const Vector4& lhs, const Vector4& rhs) const { return lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end()); }
+		};
+
+		static bool getStatus(const string& filePath, uint64_t& size, uint64_t& modified)
+		{
+#ifdef _WIN32
+			struct _stat64 status;
+
+			if(_stat64(filePath.c_str(), &status) != 0)
+				return false;
+#else
+			struct stat status;
+
+			if(stat(filePath.c_str(), &status) != 0)
+				return false;
+#endif
+
+			size = (uint64_t)status.st_size;
+			modified = (uint64_t)status.st_mtime;
+
+			return true;
+		}
+
+		/**
+		  * FNV-1a over the bytes of the file
+		  */
+		static uint64_t hashFile(const string& filePath)
+		{
+			uint64_t result = 14695981039346656037ULL;
+			FILE* file = fopen(filePath.c_str(), "rb");
+
+			if(file == NULL)
+				return result;
+
+			unsigned char buffer[1 << 16];
+			size_t count;
+
+			while((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+				for(size_t i = 0; i < count; i++)
+					result = (result ^ buffer[i]) * 1099511628211ULL;
+
+			fclose(file);
+
+			return result;
+		}
+};
+
+#endif /*MESHCACHE_H_*/
@@ -0,0 +1,138 @@
+#ifndef OFFSCREENCONTEXT_H_
+#define OFFSCREENCONTEXT_H_
+
+#include <cstdint>		//uint8_t
+#include <vector>		//vector
+#include <stdexcept>	//runtime_error
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+using namespace std;
+
+/**
+  * @brief This class creates a GL context with no window through EGL's surfaceless platform, as Mesa provides on headless machines,
+  * and renders into a framebuffer object of a fixed size.  The context asks for the same version as the windowed game, so everything
+  * draws as it does on screen.  This throws a runtime_error if EGL or the context cannot be set up.
+  */
+class OffscreenContext
+{
+	private:
+		EGLDisplay display;
+		EGLContext context;
+		GLsizei width, height;
+		GLuint framebuffer, colorBuffer, depthStencilBuffer;
+
+		OffscreenContext(const OffscreenContext&);
+		OffscreenContext& operator = (const OffscreenContext&);
+
+	public:
+		/**
+		  * Creates the context, makes it current on this thread, loads the GL functions and binds a framebuffer of width by height.
+		  */
+		OffscreenContext(GLsizei width, GLsizei height) : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), width(width), height(height), framebuffer(0), colorBuffer(0), depthStencilBuffer(0)
+		{
+			display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+			if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+				throw runtime_error("EGL's surfaceless platform is not available.");
+
+			const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+			const EGLint contextAttributes[] = { EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 0, EGL_NONE };
+			EGLConfig config = EGL_NO_CONFIG_KHR;
+			EGLint configCount = 0;
+
+			if(!eglBindAPI(EGL_OPENGL_API))
+			{
+				release();
+				throw runtime_error("EGL cannot render desktop GL.");
+			}
+
+			//Nothing is drawn to an EGL surface, so any config which can render desktop GL will do.  The surfaceless platform may offer
+			//no configs at all, in which case the context is created without one.
+			if(!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+				config = EGL_NO_CONFIG_KHR;
+
+			context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+
+			if(context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+			{
+				release();
+				throw runtime_error("An offscreen GL context could not be created.");
+			}
+
+			gladLoadGL((GLADloadfunc)eglGetProcAddress);
+
+			glGenRenderbuffers(1, &colorBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+			//The shadow volumes need a stencil buffer alongside the depth buffer
+			glGenRenderbuffers(1, &depthStencilBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, depthStencilBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencilBuffer);
+
+			if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			{
+				release();
+				throw runtime_error("The offscreen framebuffer is not supported.");
+			}
+
+			glViewport(0, 0, width, height);
+		}
+
+		~OffscreenContext() { release(); }
+
+		/**
+		  * Reads the framebuffer as 8-bit RGB, bottom row first.
+		  */
+		void readPixels(vector<uint8_t>& pixels) const
+		{
+			pixels.resize((size_t)width * height * 3);
+
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+		}
+
+		GLsizei getWidth() const { return width; }
+
+		GLsizei getHeight() const { return height; }
+
+	private:
+		void release()
+		{
+			if(context != EGL_NO_CONTEXT && eglGetCurrentContext() == context)
+			{
+				if(framebuffer != 0)
+					glDeleteFramebuffers(1, &framebuffer);
+
+				if(colorBuffer != 0)
+					glDeleteRenderbuffers(1, &colorBuffer);
+
+				if(depthStencilBuffer != 0)
+					glDeleteRenderbuffers(1, &depthStencilBuffer);
+
+				eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			}
+
+			framebuffer = colorBuffer = depthStencilBuffer = 0;
+
+			if(context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+
+			if(display != EGL_NO_DISPLAY)
+				eglTerminate(display);
+
+			context = EGL_NO_CONTEXT;
+			display = EGL_NO_DISPLAY;
+		}
+};
+
+#endif /*OFFSCREENCONTEXT_H_*/
@@ -0,0 +1,469 @@
+#ifndef PUZZLECATALOG_H_
+#define PUZZLECATALOG_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint64_t
+#include <vector>		//vector
+#include <deque>		//deque
+#include <string>		//string
+#include <unordered_map>	//unordered_map
+#include <algorithm>	//sort and upper_bound
+#include <thread>		//thread
+#include <mutex>		//mutex, unique_lock and lock_guard
+#include <condition_variable>	//condition_variable
+#include <exception>	//exception
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>		//opendir and readdir
+#include <sys/stat.h>	//stat
+#include <unistd.h>		//read and close
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>	//inotify_init1 and inotify_add_watch
+#endif
+
+#include "BlockGrid.h"
+#include "BlockParser.h"
+#include "BlockFile.h"
+
+using namespace std;
+
+/**
+  * @brief This class lists the puzzles in a directory along with their dimensions, size and content hash.
+  * The directory is listed once on construction.  After that, refresh() picks up changes reported by the file system
+  * (inotify on Linux, change notifications on Windows).  Puzzles are parsed on a worker thread, only when they are new or changed, so
+  * an entry is listed straight away and its details are filled in by a later refresh().
+  */
+class PuzzleCatalog
+{
+	public:
+		typedef size_t size_type;
+
+		struct Entry
+		{
+			string name;		//File name without its extension, ready to be drawn
+			string fileName;
+			string path;
+			size_type height, rows, columns;
+			uint64_t fileSize;
+			uint64_t modified;
+			uint64_t hash;		//Content hash of the puzzle, equal for the .block and .blockb forms of a puzzle
+			bool valid;
+			bool pending;		//True until the worker has read the file
+
+			Entry() : height(0), rows(0), columns(0), fileSize(0), modified(0), hash(0), valid(false), pending(false) {}
+
+			friend bool operator < (const Entry& lhs, const Entry& rhs) { return lhs.name < rhs.name || (lhs.name == rhs.name && lhs.fileName < rhs.fileName); }
+		};
+
+	private:
+		string directory;
+
+		//Render thread only
+		vector<Entry> entries;
+		unordered_map<string, size_type> indices;
+		size_type pendingReads;
+
+		//Shared with the worker
+		thread worker;
+		mutex queueMutex;
+		condition_variable queueChanged, readsFinished;
+		deque<Entry> requests, results;
+		bool isWorking;
+		bool stopping;
+
+#ifdef _WIN32
+		HANDLE notification;
+#elif defined(__linux__)
+		int notification;
+#endif
+
+		PuzzleCatalog(const PuzzleCatalog&);
+		PuzzleCatalog& operator = (const PuzzleCatalog&);
+
+	public:
+		PuzzleCatalog(const string& directory) : directory(directory), pendingReads(0), isWorking(false), stopping(false)
+		{
+#ifdef _WIN32
+			notification = FindFirstChangeNotificationA(directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+#elif defined(__linux__)
+			notification = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+			if(notification >= 0 && inotify_add_watch(notification, directory.c_str(), IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0)
+			{
+				close(notification);
+				notification = -1;
+			}
+#endif
+
+			worker = thread(&PuzzleCatalog::run, this);
+
+			rescan();
+		}
+
+		~PuzzleCatalog()
+		{
+			{
+				lock_guard<mutex> lock(queueMutex);
+				stopping = true;
+			}
+
+			queueChanged.notify_one();
+			worker.join();
+
+#ifdef _WIN32
+			if(notification != INVALID_HANDLE_VALUE)
+				FindCloseChangeNotification(notification);
+#elif defined(__linux__)
+			if(notification >= 0)
+				close(notification);
+#endif
+		}
+
+		/**
+		  * Applies the reads the worker has finished and any changes reported in the directory.  No puzzle is parsed here, but the
+		  * directory is listed again on Windows, and on overflow of the change queue on Linux.  This can be called every frame.
+		  * @return true if the entries changed
+		  */
+		bool refresh()
+		{
+			bool changed = collectReads();
+
+#ifdef _WIN32
+			if(notification == INVALID_HANDLE_VALUE || WaitForSingleObject(notification, 0) != WAIT_OBJECT_0)
+				return changed;
+
+			FindNextChangeNotification(notification);
+
+			return rescan() || changed;
+#elif defined(__linux__)
+			if(notification < 0)
+				return changed;
+
+			//inotify_event records are variable length, so keep the buffer aligned for them.
+			union { struct inotify_event event; char bytes[4096]; } buffer;
+			ssize_t length;
+
+			while((length = ::read(notification, buffer.bytes, sizeof(buffer.bytes))) > 0)
+				for(ssize_t i = 0; i < length; )
+				{
+					const struct inotify_event* event = (const struct inotify_event*)(buffer.bytes + i);
+
+					if(event -> mask & IN_Q_OVERFLOW)
+						changed = rescan() || changed;
+					else if(event -> len > 0)
+						changed = update(event -> name) || changed;
+
+					i += sizeof(struct inotify_event) + event -> len;
+				}
+
+			return changed;
+#else
+			return changed;
+#endif
+		}
+
+		/**
+		  * Waits for the worker to read every puzzle listed so far and applies the results, for callers which need the whole catalog
+		  * at once rather than a menu which fills in over several frames.
+		  */
+		void finishReads()
+		{
+			{
+				unique_lock<mutex> lock(queueMutex);
+
+				while(!requests.empty() || isWorking)
+					readsFinished.wait(lock);
+			}
+
+			collectReads();
+		}
+
+		/**
+		  * @return the puzzles sorted by name
+		  */
+		const vector<Entry>& getEntries() const { return entries; }
+
+		/**
+		  * @return true while some entries are still waiting to be read
+		  */
+		bool isPending() const { return pendingReads > 0; }
+
+	private:
+		/**
+		  * Lists the directory again, re-reading only new files and files whose size or modification time changed.
+		  */
+		bool rescan()
+		{
+			vector<Entry> listed;
+			bool changed = false;
+
+#ifdef _WIN32
+			WIN32_FIND_DATAA findData;
+			HANDLE listing = FindFirstFileA((directory + "\\*").c_str(), &findData);
+
+			if(listing != INVALID_HANDLE_VALUE)
+			{
+				do
+				{
+					if(!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && isPuzzle(findData.cFileName))
+					{
+						Entry entry;
+
+						entry.fileName = findData.cFileName;
+						entry.fileSize = ((uint64_t)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+						entry.modified = ((uint64_t)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+						listed.push_back(entry);
+					}
+				}
+				while(FindNextFileA(listing, &findData) != 0);
+
+				FindClose(listing);
+			}
+#else
+			DIR* listing = opendir(directory.c_str());
+
+			if(listing != NULL)
+			{
+				for(struct dirent* i = readdir(listing); i != NULL; i = readdir(listing))
+				{
+					Entry entry;
+
+					entry.fileName = i -> d_name;
+
+					if(isPuzzle(entry.fileName) && stat(entry.fileName, entry))
+						listed.push_back(entry);
+				}
+
+				closedir(listing);
+			}
+#endif
+
+			for(vector<Entry>::iterator i = listed.begin(); i != listed.end(); i++)
+			{
+				const Entry* existing = find(i -> fileName);
+
+				if(existing != NULL && existing -> fileSize == i -> fileSize && existing -> modified == i -> modified)
+					*i = *existing;
+				else
+				{
+					queueRead(*i);
+					changed = true;
+				}
+			}
+
+			changed = changed || listed.size() != entries.size();
+
+			sort(listed.begin(), listed.end());
+			entries.swap(listed);
+			reindex();
+
+			return changed;
+		}
+
+#ifndef _WIN32
+		/**
+		  * Brings a single entry up to date after the file system reported a change to it.
+		  */
+		bool update(const string& fileName)
+		{
+			if(!isPuzzle(fileName))
+				return false;
+
+			Entry* existing = find(fileName);
+			Entry entry;
+
+			entry.fileName = fileName;
+
+			//The file was removed or renamed away
+			if(!stat(fileName, entry))
+			{
+				if(existing == NULL)
+					return false;
+
+				entries.erase(entries.begin() + (existing - entries.data()));
+				reindex();
+
+				return true;
+			}
+
+			if(existing != NULL && existing -> fileSize == entry.fileSize && existing -> modified == entry.modified)
+				return false;
+
+			queueRead(entry);
+
+			if(existing != NULL)
+				*existing = entry;
+			else
+			{
+				entries.insert(upper_bound(entries.begin(), entries.end(), entry), entry);
+				reindex();
+			}
+
+			return true;
+		}
+
+		bool stat(const string& fileName, Entry& entry) const
+		{
+			struct stat status;
+
+			if(::stat((directory + "/" + fileName).c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+				return false;
+
+			entry.fileSize = (uint64_t)status.st_size;
+			entry.modified = (uint64_t)status.st_mtime;
+
+			return true;
+		}
+#endif
+
+		/**
+		  * Lists entry with what can be known without reading the file and hands it to the worker to read.
+		  */
+		void queueRead(Entry& entry)
+		{
+			entry.name = entry.fileName.substr(0, entry.fileName.find_last_of("."));
+			entry.path = directory + "/" + entry.fileName;
+			entry.height = entry.rows = entry.columns = 0;
+			entry.hash = 0;
+			entry.valid = false;
+			entry.pending = true;
+
+			{
+				lock_guard<mutex> lock(queueMutex);
+				requests.push_back(entry);
+			}
+
+			pendingReads++;
+			queueChanged.notify_one();
+		}
+
+		/**
+		  * Copies the reads the worker has finished into the entries they were made for.  A read is dropped if its file has changed
+		  * since, as a newer read of it is then queued.
+		  */
+		bool collectReads()
+		{
+			deque<Entry> finished;
+
+			{
+				lock_guard<mutex> lock(queueMutex);
+				finished.swap(results);
+			}
+
+			bool changed = false;
+
+			for(deque<Entry>::const_iterator i = finished.begin(); i != finished.end(); i++)
+			{
+				Entry* existing = find(i -> fileName);
+
+				pendingReads--;
+
+				if(existing != NULL && existing -> fileSize == i -> fileSize && existing -> modified == i -> modified)
+				{
+					*existing = *i;
+					changed = true;
+				}
+			}
+
+			return changed;
+		}
+
+		void run()
+		{
+			unique_lock<mutex> lock(queueMutex);
+
+			for(;;)
+			{
+				while(!stopping && requests.empty())
+					queueChanged.wait(lock);
+
+				if(stopping)
+					return;
+
+				Entry entry = requests.front();
+
+				requests.pop_front();
+				isWorking = true;
+				lock.unlock();
+
+				read(entry);
+
+				lock.lock();
+				results.push_back(entry);
+				isWorking = false;
+
+				if(requests.empty())
+					readsFinished.notify_all();
+			}
+		}
+
+		/**
+		  * Fills in the dimensions and hash of entry.  Unreadable puzzles are kept, but marked as invalid.
+		  */
+		static void read(Entry& entry)
+		{
+			entry.pending = false;
+
+			try
+			{
+				if(BlockFile::isBinaryPath(entry.fileName))
+				{
+					BlockFile file(entry.path);
+
+					entry.height = file.getHeight();
+					entry.rows = file.getRows();
+					entry.columns = file.getColumns();
+					entry.hash = file.getContentHash();
+				}
+				else
+				{
+					BlockGrid grid;
+
+					entry.path >> grid;
+
+					entry.height = grid.getHeight();
+					entry.rows = grid.getRows();
+					entry.columns = grid.getColumns();
+					entry.hash = grid.hash();
+				}
+
+				entry.valid = true;
+			}
+			catch(const exception&)
+			{
+				entry.height = entry.rows = entry.columns = 0;
+				entry.hash = 0;
+			}
+		}
+
+		Entry* find(const string& fileName)
+		{
+			unordered_map<string, size_type>::const_iterator found = indices.find(fileName);
+
+			return found != indices.end() ? &entries[found -> second] : NULL;
+		}
+
+		/**
+		  * Rebuilds the index from file names to entries after entries were added, removed or sorted.
+		  */
+		void reindex()
+		{
+			indices.clear();
+
+			for(size_type i = 0; i < entries.size(); i++)
+				indices[entries[i].fileName] = i;
+		}
+
+		static bool isPuzzle(const string& fileName)
+		{
+			const string extension = ".block";
+
+			return BlockFile::isBinaryPath(fileName) || (fileName.size() > extension.size() && fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0);
+		}
+};
+
+#endif /*PUZZLECATALOG_H_*/
@@ -0,0 +1,410 @@
+#ifndef SCENELIGHTING_H_
+#define SCENELIGHTING_H_
+
+#include <cstddef>		//size_t
+#include <cstring>		//memset, memcmp and memcpy
+#include <cmath>		//cos
+#include <cassert>		//assert
+#include <algorithm>	//min and max
+#include <memory>		//unique_ptr
+#include <string>		//string
+#include <stdexcept>	//runtime_error
+#include <iostream>		//cerr
+
+#include "ShaderProgram.h"
+
+using namespace std;
+
+/**
+  * @brief This class lights the scene in a shader, from lights and materials kept in a uniform buffer, in place of the fixed-function lights.
+  * The buffer is only written when a light, a material or the selection between them changes.  Any program which declares the
+  * Lighting block through shadingSource and calls bindBlock() reads the same buffer, so other shaders light their geometry the same way.
+  *
+  * Lighting follows the fixed-function equations per vertex, with the vertex colour as the ambient and diffuse colour of the material,
+  * just as GL_COLOR_MATERIAL gave.  Light positions and spot directions are in world coordinates unless they are fixed to the eye,
+  * and are moved into eye coordinates by the modelview matrix in the shader, so lit geometry must be drawn with only the camera on it.
+  * Changing the buffer before it is created makes no GL calls.
+  * @see BlockInstances
+  */
+class SceneLighting
+{
+	public:
+		enum { lightCount = 3, materialCount = 2 };
+
+		//The uniform buffer binding point the Lighting block is read from
+		enum { bindingPoint = 1 };
+
+		static const char* const shadingSource;
+
+	private:
+		enum { x, y, z, w };
+
+		//Laid out as the std140 Lighting block in shadingSource
+		struct Light
+		{
+			GLfloat position[4];
+			GLfloat ambient[4];
+			GLfloat diffuse[4];
+			GLfloat specular[4];
+			GLfloat spot[4];			//Direction, then the cosine of the cutoff angle or -2 for lights which are not spotlights
+			GLfloat factors[4];			//Constant, linear and quadratic attenuation, then the spot exponent
+		};
+
+		struct Material
+		{
+			GLfloat specular[4];
+			GLfloat shininess[4];		//Only the first is used
+		};
+
+		struct Block
+		{
+			Light lights[lightCount];
+			Material materials[materialCount];
+			GLfloat sceneAmbient[4];
+			GLint state[4];				//Enabled lights and lights fixed to the eye, as bit masks, then the material and whether it is textured
+		};
+
+		Block block;
+
+		//The bytes of the block changed since it was last uploaded, last excluded
+		mutable size_t changedFirst, changedLast;
+
+		mutable GLuint buffer;
+		mutable unique_ptr<ShaderProgram> program;
+		mutable bool failed;
+
+		SceneLighting(const SceneLighting&);
+		SceneLighting& operator = (const SceneLighting&);
+
+	public:
+		/**
+		  * Starts with every light off and the fixed-function defaults for everything else.
+		  */
+		SceneLighting() : changedFirst(0), changedLast(0), buffer(0), failed(false)
+		{
+			memset(&block, 0, sizeof(block));
+
+			for(unsigned i = 0; i < lightCount; i++)
+			{
+				Light& light = block.lights[i];
+
+				light.position[z] = 1.0f;
+				light.ambient[w] = light.diffuse[w] = light.specular[w] = 1.0f;
+				light.spot[z] = -1.0f;
+				light.spot[w] = -2.0f;
+				light.factors[x] = 1.0f;
+			}
+
+			for(unsigned i = 0; i < materialCount; i++)
+				block.materials[i].specular[w] = 1.0f;
+
+			block.sceneAmbient[x] = block.sceneAmbient[y] = block.sceneAmbient[z] = 0.2f;
+			block.sceneAmbient[w] = 1.0f;
+		}
+
+		~SceneLighting() { release(); }
+
+		/**
+		  * @param eyeCoordinates true if position is in eye coordinates and so moves with the camera
+		  */
+		void setPosition(unsigned light, const GLfloat (&position)[4], bool eyeCoordinates = false)
+		{
+			assert(light < lightCount);
+
+			set(block.lights[light].position, position, 4);
+			setBit(y, light, eyeCoordinates);
+		}
+
+		void setColors(unsigned light, const GLfloat (&ambient)[4], const GLfloat (&diffuse)[4], const GLfloat (&specular)[4])
+		{
+			assert(light < lightCount);
+
+			set(block.lights[light].ambient, ambient, 4);
+			set(block.lights[light].diffuse, diffuse, 4);
+			set(block.lights[light].specular, specular, 4);
+		}
+
+		/**
+		  * @param cutoff the angle in degrees from direction at which the light stops, or 180 for a light which shines everywhere
+		  */
+		void setSpot(unsigned light, const GLfloat (&direction)[4], GLfloat cutoff, GLfloat exponent)
+		{
+			assert(light < lightCount);
+
+			const GLfloat spot[4] = { direction[x], direction[y], direction[z], cutoff == 180.0f ? -2.0f : (GLfloat)cos(cutoff * 3.14159265358979 / 180.0) };
+
+			set(block.lights[light].spot, spot, 4);
+			set(block.lights[light].factors + w, &exponent, 1);
+		}
+
+		void setAttenuation(unsigned light, GLfloat constant, GLfloat linear, GLfloat quadratic)
+		{
+			assert(light < lightCount);
+
+			const GLfloat factors[3] = { constant, linear, quadratic };
+
+			set(block.lights[light].factors, factors, 3);
+		}
+
+		void setEnabled(unsigned light, bool enabled)
+		{
+			assert(light < lightCount);
+
+			setBit(x, light, enabled);
+		}
+
+		/**
+		  * The ambient and diffuse colour of every material is the colour of the vertex being lit.
+		  */
+		void setMaterial(unsigned material, const GLfloat (&specular)[4], GLfloat shininess)
+		{
+			assert(material < materialCount);
+
+			set(block.materials[material].specular, specular, 4);
+			set(block.materials[material].shininess, &shininess, 1);
+		}
+
+		/**
+		  * Chooses the material of what is drawn next.
+		  */
+		void selectMaterial(unsigned material)
+		{
+			assert(material < materialCount);
+
+			setState(z, (GLint)material);
+		}
+
+		/**
+		  * Chooses whether what is drawn next takes its colour from texture unit 0 as well, through its first texture coordinates.
+		  */
+		void setTextured(bool textured) { setState(w, textured); }
+
+		/**
+		  * Binds the lighting shader and the uniform buffer, creating them the first time.  Geometry is given through the fixed-function
+		  * vertex, normal, colour and texture coordinate arrays.  This must be called on the thread which owns the GL context.
+		  * @return false if the shader is not available, in which case nothing was bound
+		  */
+		bool use() const
+		{
+			if(failed || (buffer == 0 && !create()))
+				return false;
+
+			upload();
+			glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, buffer);
+			program -> use();
+
+			return true;
+		}
+
+		/**
+		  * Points the Lighting block of program at the uniform buffer.
+		  */
+		static void bindBlock(const ShaderProgram& program)
+		{
+			const GLuint index = glGetUniformBlockIndex(program.getName(), "Lighting");
+
+			if(index != GL_INVALID_INDEX)
+				glUniformBlockBinding(program.getName(), index, bindingPoint);
+		}
+
+		/**
+		  * Frees the uniform buffer and the shader.  This must be called on the thread which owns the GL context.
+		  */
+		void release() const
+		{
+			if(buffer != 0)
+				glDeleteBuffers(1, &buffer);
+
+			buffer = 0;
+			program.reset();
+		}
+
+	private:
+		bool create() const
+		{
+			try
+			{
+				program.reset(new ShaderProgram(string("#version 130\n") + shadingSource + vertexSource, string("#version 130\n") + shadingSource + fragmentSource));
+			}
+			catch(const runtime_error& e)
+			{
+				cerr << e.what() << endl;
+				failed = true;
+
+				return false;
+			}
+
+			bindBlock(*program);
+
+			GLint previousProgram;
+
+			glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+			program -> use();
+			glUniform1i(program -> getUniformLocation("surfaceTexture"), 0);
+			glUseProgram(previousProgram);
+
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(block), &block, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			changedFirst = changedLast = 0;
+
+			return true;
+		}
+
+		/**
+		  * Writes the changed part of the block to the uniform buffer.
+		  */
+		void upload() const
+		{
+			if(buffer == 0 || changedFirst == changedLast)
+				return;
+
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glBufferSubData(GL_UNIFORM_BUFFER, changedFirst, changedLast - changedFirst, (const char*)&block + changedFirst);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+			changedFirst = changedLast = 0;
+		}
+
+		template<typename T>
+		void set(T* destination, const T* values, size_t count)
+		{
+			if(memcmp(destination, values, count * sizeof(T)) == 0)
+				return;
+
+			memcpy(destination, values, count * sizeof(T));
+
+			const size_t first = (const char*)destination - (const char*)&block, last = first + count * sizeof(T);
+
+			if(changedFirst == changedLast)
+			{
+				changedFirst = first;
+				changedLast = last;
+			}
+			else
+			{
+				changedFirst = min(changedFirst, first);
+				changedLast = max(changedLast, last);
+			}
+
+			//Changes between draws go straight to the buffer, so the next draw sees them
+			upload();
+		}
+
+		void setState(unsigned i, GLint value) { set(block.state + i, &value, 1); }
+
+		void setBit(unsigned i, unsigned bit, bool value) { setState(i, value ? block.state[i] | 1 << bit : block.state[i] & ~(1 << bit)); }
+
+		static const char* const vertexSource;
+		static const char* const fragmentSource;
+};
+
+//Declares the Lighting block and shade(), which follows the fixed-function lighting equations with a viewer at infinity
+const char* const SceneLighting::shadingSource = R"(
+#extension GL_ARB_uniform_buffer_object : require
+
+struct Light
+{
+	vec4 position;
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	vec4 spot;
+	vec4 factors;
+};
+
+struct Material
+{
+	vec4 specular;
+	vec4 shininess;
+};
+
+layout(std140) uniform Lighting
+{
+	Light lights[3];
+	Material materials[2];
+	vec4 sceneAmbient;
+	ivec4 state;
+};
+
+vec4 shade(vec3 eyePosition, vec3 eyeNormal, vec4 materialColor)
+{
+	Material material = materials[state.z];
+	vec4 result = materialColor * sceneAmbient;
+
+	for(int i = 0; i < 3; i++)
+	{
+		if((state.x & (1 << i)) == 0)
+			continue;
+
+		bool fixedToEye = (state.y & (1 << i)) != 0;
+		vec4 position = fixedToEye ? lights[i].position : gl_ModelViewMatrix * lights[i].position;
+		vec3 toLight;
+		float attenuation = 1.0;
+
+		if(position.w != 0.0)
+		{
+			toLight = position.xyz / position.w - eyePosition;
+
+			float distance = length(toLight);
+
+			toLight /= distance;
+			attenuation = 1.0 / (lights[i].factors.x + lights[i].factors.y * distance + lights[i].factors.z * distance * distance);
+
+			if(lights[i].spot.w >= -1.0)
+			{
+				vec3 direction = fixedToEye ? lights[i].spot.xyz : mat3(gl_ModelViewMatrix) * lights[i].spot.xyz;
+				float spot = dot(-toLight, normalize(direction));
+
+				attenuation *= spot < lights[i].spot.w ? 0.0 : pow(spot, lights[i].factors.w);
+			}
+		}
+		else
+			toLight = normalize(position.xyz);
+
+		float diffuse = dot(eyeNormal, toLight);
+		vec4 contribution = materialColor * lights[i].ambient;
+
+		if(diffuse > 0.0)
+		{
+			float specular = max(dot(eyeNormal, normalize(toLight + vec3(0.0, 0.0, 1.0))), 0.0);
+
+			contribution += diffuse * materialColor * lights[i].diffuse + pow(specular, material.shininess.x) * material.specular * lights[i].specular;
+		}
+
+		result += attenuation * contribution;
+	}
+
+	return clamp(vec4(result.rgb, materialColor.a), 0.0, 1.0);
+}
+)";
+
+//ftransform gives the same depth as every other pass over the scene, so the lighting pass can test for equal depth
+const char* const SceneLighting::vertexSource = R"(
+out vec4 color;
+out vec2 textureCoordinate;
+
+void main()
+{
+	color = shade(vec3(gl_ModelViewMatrix * gl_Vertex), normalize(gl_NormalMatrix * gl_Normal), gl_Color);
+	textureCoordinate = gl_MultiTexCoord0.xy;
+	gl_Position = ftransform();
+}
+)";
+
+const char* const SceneLighting::fragmentSource = R"(
+uniform sampler2D surfaceTexture;
+
+in vec4 color;
+in vec2 textureCoordinate;
+
+void main()
+{
+	gl_FragColor = state.w != 0 ? color * texture(surfaceTexture, textureCoordinate) : color;
+}
+)";
+
+#endif /*SCENELIGHTING_H_*/
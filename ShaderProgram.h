@@ -0,0 +1,125 @@
+#ifndef SHADERPROGRAM_H_
+#define SHADERPROGRAM_H_
+
+#include <vector>		//vector
+#include <string>		//string
+#include <utility>		//pair
+#include <stdexcept>	//runtime_error
+
+using namespace std;
+
+/**
+  * @brief This class compiles and links a GLSL program from vertex and fragment source.
+  * Compile and link errors are thrown as a runtime_error holding the driver's log.
+  */
+class ShaderProgram
+{
+	public:
+		typedef vector<pair<GLuint, string> > AttributeList;
+
+	private:
+		GLuint program;
+
+		ShaderProgram(const ShaderProgram&);
+		ShaderProgram& operator = (const ShaderProgram&);
+
+	public:
+		/**
+		  * This must be called on the thread which owns the GL context.
+		  * @param attributes the location each named vertex attribute is bound to before linking
+		  */
+		ShaderProgram(const string& vertexSource, const string& fragmentSource, const AttributeList& attributes = AttributeList()) : program(0)
+		{
+			GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexSource);
+			GLuint fragmentShader;
+
+			try
+			{
+				fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentSource);
+			}
+			catch(...)
+			{
+				glDeleteShader(vertexShader);
+				throw;
+			}
+
+			program = glCreateProgram();
+			glAttachShader(program, vertexShader);
+			glAttachShader(program, fragmentShader);
+
+			for(AttributeList::const_iterator i = attributes.begin(); i != attributes.end(); i++)
+				glBindAttribLocation(program, i -> first, i -> second.c_str());
+
+			glLinkProgram(program);
+
+			//The program keeps the shaders alive for as long as it needs them.
+			glDeleteShader(vertexShader);
+			glDeleteShader(fragmentShader);
+
+			GLint linked;
+
+			glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+			if(!linked)
+			{
+				string log = getLog(program, false);
+
+				glDeleteProgram(program);
+				throw runtime_error("The shader program could not be linked:\n" + log);
+			}
+		}
+
+		~ShaderProgram() { glDeleteProgram(program); }
+
+		void use() const { glUseProgram(program); }
+
+		GLint getUniformLocation(const char* name) const { return glGetUniformLocation(program, name); }
+
+		GLuint getName() const { return program; }
+
+	private:
+		static GLuint compile(GLenum type, const string& source)
+		{
+			GLuint shader = glCreateShader(type);
+			const GLchar* text = source.c_str();
+			GLint compiled;
+
+			glShaderSource(shader, 1, &text, NULL);
+			glCompileShader(shader);
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+
+			if(!compiled)
+			{
+				string log = getLog(shader, true);
+
+				glDeleteShader(shader);
+				throw runtime_error(string("The ") + (type == GL_VERTEX_SHADER ? "vertex" : "fragment") + " shader could not be compiled:\n" + log);
+			}
+
+			return shader;
+		}
+
+		static string getLog(GLuint object, bool isShader)
+		{
+			GLint length = 0;
+
+			if(isShader)
+				glGetShaderiv(object, GL_INFO_LOG_LENGTH, &length);
+			else
+				glGetProgramiv(object, GL_INFO_LOG_LENGTH, &length);
+
+			if(length <= 1)
+				return string();
+
+			vector<GLchar> log(length);
+
+			if(isShader)
+				glGetShaderInfoLog(object, length, NULL, log.data());
+			else
+				glGetProgramInfoLog(object, length, NULL, log.data());
+
+			return string(log.data());
+		}
+};
+
+#endif /*SHADERPROGRAM_H_*/
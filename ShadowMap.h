@@ -0,0 +1,347 @@
+#ifndef SHADOWMAP_H_
+#define SHADOWMAP_H_
+
+#include <cmath>		//sqrt, fabs, asin and tan
+#include <memory>		//unique_ptr
+#include <stdexcept>	//runtime_error
+#include <iostream>		//cerr
+
+#include "Vector4.h"
+#include "ShaderProgram.h"
+
+using namespace std;
+
+/**
+  * @brief This class renders the depth of the shadow casters as seen from a point light and tests other geometry against it.
+  * The light's frustum is fitted to a bounding sphere around the casters, so the whole map covers the structure.
+  * The test pass draws through a shader which discards every fragment the light can see, so the fragments that remain
+  * are the shadowed ones and can be marked in the stencil buffer just like the fragments inside a shadow volume.
+  */
+class ShadowMap
+{
+	private:
+		enum { x, y, z, w };
+
+		GLsizei size;
+
+		//Column-major, taking world coordinates to shadow map texture coordinates and depth
+		GLfloat lightMatrix[16];
+		Vector4 lightPosition;
+
+		//State replaced by the depth pass and the test pass, restored when they end
+		GLint previousFramebuffer;
+		mutable GLint previousProgram, previousTexture;
+
+		GLuint texture, framebuffer;
+		unique_ptr<ShaderProgram> program;
+		bool failed;
+
+		ShadowMap(const ShadowMap&);
+		ShadowMap& operator = (const ShadowMap&);
+
+	public:
+		/**
+		  * @param size the width and height of the depth texture
+		  */
+		ShadowMap(GLsizei size = 1024) : size(size), previousFramebuffer(0), previousProgram(0), previousTexture(0), texture(0), framebuffer(0), failed(false)
+		{
+			for(unsigned i = 0; i < 16; i++)
+				lightMatrix[i] = i % 5 == 0 ? 1.0f : 0.0f;
+		}
+
+		~ShadowMap() { release(); }
+
+		/**
+		  * Binds the depth texture as the render target and loads the light's projection and view.  Draw the shadow casters, then call endDepthPass.
+		  * This must be called on the thread which owns the GL context.
+		  * @param center the center of a sphere holding every shadow caster
+		  * @param radius the radius of that sphere
+		  * @return false if shadow maps are not available, in which case nothing was changed
+		  */
+		bool beginDepthPass(const Vector4& lightPosition, const Vector4& center, GLfloat radius)
+		{
+			if(failed || (framebuffer == 0 && !create()))
+				return false;
+
+			GLfloat projection[16], view[16], bias[16], biasedProjection[16];
+
+			this -> lightPosition = lightPosition;
+			computeLightMatrices(lightPosition, center, radius, projection, view);
+
+			//Move clip coordinates from [-1, 1] to texture coordinates in [0, 1]
+			for(unsigned i = 0; i < 16; i++)
+				bias[i] = i % 5 == 0 ? 0.5f : 0.0f;
+
+			bias[12] = bias[13] = bias[14] = 0.5f;
+			bias[15] = 1.0f;
+
+			multiply(bias, projection, biasedProjection);
+			multiply(biasedProjection, view, lightMatrix);
+
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glViewport(0, 0, size, size);
+			glColorMask(0, 0, 0, 0);
+			glDepthMask(1);
+			glDepthFunc(GL_LEQUAL);
+			glEnable(GL_DEPTH_TEST);
+			glDisable(GL_BLEND);
+			glDisable(GL_STENCIL_TEST);
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+			//Storing the faces turned away from the light, pushed slightly further, keeps lit faces from shadowing themselves.
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_FRONT);
+			glEnable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(2.0f, 4.0f);
+
+			glMatrixMode(GL_PROJECTION);
+			glPushMatrix();
+			glLoadMatrixf(projection);
+			glMatrixMode(GL_MODELVIEW);
+			glPushMatrix();
+			glLoadMatrixf(view);
+
+			return true;
+		}
+
+		/**
+		  * Restores the render target, matrices and state which were current before beginDepthPass.
+		  */
+		void endDepthPass()
+		{
+			glMatrixMode(GL_PROJECTION);
+			glPopMatrix();
+			glMatrixMode(GL_MODELVIEW);
+			glPopMatrix();
+
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+			glPopAttrib();
+		}
+
+		/**
+		  * Binds the shader which discards every fragment lit by the light.  Geometry must be given in world coordinates with normals.
+		  * Call this after endDepthPass, draw the receivers and then call endShadowTest.
+		  */
+		void beginShadowTest() const
+		{
+			glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+			glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+
+			glBindTexture(GL_TEXTURE_2D, texture);
+
+			program -> use();
+			glUniformMatrix4fv(program -> getUniformLocation("lightMatrix"), 1, GL_FALSE, lightMatrix);
+			glUniform3f(program -> getUniformLocation("lightPosition"), lightPosition[x], lightPosition[y], lightPosition[z]);
+			glUniform1i(program -> getUniformLocation("shadowMap"), 0);
+		}
+
+		void endShadowTest() const
+		{
+			glUseProgram(previousProgram);
+			glBindTexture(GL_TEXTURE_2D, previousTexture);
+		}
+
+		/**
+		  * Frees the depth texture, its framebuffer and the shader.  This must be called on the thread which owns the GL context.
+		  */
+		void release()
+		{
+			if(framebuffer != 0)
+				glDeleteFramebuffers(1, &framebuffer);
+
+			if(texture != 0)
+				glDeleteTextures(1, &texture);
+
+			framebuffer = texture = 0;
+			program.reset();
+		}
+
+		GLsizei getSize() const { return size; }
+
+	private:
+		bool create()
+		{
+			try
+			{
+				program.reset(new ShaderProgram(vertexSource, fragmentSource));
+			}
+			catch(const runtime_error& e)
+			{
+				cerr << e.what() << endl;
+				failed = true;
+
+				return false;
+			}
+
+			const GLfloat border[4] = { 1.0, 1.0, 1.0, 1.0 };
+			GLint previousTexture;
+
+			glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+			//Anything outside the map is as far away as possible, and so is lit
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+			glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+			glBindTexture(GL_TEXTURE_2D, previousTexture);
+
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+
+			const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+			if(!complete)
+			{
+				cerr << "The shadow map framebuffer is not supported." << endl;
+				release();
+				failed = true;
+			}
+
+			return complete;
+		}
+
+		/**
+		  * Fits a perspective frustum from lightPosition around the sphere at center.
+		  */
+		static void computeLightMatrices(const Vector4& lightPosition, const Vector4& center, GLfloat radius, GLfloat (&projection)[16], GLfloat (&view)[16])
+		{
+			GLfloat forward[3] = { center[x] - lightPosition[x], center[y] - lightPosition[y], center[z] - lightPosition[z] };
+			GLfloat distance = sqrt(forward[x] * forward[x] + forward[y] * forward[y] + forward[z] * forward[z]);
+
+			for(unsigned i = 0; i < 3; i++)
+				forward[i] /= distance;
+
+			//Any up vector works as long as it is not parallel to the direction of the light
+			GLfloat up[3] = { 0.0, 1.0, 0.0 };
+
+			if(fabs(forward[y]) > 0.99f)
+			{
+				up[y] = 0.0;
+				up[z] = 1.0;
+			}
+
+			GLfloat side[3], trueUp[3];
+
+			cross(forward, up, side);
+
+			GLfloat sideLength = sqrt(side[x] * side[x] + side[y] * side[y] + side[z] * side[z]);
+
+			for(unsigned i = 0; i < 3; i++)
+				side[i] /= sideLength;
+
+			cross(side, forward, trueUp);
+
+			const GLfloat* axes[3] = { side, trueUp, forward };
+
+			for(unsigned row = 0; row < 3; row++)
+			{
+				GLfloat sign = row == 2 ? -1.0f : 1.0f;
+				GLfloat translation = 0.0;
+
+				for(unsigned column = 0; column < 3; column++)
+				{
+					view[column * 4 + row] = sign * axes[row][column];
+					translation -= view[column * 4 + row] * lightPosition[column];
+				}
+
+				view[12 + row] = translation;
+			}
+
+			view[3] = view[7] = view[11] = 0.0;
+			view[15] = 1.0;
+
+			//The light may sit inside the sphere, in which case the frustum is as wide as it can usefully be.
+			GLfloat sine = distance > radius ? radius / distance : 0.99f;
+			GLfloat halfWidth = tan(asin(sine));
+			GLfloat zNear = distance > radius ? distance - radius : distance * 0.01f;
+			GLfloat zFar = distance + radius;
+
+			for(unsigned i = 0; i < 16; i++)
+				projection[i] = 0.0;
+
+			projection[0] = projection[5] = 1.0f / halfWidth;
+			projection[10] = -(zFar + zNear) / (zFar - zNear);
+			projection[11] = -1.0;
+			projection[14] = -2.0f * zFar * zNear / (zFar - zNear);
+		}
+
+		static void cross(const GLfloat (&lhs)[3], const GLfloat (&rhs)[3], GLfloat (&result)[3])
+		{
+			result[x] = lhs[y] * rhs[z] - lhs[z] * rhs[y];
+			result[y] = lhs[z] * rhs[x] - lhs[x] * rhs[z];
+			result[z] = lhs[x] * rhs[y] - lhs[y] * rhs[x];
+		}
+
+		/**
+		  * result = lhs * rhs, all column-major
+		  */
+		static void multiply(const GLfloat (&lhs)[16], const GLfloat (&rhs)[16], GLfloat (&result)[16])
+		{
+			for(unsigned column = 0; column < 4; column++)
+				for(unsigned row = 0; row < 4; row++)
+				{
+					result[column * 4 + row] = 0.0;
+
+					for(unsigned k = 0; k < 4; k++)
+						result[column * 4 + row] += lhs[k * 4 + row] * rhs[column * 4 + k];
+				}
+		}
+
+		static const char* const vertexSource;
+		static const char* const fragmentSource;
+};
+
+//ftransform gives the same depth as the fixed-function pipeline, so the test pass lines up with what was drawn before it.
+//Surfaces turned away from the light are in their own shadow; the map only stores such surfaces, so they are not tested against it.
+const char* const ShadowMap::vertexSource = R"(
+#version 130
+
+uniform mat4 lightMatrix;
+uniform vec3 lightPosition;
+
+out vec4 shadowCoordinate;
+out float facing;
+
+void main()
+{
+	shadowCoordinate = lightMatrix * gl_Vertex;
+	facing = dot(gl_Normal, lightPosition - gl_Vertex.xyz);
+	gl_Position = ftransform();
+}
+)";
+
+const char* const ShadowMap::fragmentSource = R"(
+#version 130
+
+uniform sampler2DShadow shadowMap;
+
+in vec4 shadowCoordinate;
+in float facing;
+
+void main()
+{
+	//Fragments behind the light, or which the light can see, are not in shadow
+	if(facing > 0.0 && (shadowCoordinate.w <= 0.0 || textureProj(shadowMap, shadowCoordinate) > 0.5))
+		discard;
+
+	gl_FragColor = vec4(0.0);
+}
+)";
+
+#endif /*SHADOWMAP_H_*/
@@ -0,0 +1,120 @@
+#ifndef SILHOUETTE_H_
+#define SILHOUETTE_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//int32_t
+#include <cassert>		//assert
+#include <vector>		//vector
+#include <utility>		//pair
+
+#include "MeshCache.h"
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class finds the silhouette of a triangle mesh as seen from a light, for extruding into a shadow volume.
+  * It uses the triangle adjacency from MeshCache::computeNeighbours, so finding the silhouette and chaining it into loops
+  * is linear in the number of triangles.  The caller owns every buffer, which are reused from call to call.
+  * @see Model
+  * @see SimulatedModel
+  */
+class Silhouette
+{
+	public:
+		typedef vector<Vector4>::size_type size_type;
+		typedef pair<Vector4, Vector4> Edge;
+
+	private:
+		enum { x, y, z, w };
+
+	public:
+		/**
+		  * Replaces edges with the silhouette edges of vertices, chained head to tail into loops where the mesh allows.
+		  * An edge is on the silhouette if its triangle faces the light and the triangle across it does not, or there is none.
+		  * @param neighbours for each edge of each triangle, the triangle across that edge
+		  * @param facing working space holding whether each triangle faces the light
+		  * @param used working space marking edges already added to a loop
+		  */
+		static void find(const vector<Vector4>& vertices, const vector<int32_t>& neighbours, const Vector4& lightPosition, vector<char>& facing, vector<char>& used, vector<Edge>& edges)
+		{
+			assert(vertices.size() % 3 == 0 && neighbours.size() == vertices.size());
+
+			const size_type triangleCount = vertices.size() / 3;
+
+			facing.resize(triangleCount);
+			used.assign(vertices.size(), 0);
+			edges.clear();
+
+			for(size_type i = 0; i < triangleCount; i++)
+			{
+				const Vector4& a = vertices[3 * i];
+				const Vector4& b = vertices[3 * i + 1];
+				const Vector4& c = vertices[3 * i + 2];
+				Vector4 normal = Vector4::crossProduct(Vector4(b[x] - a[x], b[y] - a[y], b[z] - a[z], 0.0), Vector4(c[x] - a[x], c[y] - a[y], c[z] - a[z], 0.0));
+
+				facing[i] = Vector4::dotProduct(normal, lightPosition) > 0.0;
+			}
+
+			for(size_type i = 0; i < vertices.size(); i++)
+			{
+				if(used[i] || !isSilhouette(i, neighbours, facing))
+					continue;
+
+				//Follow the loop from this edge until it closes or the mesh is not closed enough to continue
+				for(size_type edge = i; edge != none && !used[edge]; edge = findNext(edge, vertices, neighbours, facing))
+				{
+					used[edge] = 1;
+					edges.push_back(Edge(vertices[edge], vertices[nextInTriangle(edge)]));
+				}
+			}
+		}
+
+	private:
+		static const size_type none = (size_type)-1;
+
+		/**
+		  * Edge e of triangle t is numbered 3t + e and runs from vertex 3t + e to vertex 3t + (e + 1) % 3.
+		  */
+		static size_type nextInTriangle(size_type edge) { return edge - edge % 3 + (edge + 1) % 3; }
+
+		static bool isSilhouette(size_type edge, const vector<int32_t>& neighbours, const vector<char>& facing)
+		{
+			return facing[edge / 3] && (neighbours[edge] == MeshCache::noNeighbour || !facing[neighbours[edge]]);
+		}
+
+		/**
+		  * Turns about the end of edge through the triangles facing the light until it reaches the silhouette edge leaving that vertex.
+		  * @return the next silhouette edge, or none if the mesh is open or not manifold there
+		  */
+		static size_type findNext(size_type edge, const vector<Vector4>& vertices, const vector<int32_t>& neighbours, const vector<char>& facing)
+		{
+			size_type candidate = nextInTriangle(edge);
+
+			//A vertex cannot be shared by more triangles than the mesh has
+			for(size_type i = 0; i < neighbours.size() / 3; i++)
+			{
+				if(isSilhouette(candidate, neighbours, facing))
+					return candidate;
+
+				//The candidate is shared with a triangle facing the light; continue from the matching edge of that triangle
+				const size_type triangle = (size_type)neighbours[candidate];
+				const Vector4& start = vertices[candidate];
+				const Vector4& end = vertices[nextInTriangle(candidate)];
+				size_type opposite = none;
+
+				for(size_type j = 3 * triangle; j < 3 * triangle + 3 && opposite == none; j++)
+					if(vertices[j] == end && vertices[nextInTriangle(j)] == start)
+						opposite = j;
+
+				if(opposite == none)
+					return none;
+
+				candidate = nextInTriangle(opposite);
+			}
+
+			return none;
+		}
+};
+
+#endif /*SILHOUETTE_H_*/
@@ -3,14 +3,16 @@
 
 #include <vector>		//vector
 #include <utility>		//pair
-#include <algorithm>	//remove and swap
 #include <fstream>		//ifstream
 #include <cassert>		//assert
 #include <iostream>		//istream and ostream
 #include <stdexcept>	//runtime_error
 #include <string>		//string
+#include <cstdint>		//int32_t
 #include <cmath>		//abs
 
+#include "MeshCache.h"
+#include "Silhouette.h"
 #include "Vector4.h"
 #include "Matrix44.h"
 
@@ -44,6 +46,10 @@ class SimulatedModel
 		mutable vector<Vector4> shadowVolumeVertices;
 		mutable vector<Vector4> transformedVertices;
 		mutable vector<Edge> edges;
+		mutable vector<char> facingLight, usedEdges;
+
+		//For each edge of each triangle, the triangle across that edge.  Models built from a vector compute this on first use.
+		mutable vector<int32_t> neighbours;
 
 	public:
 		SimulatedModel(bool dummy, const vector<Vector4>& vertices = vector<Vector4>(), const Matrix44& globalOrientation = Matrix44(), Vector4 color = Vector4(1.0, 1.0, 1.0, 1.0)) : vertices(vertices), globalOrientation(globalOrientation), color(color), hasMoved(true), previousLightPosition() { vertices >> *this; }
@@ -93,6 +99,9 @@ class SimulatedModel
 			else
 				glColor4f(1.0, 0.0, 0.0, 0.5);
 
+			if(edges.empty())
+				return;
+
 			//Draw the cached shadow volume
 
 			vector<Edge>::iterator startVertexPosition = edges.begin();
@@ -130,6 +139,13 @@ class SimulatedModel
 
 		vector<GLfloat>::size_type getVertexCount() const { return vertices.size(); }
 
+		const vector<Vector4>& getVertices() const { return vertices; }
+
+		/**
+		  * @return one normal for each triangle of the model
+		  */
+		const vector<Vector4>& getNormals() const { return normals; }
+
 		const Vector4& getColor() const { return color; }
 		
 		const Matrix44& getOrientation() const { return globalOrientation; }
@@ -143,6 +159,15 @@ class SimulatedModel
 
 		friend void operator >> (const char* filePath, SimulatedModel& model)
 		{
+			//Use the binary cache beside the model when it is still valid
+			if(MeshCache::read(filePath, model.vertices, model.normals, model.neighbours))
+			{
+				model.shadowVolumeVertices.clear();
+				model.shadowVolumeVertices.reserve(model.vertices.size());
+
+				return;
+			}
+
 			vector<GLfloat>::size_type vertexCount;
 			ifstream in(filePath);
 			
@@ -174,6 +199,9 @@ class SimulatedModel
  			}
 
 			model.computeNormals();
+			model.neighbours = MeshCache::computeNeighbours(model.vertices);
+
+			MeshCache::write(filePath, model.vertices, model.normals, model.neighbours);
 		}
 		
 		friend void operator >> (const vector<Vector4>& vertices, SimulatedModel& model)
@@ -255,42 +283,11 @@ class SimulatedModel
 			edges.clear();
 			edges.reserve(vertices.size());
 
-			//For all triangles...
-			for(vector<Vector4>::iterator i = transformedVertices.begin(); i != transformedVertices.end(); i += 3)
-			{
-				//If the triangle is facing the light...
-				if(Vector4::dotProduct(computeNormal(*i, *(i + 1), *(i + 2)), lightPosition) > 0.0)
-				{
-					vector<Edge> triangle;
-					
-					triangle.push_back(Edge(*i      , *(i + 1)));
-					triangle.push_back(Edge(*(i + 1), *(i + 2)));
-					triangle.push_back(Edge(*(i + 2), *i));
-
-					for(vector<Edge>::iterator i = triangle.begin(); i != triangle.end(); i++)
-					{	
-						bool found = false;
-						vector<Edge>::iterator removeLocation;
-						
-						for(vector<Edge>::iterator j = edges.begin(); j != edges.end() && !found; j++)
-							if(*i == *j || *i == Edge(j -> second, j -> first))
-							{
-								found = true;
-								removeLocation = remove(edges.begin(), edges.end(), *j);
-							}
-						
-						//If a duplicate edge exists, we remove all instances of the edge from our container.
-						if(found)
-							edges.erase(removeLocation, edges.end());
-						//Otherwise, it is a candidate for a silhouette edge.
-						else
-							edges.push_back(*i);
-					}
-				}
-			}
-			
-			//We must sort the edges to use a quad strip.
-			sortEdges(edges);
+			if(neighbours.size() != vertices.size())
+				neighbours = MeshCache::computeNeighbours(vertices);
+
+			//The silhouette comes back already chained into loops for the quad strips.
+			Silhouette::find(transformedVertices, neighbours, lightPosition, facingLight, usedEdges, edges);
 
 			for(vector<Edge>::iterator i = edges.begin(); i != edges.end(); i++)
 			{
@@ -320,27 +317,6 @@ class SimulatedModel
 			
 			return normal;
 		}
-		
-		static void sortEdges(vector<Edge>& edges)
-		{
-			bool swapped;
-			
-			for(vector<Edge>::iterator i = edges.begin(); i != edges.end() - 1; i++)
-			{
-				swapped = false;
-				
-				for(vector<Edge>::iterator j = i + 1; j != edges.end() && !swapped; j++)
-					if(i -> second == j -> first || i -> second == j -> second)
-					{
-						if(i -> second == j -> second)
-							swap(j -> first, j -> second);
-							
-						swap(*(i + 1), *j);
-						
-						swapped = true;
-					}
-			}
-		}
 };
 
 const GLfloat SimulatedModel::moveThreshold = 0.08;
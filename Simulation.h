@@ -0,0 +1,285 @@
+#ifndef SIMULATION_H_
+#define SIMULATION_H_
+
+#include <vector>		//vector
+#include <algorithm>	//min
+#include <memory>		//unique_ptr
+#include <thread>		//thread and this_thread
+#include <atomic>		//atomic
+#include <mutex>		//mutex and lock_guard
+#include <chrono>		//steady_clock
+#include <cassert>		//assert
+#include <functional>	//function
+
+#include "BlockDriver.h"
+#include "TripleBuffer.h"
+
+using namespace std;
+
+/**
+  * @brief This class runs a game's laser on its own thread at a fixed tick rate, apart from the thread which draws.
+  * After every tick the state the render thread needs is copied into a Snapshot and published through a TripleBuffer, so neither thread
+  * ever waits on the other.  A snapshot carries only the part of the path and the touched cells which changed since the last snapshot the
+  * render thread took, so a tick costs the same however long the path is.  Input is queued with send() and applied at the start of the next tick.
+  * The structure attached to the BlockDriver must not be exchanged while the simulation is started.
+  * @see BlockDriver::Laser
+  */
+class Simulation
+{
+	public:
+		typedef BlockDriver::size_type size_type;
+
+		/**
+		  * @brief The state of a game after a tick, as published to the render thread.
+		  * The path and touched cells continue those of a snapshot the render thread took earlier in the same game: the vertices before
+		  * pathStart and the cells before touchedStart are as it had them.
+		  */
+		struct Snapshot
+		{
+			size_type pathStart, touchedStart;
+			vector<GLfloat> path;				//The laser's line strip from vertex pathStart on, three coordinates per vertex
+			vector<size_type> touchedCells;		//The cells the laser entered from the touchedStart'th on, as (height * rows + row) * columns + column
+			vector<Vector4> visitedCorners;		//For the debug view, empty while it is hidden: the ends of each straight run of the path
+			vector<Vector4> frontier;			//For the debug view, empty while it is hidden: the voxels the laser can enter next without losing
+			bool mobile, won, idle;
+
+			Snapshot() : pathStart(0), touchedStart(0), mobile(false), won(false), idle(false) {}
+		};
+
+		enum Command { TURN_UP, TURN_DOWN, TURN_LEFT, TURN_RIGHT, TOGGLE_MOBILE };
+
+		/**
+		  * The seconds between ticks.  The laser moves once per tick.
+		  */
+		static const GLfloat tickInterval;
+
+	private:
+		BlockDriver& blockDriver;
+		unique_ptr<BlockDriver::Laser> laser;
+		TripleBuffer<Snapshot> snapshots;
+		thread worker;
+		atomic<bool> running;
+
+		//Set by the render thread while the debug view is shown, as finding the frontier costs more than the rest of a tick
+		atomic<bool> debugView;
+
+		//Called when the game state the render thread shows changes, so a render loop which waits for events can wake
+		function<void ()> wake;
+		bool shownMobile, shownWon, shownIdle, shownDebugView;
+
+		//What changed since the last snapshot the render thread took: the path from vertex pathFrom on and the touched cells from touchedFrom on
+		size_type pathFrom, touchedFrom;
+
+		//The number of touched cells in the last snapshot published
+		size_type publishedTouches;
+
+		mutex commandMutex;
+		vector<Command> commands;
+
+		//The commands taken for the current tick, kept to reuse its storage
+		vector<Command> received;
+
+		Simulation(const Simulation&);
+		Simulation& operator = (const Simulation&);
+
+	public:
+		Simulation(BlockDriver& blockDriver) : blockDriver(blockDriver), running(false), debugView(false), shownMobile(false), shownWon(false), shownIdle(false), shownDebugView(false), pathFrom(0), touchedFrom(0), publishedTouches(0) {}
+
+		~Simulation() { stop(); }
+
+		/**
+		  * Starts a game with a new laser in the BlockDriver's structure and publishes its first snapshot.
+		  * @param threaded false to move the laser only when step() is called, for replays which must not depend on the clock
+		  */
+		void start(bool threaded)
+		{
+			assert(blockDriver.isLoaded());
+
+			stop();
+
+			//BlockDriver hands out an auto_ptr, which is deprecated, so ownership is taken from it at once
+			laser.reset(blockDriver.getLaser().release());
+			commands.clear();
+			pathFrom = touchedFrom = publishedTouches = 0;
+			publish();
+
+			if(threaded)
+			{
+				running = true;
+				worker = thread(&Simulation::run, this);
+			}
+		}
+
+		/**
+		  * Ends the game, waiting for the current tick to finish.  Snapshots already published remain readable.
+		  */
+		void stop()
+		{
+			running = false;
+
+			if(worker.joinable())
+				worker.join();
+
+			laser.reset();
+		}
+
+		bool isStarted() const { return laser.get() != 0; }
+
+		/**
+		  * Sets a function the simulation's thread calls whenever the laser starts or stops moving, the game is won, the laser becomes idle
+		  * or the debug view's overlays start or stop being filled in.
+		  * It is not called for ordinary moves.  Set this only while the simulation is stopped.
+		  */
+		void setWakeCallback(const function<void ()>& wake) { this -> wake = wake; }
+
+		/**
+		  * Queues input for the next tick.  This may be called on any thread.
+		  */
+		void send(Command command)
+		{
+			lock_guard<mutex> lock(commandMutex);
+
+			commands.push_back(command);
+		}
+
+		/**
+		  * Sets whether snapshots carry the visited corners and frontier for the debug view.  This may be called on any thread
+		  * and lasts across games.  Without a simulation thread, a snapshot with the new setting is published at once, so call it
+		  * on the thread which calls step().
+		  */
+		void setDebugView(bool enabled)
+		{
+			debugView = enabled;
+
+			if(isStarted() && !worker.joinable())
+				publish();
+		}
+
+		/**
+		  * Runs a single tick.  Call this only for a simulation started without its own thread.
+		  */
+		void step()
+		{
+			assert(isStarted() && !worker.joinable());
+
+			tick();
+		}
+
+		/**
+		  * Takes the latest snapshot published.  Only one thread, the render thread, may call this and getSnapshot().
+		  * @return true if getSnapshot() now returns a newer snapshot
+		  */
+		bool acquire() { return snapshots.acquire(); }
+
+		const Snapshot& getSnapshot() const { return snapshots.getFront(); }
+
+	private:
+		void run()
+		{
+			const chrono::steady_clock::duration interval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<GLfloat>(tickInterval));
+			chrono::steady_clock::time_point nextTick = chrono::steady_clock::now();
+
+			while(running)
+			{
+				tick();
+
+				nextTick += interval;
+
+				//After a stall, carry on from now rather than running the missed ticks all at once
+				if(nextTick < chrono::steady_clock::now())
+					nextTick = chrono::steady_clock::now();
+
+				this_thread::sleep_until(nextTick);
+			}
+		}
+
+		void tick()
+		{
+			{
+				lock_guard<mutex> lock(commandMutex);
+
+				received.swap(commands);
+			}
+
+			for(vector<Command>::const_iterator i = received.begin(); i != received.end(); i++)
+				switch(*i)
+				{
+					case TURN_UP:		laser -> turn(BlockDriver::Laser::UP);
+										break;
+
+					case TURN_DOWN:		laser -> turn(BlockDriver::Laser::DOWN);
+										break;
+
+					case TURN_LEFT:		laser -> turn(BlockDriver::Laser::LEFT);
+										break;
+
+					case TURN_RIGHT:	laser -> turn(BlockDriver::Laser::RIGHT);
+										break;
+
+					case TOGGLE_MOBILE:	laser -> setMobile(!laser -> isMobile());
+										break;
+				}
+
+			received.clear();
+
+			if(laser -> isMobile())
+				laser -> step();
+
+			publish();
+		}
+
+		void publish()
+		{
+			Snapshot& snapshot = snapshots.getBack();
+			const vector<GLfloat>& path = laser -> getPath();
+			const vector<size_type>& touchedCells = laser -> getTouchedCells();
+			const size_type unchanged = laser -> takeUnchangedPath();
+
+			pathFrom = min(pathFrom, unchanged);
+
+			//Assignment reuses the storage the slot had the last time it was filled
+			snapshot.pathStart = pathFrom;
+			snapshot.path.assign(path.begin() + pathFrom * 3, path.end());
+			snapshot.touchedStart = touchedFrom;
+			snapshot.touchedCells.assign(touchedCells.begin() + touchedFrom, touchedCells.end());
+			const bool showDebugView = debugView;
+
+			if(showDebugView)
+			{
+				laser -> getVisitedCorners(snapshot.visitedCorners);
+				laser -> getFrontier(snapshot.frontier);
+			}
+			else
+			{
+				snapshot.visitedCorners.clear();
+				snapshot.frontier.clear();
+			}
+
+			snapshot.mobile = laser -> isMobile();
+			snapshot.won = laser -> hasTouchedAllPenetrable();
+			snapshot.idle = laser -> isIdle();
+
+			const bool changed = snapshot.mobile != shownMobile || snapshot.won != shownWon || snapshot.idle != shownIdle || showDebugView != shownDebugView;
+
+			shownMobile = snapshot.mobile;
+			shownWon = snapshot.won;
+			shownIdle = snapshot.idle;
+			shownDebugView = showDebugView;
+
+			//Once the render thread has taken the previous snapshot, later ones need only carry what changed since it
+			if(snapshots.publish())
+			{
+				pathFrom = unchanged;
+				touchedFrom = publishedTouches;
+			}
+
+			publishedTouches = touchedCells.size();
+
+			if(changed && wake)
+				wake();
+		}
+};
+
+const GLfloat Simulation::tickInterval = 0.01;
+
+#endif /*SIMULATION_H_*/
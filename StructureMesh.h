@@ -0,0 +1,651 @@
+#ifndef STRUCTUREMESH_H_
+#define STRUCTUREMESH_H_
+
+#include <cstddef>		//size_t and offsetof
+#include <cstdint>		//uint8_t
+#include <algorithm>	//min, max and sort
+#include <vector>		//vector
+#include <utility>		//pair
+
+#include "BrickCuller.h"
+#include "WorkerPool.h"
+#include "Vector4.h"
+
+using namespace std;
+
+/**
+  * @brief This class keeps the visible faces of a structure in vertex buffers, one for each brick of up to BrickCuller::brickSize cells along each side.
+  * Only faces between a block and empty space or a block of the other type (penetrable or impenetrable) are kept, and coplanar
+  * neighbouring faces of the same colour within a brick are merged into larger quads.  The mesh is built on the CPU without any GL calls,
+  * which lets a structure be built on a background thread; each brick's buffer is created the first time it is drawn.
+  * Bricks only read the cells around them while they are meshed, so they are meshed in parallel on the shared WorkerPool.
+  * Vertices are stored in world coordinates and drawn through the fixed-function arrays.
+  *
+  * Bricks outside the view are not drawn, and neither are bricks hidden behind the faces of nearer bricks.  Which bricks can be seen
+  * is only worked out again when the view or the mesh changes.  Changing the colour of a block rebuilds only its brick.
+  *
+  * Each brick also has two coarser meshes, in which every 2x2x2 or 4x4x4 group of cells becomes one box with the colour of most of
+  * its blocks, or nothing if most of it is empty.  A brick is drawn with the coarsest mesh whose error, projected onto the screen,
+  * stays under maximumError pixels.  It only returns to a coarser mesh once that error falls well below the limit, so bricks near
+  * the limit do not flicker between meshes as the camera moves.
+  * @see BlockStructure
+  * @see BrickCuller
+  */
+class StructureMesh
+{
+	public:
+		typedef size_t size_type;
+
+		static const unsigned paletteSize = 3;
+
+	private:
+		enum { x, y, z, w };
+		enum { brickSize = BrickCuller::brickSize };
+
+		//Faces drawn into the coarse depth buffer each time the visible bricks are worked out, nearest bricks first
+		enum { occluderBudget = 8192 };
+
+		//Level l merges cells in groups of 2^l along each side
+		enum { levelCount = 3 };
+
+		//The most a level may be off, projected onto the screen, and the fraction of that under which a coarser level is taken
+		static const GLfloat maximumError;
+		static const GLfloat hysteresis;
+
+		struct Vertex
+		{
+			GLfloat position[3];
+			GLfloat normal[3];
+			GLfloat color[4];
+		};
+
+		struct Brick
+		{
+			size_type first[3], last[3];	//The cells of the brick along each axis, last excluded
+
+			//The meshes of every level, one after the other
+			vector<Vertex> vertices;
+			GLint levelFirst[levelCount];
+			GLsizei levelVertexCount[levelCount];
+
+			BrickCuller::Box bounds;		//Holds every level
+
+			//Set when a block in the brick changed colour since the brick was last built
+			bool changed;
+
+			mutable GLuint vertexArray, vertexBuffer;
+		};
+
+		/**
+		  * The bricks found to be visible from one view.  Views with and without occlusion culling are kept apart,
+		  * since a shadow map pass and the passes from the camera alternate every frame.
+		  */
+		struct View
+		{
+			BrickCuller culler;
+			vector<size_type> visible;
+			vector<uint8_t> levels;			//The level each brick was last drawn at
+			bool current;
+
+			View() : current(false) {}
+		};
+
+		//Cell codes: 0 is empty, otherwise one more than the block's palette index
+		enum { empty = 0 };
+
+		size_type dimensions[levelCount][3];	//Columns, height and rows of each level, so that dimension i runs along world axis i
+		size_type brickCounts[3];
+		vector<uint8_t> cells[levelCount];
+		Vector4 corner;					//The lowest corner of the cell at height, row and column 0
+		GLfloat blockSize;
+		Vector4 palette[paletteSize];
+		unsigned impenetrableIndex;
+
+		vector<Brick> bricks;
+
+		//Set when a brick changed since the mesh was last drawn
+		mutable bool changed;
+
+		mutable View views[2];
+
+		StructureMesh(const StructureMesh&);
+		StructureMesh& operator = (const StructureMesh&);
+
+	public:
+		StructureMesh() : blockSize(1.0), impenetrableIndex(paletteSize - 1), changed(false)
+		{
+			for(unsigned level = 0; level < levelCount; level++)
+				dimensions[level][x] = dimensions[level][y] = dimensions[level][z] = 0;
+
+			brickCounts[x] = brickCounts[y] = brickCounts[z] = 0;
+		}
+
+		~StructureMesh() { release(); }
+
+		/**
+		  * Replaces the mesh with the blocks of structure.  This makes no GL calls.
+		  * @param structure any type providing getHeight(), getRows(), getColumns(), hasBlock(height, row, column) and getBlock(height, row, column).getPaletteIndex(),
+		  * which may be called from several threads at once
+		  * @param origin the center of the cell at height, row and column 0
+		  * @param palette the colour of each palette index; the last entry is the colour of impenetrable blocks
+		  */
+		template<typename Structure>
+		void build(const Structure& structure, const Vector4& origin, GLfloat blockSize, const Vector4 (&palette)[paletteSize])
+		{
+			dimensions[0][x] = structure.getColumns();
+			dimensions[0][y] = structure.getHeight();
+			dimensions[0][z] = structure.getRows();
+
+			this -> blockSize = blockSize;
+			corner = Vector4(origin[x] - blockSize / 2.0f, origin[y] - blockSize / 2.0f, origin[z] - blockSize / 2.0f, 1.0);
+
+			for(unsigned i = 0; i < paletteSize; i++)
+				this -> palette[i] = palette[i];
+
+			WorkerPool& pool = WorkerPool::getShared();
+
+			cells[0].assign(dimensions[0][x] * dimensions[0][y] * dimensions[0][z], empty);
+
+			//Each layer of cells, and of every coarser level, is filled in by one thread
+			pool.parallelFor(dimensions[0][y], [&](size_t i)
+			{
+				for(size_type j = 0; j < dimensions[0][z]; j++)
+					for(size_type k = 0; k < dimensions[0][x]; k++)
+						if(structure.hasBlock(i, j, k))
+							cells[0][(i * dimensions[0][z] + j) * dimensions[0][x] + k] = (uint8_t)(structure.getBlock(i, j, k).getPaletteIndex() + 1);
+			});
+
+			for(unsigned level = 1; level < levelCount; level++)
+			{
+				for(unsigned d = 0; d < 3; d++)
+					dimensions[level][d] = (dimensions[0][d] + (1 << level) - 1) >> level;
+
+				cells[level].resize(dimensions[level][x] * dimensions[level][y] * dimensions[level][z]);
+
+				pool.parallelFor(dimensions[level][y], [&](size_t layer)
+				{
+					size_type position[3];
+
+					for(position[y] = layer, position[z] = 0; position[z] < dimensions[level][z]; position[z]++)
+						for(position[x] = 0; position[x] < dimensions[level][x]; position[x]++)
+							merge(level, position);
+				});
+			}
+
+			for(unsigned d = 0; d < 3; d++)
+				brickCounts[d] = (dimensions[0][d] + brickSize - 1) / brickSize;
+
+			bricks.assign(brickCounts[x] * brickCounts[y] * brickCounts[z], Brick());
+
+			for(size_type i = 0; i < bricks.size(); i++)
+			{
+				Brick& brick = bricks[i];
+				const size_type position[3] = { i % brickCounts[x], i / (brickCounts[x] * brickCounts[z]), i / brickCounts[x] % brickCounts[z] };
+
+				for(unsigned d = 0; d < 3; d++)
+				{
+					brick.first[d] = position[d] * brickSize;
+					brick.last[d] = min(brick.first[d] + brickSize, dimensions[0][d]);
+				}
+
+				brick.vertexArray = brick.vertexBuffer = 0;
+			}
+
+			pool.parallelFor(bricks.size(), [this](size_t i) { mesh(bricks[i]); });
+
+			for(unsigned i = 0; i < 2; i++)
+				views[i].levels.assign(bricks.size(), 0);
+
+			changed = true;
+		}
+
+		/**
+		  * Records that the colour of a block changed.  Its brick is rebuilt on the next draw.
+		  * @param cell the index of the block, (height * rows + row) * columns + column
+		  */
+		void setPaletteIndex(size_type cell, unsigned paletteIndex)
+		{
+			if(cell >= cells[0].size() || cells[0][cell] == empty || cells[0][cell] == paletteIndex + 1)
+				return;
+
+			cells[0][cell] = (uint8_t)(paletteIndex + 1);
+
+			const size_type position[3] = { cell % dimensions[0][x], cell / (dimensions[0][x] * dimensions[0][z]), cell / dimensions[0][x] % dimensions[0][z] };
+
+			markChanged(position);
+
+			//A coarser box may take another colour, which can also change which faces of its neighbours in other bricks are seen
+			for(unsigned level = 1; level < levelCount; level++)
+			{
+				const size_type merged[3] = { position[x] >> level, position[y] >> level, position[z] >> level };
+
+				if(!merge(level, merged))
+					continue;
+
+				for(unsigned d = 0; d < 3; d++)
+					for(int side = -1; side <= 1; side += 2)
+					{
+						size_type neighbour[3] = { merged[x] << level, merged[y] << level, merged[z] << level };
+
+						if(side < 0 ? merged[d] == 0 : merged[d] + 1 >= dimensions[level][d])
+							continue;
+
+						neighbour[d] = (merged[d] + side) << level;
+						markChanged(neighbour);
+					}
+			}
+		}
+
+		/**
+		  * Draws every visible face of the bricks which can be seen with the current projection and modelview matrices.
+		  * This must be called on the thread which owns the GL context.
+		  * @param occlusionCulling false to draw every brick in the view frustum, for instance when drawing back faces into a shadow map
+		  */
+		void draw(bool occlusionCulling = true) const
+		{
+			if(changed)
+			{
+				StructureMesh* self = const_cast<StructureMesh*>(this);
+				vector<size_type> rebuilt;
+
+				for(size_type i = 0; i < bricks.size(); i++)
+					if(bricks[i].changed)
+						rebuilt.push_back(i);
+
+				//Only the bricks which changed are meshed again, in parallel, and then uploaded from this thread
+				WorkerPool::getShared().parallelFor(rebuilt.size(), [self, &rebuilt](size_t i) { self -> mesh(self -> bricks[rebuilt[i]]); });
+
+				for(vector<size_type>::const_iterator i = rebuilt.begin(); i != rebuilt.end(); i++)
+				{
+					const Brick& brick = bricks[*i];
+
+					if(brick.vertexArray != 0)
+					{
+						glBindBuffer(GL_ARRAY_BUFFER, brick.vertexBuffer);
+						glBufferData(GL_ARRAY_BUFFER, brick.vertices.size() * sizeof(Vertex), brick.vertices.data(), GL_STATIC_DRAW);
+						glBindBuffer(GL_ARRAY_BUFFER, 0);
+					}
+				}
+
+				views[0].current = views[1].current = false;
+				changed = false;
+			}
+
+			View& view = views[occlusionCulling];
+
+			if(view.culler.setView() || !view.current)
+				findVisibleBricks(view, occlusionCulling);
+
+			for(vector<size_type>::const_iterator i = view.visible.begin(); i != view.visible.end(); i++)
+			{
+				const Brick& brick = bricks[*i];
+				const unsigned level = view.levels[*i];
+
+				if(brick.levelVertexCount[level] == 0)
+					continue;
+
+				if(brick.vertexArray == 0)
+					upload(brick);
+
+				glBindVertexArray(brick.vertexArray);
+				glDrawArrays(GL_TRIANGLES, brick.levelFirst[level], brick.levelVertexCount[level]);
+			}
+
+			glBindVertexArray(0);
+		}
+
+		/**
+		  * Frees the vertex buffers.  The mesh is uploaded again if it is drawn afterwards.
+		  * This must be called on the thread which owns the GL context.
+		  */
+		void release() const
+		{
+			for(vector<Brick>::const_iterator i = bricks.begin(); i != bricks.end(); i++)
+			{
+				if(i -> vertexArray != 0)
+					glDeleteVertexArrays(1, &i -> vertexArray);
+
+				if(i -> vertexBuffer != 0)
+					glDeleteBuffers(1, &i -> vertexBuffer);
+
+				i -> vertexArray = i -> vertexBuffer = 0;
+			}
+		}
+
+		/**
+		  * @return the number of triangles in the finest mesh of every brick
+		  */
+		size_type getTriangleCount() const
+		{
+			size_type count = 0;
+
+			for(vector<Brick>::const_iterator i = bricks.begin(); i != bricks.end(); i++)
+				count += i -> levelVertexCount[0] / 3;
+
+			return count;
+		}
+
+		/**
+		  * @return the number of triangles drawn by the last call to draw() with occlusionCulling
+		  */
+		size_type getVisibleTriangleCount(bool occlusionCulling = true) const
+		{
+			const View& view = views[occlusionCulling];
+			size_type count = 0;
+
+			for(vector<size_type>::const_iterator i = view.visible.begin(); i != view.visible.end(); i++)
+				count += bricks[*i].levelVertexCount[view.levels[*i]] / 3;
+
+			return count;
+		}
+
+		size_type getBrickCount() const { return bricks.size(); }
+
+		/**
+		  * @return the number of bricks drawn by the last call to draw() with occlusionCulling
+		  */
+		size_type getVisibleBrickCount(bool occlusionCulling = true) const { return views[occlusionCulling].visible.size(); }
+
+	private:
+		uint8_t getCell(unsigned level, const size_type (&position)[3]) const { return cells[level][(position[y] * dimensions[level][z] + position[z]) * dimensions[level][x] + position[x]]; }
+
+		/**
+		  * Sets a cell of a coarser level from the cells of the level below it: empty if most of them are, otherwise the code most of its blocks have.
+		  * @return true if the cell changed
+		  */
+		bool merge(unsigned level, const size_type (&position)[3])
+		{
+			size_type counts[paletteSize + 1] = { 0 }, total = 0;
+			size_type cell[3];
+
+			for(cell[y] = 2 * position[y]; cell[y] < min(2 * position[y] + 2, dimensions[level - 1][y]); cell[y]++)
+				for(cell[z] = 2 * position[z]; cell[z] < min(2 * position[z] + 2, dimensions[level - 1][z]); cell[z]++)
+					for(cell[x] = 2 * position[x]; cell[x] < min(2 * position[x] + 2, dimensions[level - 1][x]); cell[x]++)
+					{
+						counts[getCell(level - 1, cell)]++;
+						total++;
+					}
+
+			uint8_t code = empty;
+
+			if(2 * counts[empty] < total)
+				for(uint8_t i = 1; i <= paletteSize; i++)
+					if(code == empty || counts[i] > counts[code])
+						code = i;
+
+			uint8_t& merged = cells[level][(position[y] * dimensions[level][z] + position[z]) * dimensions[level][x] + position[x]];
+			const bool changed = merged != code;
+
+			merged = code;
+
+			return changed;
+		}
+
+		/**
+		  * Marks the brick holding the cell at position of the finest level for rebuilding.
+		  */
+		void markChanged(const size_type (&position)[3])
+		{
+			bricks[((position[y] / brickSize) * brickCounts[z] + position[z] / brickSize) * brickCounts[x] + position[x] / brickSize].changed = true;
+			changed = true;
+		}
+
+		/**
+		  * @return true if a face between cells with codes cell and neighbour can be seen
+		  */
+		bool isVisible(uint8_t cell, uint8_t neighbour) const
+		{
+			return neighbour == empty || (cell == impenetrableIndex + 1) != (neighbour == impenetrableIndex + 1);
+		}
+
+		/**
+		  * Builds the mesh of every level of brick, one after the other, and bounds which hold them all.
+		  */
+		void mesh(Brick& brick)
+		{
+			brick.vertices.clear();
+			brick.changed = false;
+
+			for(unsigned level = 0; level < levelCount; level++)
+			{
+				brick.levelFirst[level] = (GLint)brick.vertices.size();
+				meshLevel(brick, level);
+				brick.levelVertexCount[level] = (GLsizei)(brick.vertices.size() - brick.levelFirst[level]);
+			}
+
+			for(unsigned d = 0; d < 3; d++)
+			{
+				brick.bounds.minimum[d] = corner[d] + brick.last[d] * blockSize;
+				brick.bounds.maximum[d] = corner[d] + brick.first[d] * blockSize;
+			}
+
+			for(vector<Vertex>::const_iterator i = brick.vertices.begin(); i != brick.vertices.end(); i++)
+				for(unsigned d = 0; d < 3; d++)
+				{
+					brick.bounds.minimum[d] = min(brick.bounds.minimum[d], i -> position[d]);
+					brick.bounds.maximum[d] = max(brick.bounds.maximum[d], i -> position[d]);
+				}
+		}
+
+		/**
+		  * Greedy meshing: each slice of faces facing one direction is covered by maximal rectangles of a single colour.
+		  * Faces are only merged within the brick, but whether they can be seen depends on the cells of neighbouring bricks too.
+		  * Bricks hold a whole number of cells of every level, so the cells of level within brick are its cells scaled down.
+		  */
+		void meshLevel(Brick& brick, unsigned level)
+		{
+			size_type first[3], last[3];
+
+			for(unsigned d = 0; d < 3; d++)
+			{
+				first[d] = brick.first[d] >> level;
+				last[d] = (brick.last[d] + (1 << level) - 1) >> level;
+			}
+
+			for(unsigned d = 0; d < 3; d++)
+			{
+				const unsigned u = (d + 1) % 3, v = (d + 2) % 3;
+				const size_type width = last[u] - first[u], height = last[v] - first[v];
+				vector<uint8_t> mask(width * height);
+
+				for(int side = -1; side <= 1; side += 2)
+					for(size_type slice = first[d]; slice < last[d]; slice++)
+					{
+						size_type position[3];
+
+						position[d] = slice;
+
+						//Mark the faces of this slice which can be seen from side
+						for(position[v] = first[v]; position[v] < last[v]; position[v]++)
+							for(position[u] = first[u]; position[u] < last[u]; position[u]++)
+							{
+								uint8_t cell = getCell(level, position), neighbour = empty;
+
+								if(cell != empty && (side > 0 ? slice + 1 < dimensions[level][d] : slice > 0))
+								{
+									size_type next[3] = { position[0], position[1], position[2] };
+
+									next[d] = slice + side;
+									neighbour = getCell(level, next);
+								}
+
+								mask[(position[v] - first[v]) * width + position[u] - first[u]] = cell != empty && isVisible(cell, neighbour) ? cell : (uint8_t)empty;
+							}
+
+						//Cover the marked faces with rectangles, widest first
+						for(size_type j = 0; j < height; j++)
+							for(size_type i = 0; i < width; )
+							{
+								const uint8_t code = mask[j * width + i];
+
+								if(code == empty)
+								{
+									i++;
+									continue;
+								}
+
+								size_type quadWidth = 1, quadHeight = 1;
+
+								while(i + quadWidth < width && mask[j * width + i + quadWidth] == code)
+									quadWidth++;
+
+								for(bool extend = true; extend && j + quadHeight < height; )
+								{
+									for(size_type k = 0; k < quadWidth && extend; k++)
+										extend = mask[(j + quadHeight) * width + i + k] == code;
+
+									if(extend)
+										quadHeight++;
+								}
+
+								for(size_type l = 0; l < quadHeight; l++)
+									for(size_type k = 0; k < quadWidth; k++)
+										mask[(j + l) * width + i + k] = empty;
+
+								addQuad(brick, level, d, side, side > 0 ? slice + 1 : slice, first[u] + i, first[v] + j, quadWidth, quadHeight, palette[code - 1]);
+
+								i += quadWidth;
+							}
+					}
+			}
+		}
+
+		/**
+		  * Adds two triangles covering a rectangle of faces of cells of level, wound counterclockwise when seen from outside.
+		  */
+		void addQuad(Brick& brick, unsigned level, unsigned d, int side, size_type plane, size_type i, size_type j, size_type width, size_type height, const Vector4& color)
+		{
+			const unsigned u = (d + 1) % 3, v = (d + 2) % 3;
+			const size_type cornerU[4] = { i, i + width, i + width, i };
+			const size_type cornerV[4] = { j, j, j + height, j + height };
+			const unsigned order[2][6] = { { 0, 3, 2, 0, 2, 1 }, { 0, 1, 2, 0, 2, 3 } };
+			const GLfloat cellSize = blockSize * (1 << level);
+			Vertex vertex;
+
+			for(unsigned k = 0; k < 3; k++)
+				vertex.normal[k] = k == d ? (GLfloat)side : 0.0f;
+
+			for(unsigned k = 0; k < 4; k++)
+				vertex.color[k] = color[k];
+
+			for(unsigned k = 0; k < 6; k++)
+			{
+				const unsigned n = order[side > 0][k];
+
+				vertex.position[d] = corner[d] + plane * cellSize;
+				vertex.position[u] = corner[u] + cornerU[n] * cellSize;
+				vertex.position[v] = corner[v] + cornerV[n] * cellSize;
+
+				brick.vertices.push_back(vertex);
+			}
+		}
+
+		/**
+		  * Culls the bricks outside the view frustum and, with occlusionCulling, those behind the faces of nearer bricks,
+		  * then picks the level each brick left is drawn at.
+		  */
+		void findVisibleBricks(View& view, bool occlusionCulling) const
+		{
+			vector<pair<GLfloat, size_type> > candidates;
+
+			for(size_type i = 0; i < bricks.size(); i++)
+				if(!bricks[i].vertices.empty() && view.culler.isInFrustum(bricks[i].bounds))
+					candidates.push_back(make_pair(view.culler.getDepth(bricks[i].bounds), i));
+
+			view.visible.clear();
+			view.current = true;
+
+			if(!occlusionCulling || candidates.size() < 2)
+			{
+				for(vector<pair<GLfloat, size_type> >::const_iterator i = candidates.begin(); i != candidates.end(); i++)
+					view.visible.push_back(i -> second);
+
+				chooseLevels(view);
+				return;
+			}
+
+			sort(candidates.begin(), candidates.end());
+			view.culler.clearDepth();
+
+			size_type occluders = 0;
+
+			//Each quad is six vertices; its corners in order around it are the first, second, third and sixth.
+			//Only the finest level occludes, since coarser levels may leave out faces which hide what is behind them.
+			for(vector<pair<GLfloat, size_type> >::const_iterator i = candidates.begin(); i != candidates.end() && occluders < occluderBudget; i++)
+			{
+				const vector<Vertex>& vertices = bricks[i -> second].vertices;
+				const size_type count = bricks[i -> second].levelVertexCount[0];
+
+				for(size_type j = 0; j < count && occluders < occluderBudget; j += 6, occluders++)
+				{
+					const Vertex* quad[4] = { &vertices[j], &vertices[j + 1], &vertices[j + 2], &vertices[j + 5] };
+					GLfloat corners[4][3];
+
+					for(unsigned k = 0; k < 4; k++)
+						for(unsigned l = 0; l < 3; l++)
+							corners[k][l] = quad[k] -> position[l];
+
+					view.culler.addOccluder(corners);
+				}
+			}
+
+			view.culler.buildHierarchy();
+
+			//Keep the order of the bricks, so the visible set is drawn the same way from pass to pass
+			for(size_type i = 0; i < candidates.size(); i++)
+				if(!view.culler.isOccluded(bricks[candidates[i].second].bounds))
+					view.visible.push_back(candidates[i].second);
+
+			sort(view.visible.begin(), view.visible.end());
+			chooseLevels(view);
+		}
+
+		/**
+		  * Moves each visible brick to a finer level while its error covers more than maximumError pixels, and to a coarser one
+		  * while the coarser level's error would cover less than hysteresis times that.
+		  */
+		void chooseLevels(View& view) const
+		{
+			for(vector<size_type>::const_iterator i = view.visible.begin(); i != view.visible.end(); i++)
+			{
+				const GLfloat pixelsPerUnit = view.culler.getPixelsPerUnit(bricks[*i].bounds);
+				uint8_t& level = view.levels[*i];
+
+				while(level > 0 && getError(level) * pixelsPerUnit > maximumError)
+					level--;
+
+				while(level + 1 < levelCount && getError(level + 1) * pixelsPerUnit < maximumError * hysteresis)
+					level++;
+			}
+		}
+
+		/**
+		  * @return the farthest a face of level can lie from the faces of the blocks it stands for
+		  */
+		GLfloat getError(unsigned level) const { return blockSize * ((1 << level) - 1); }
+
+		void upload(const Brick& brick) const
+		{
+			glGenVertexArrays(1, &brick.vertexArray);
+			glGenBuffers(1, &brick.vertexBuffer);
+
+			glBindVertexArray(brick.vertexArray);
+			glBindBuffer(GL_ARRAY_BUFFER, brick.vertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, brick.vertices.size() * sizeof(Vertex), brick.vertices.data(), GL_STATIC_DRAW);
+
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glEnableClientState(GL_NORMAL_ARRAY);
+			glEnableClientState(GL_COLOR_ARRAY);
+			glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (const void*)offsetof(Vertex, position));
+			glNormalPointer(GL_FLOAT, sizeof(Vertex), (const void*)offsetof(Vertex, normal));
+			glColorPointer(4, GL_FLOAT, sizeof(Vertex), (const void*)offsetof(Vertex, color));
+
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+};
+
+const GLfloat StructureMesh::maximumError = 1.0f;
+const GLfloat StructureMesh::hysteresis = 0.5f;
+
+#endif /*STRUCTUREMESH_H_*/
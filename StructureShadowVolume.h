@@ -0,0 +1,635 @@
+#ifndef STRUCTURESHADOWVOLUME_H_
+#define STRUCTURESHADOWVOLUME_H_
+
+#include <cstddef>		//size_t and ptrdiff_t
+#include <cstdint>		//uint8_t and uint64_t
+#include <cstdlib>		//abs
+#include <cassert>		//assert
+#include <algorithm>	//sort
+#include <vector>		//vector
+#include <unordered_map>	//unordered_map
+#include <memory>		//unique_ptr
+#include <stdexcept>	//runtime_error
+#include <iostream>		//cerr
+
+#include "BrickCuller.h"
+#include "Vector4.h"
+#include "ShaderProgram.h"
+
+using namespace std;
+
+/**
+  * @brief This class builds one shadow volume for a whole structure from its voxel grid.
+  * Only faces between a block and empty space can be part of a silhouette, so only the grid's boundary is considered.
+  *
+  * Every edge between two boundary faces holds a degenerate quad whose two copies of each end point carry the normals of the two faces.
+  * A vertex shader moves the vertices whose face looks away from the light to infinity, which opens the quad into a side of the
+  * shadow volume exactly where one face is lit and the other is not.  That buffer depends only on the structure, so the light can
+  * move every frame without any work on the CPU.  The quads are grouped by brick, and a brick's quads are skipped when neither
+  * the brick nor the shadow it casts can reach the view.
+  *
+  * If the shader cannot be compiled, the silhouette is found on the CPU instead: each lit boundary face adds its edges in
+  * counterclockwise order, edges shared by two lit faces cancel, and the rest are joined into straight runs and extruded.
+  * @see BlockStructure
+  */
+class StructureShadowVolume
+{
+	public:
+		typedef size_t size_type;
+
+	private:
+		enum { x, y, z, w };
+		enum { positionAttribute, normalAttribute };
+		enum { brickSize = BrickCuller::brickSize };
+
+		/**
+		  * The edge quads of the cells of one brick, which are contiguous in the buffer.
+		  */
+		struct Brick
+		{
+			GLint first;
+			GLsizei count;
+			BrickCuller::Box bounds;
+		};
+
+		/**
+		  * A silhouette edge along one axis of the grid.  count is the number of times the edge runs towards increasing axis,
+		  * less the number of times it runs the other way, and is only nonzero on the silhouette.
+		  */
+		struct Edge
+		{
+			unsigned axis;
+			size_type start[3];		//Lattice point at the lower end of the edge
+			size_type length;
+			int count;
+		};
+
+		struct EdgeLess
+		{
+			//Sort collinear edges next to each other, in order along their axis
+			bool operator () (const Edge& lhs, const Edge& rhs) const
+			{
+				const unsigned u = (lhs.axis + 1) % 3, v = (lhs.axis + 2) % 3;
+
+				if(lhs.axis != rhs.axis)
+					return lhs.axis < rhs.axis;
+
+				if(lhs.start[u] != rhs.start[u])
+					return lhs.start[u] < rhs.start[u];
+
+				if(lhs.start[v] != rhs.start[v])
+					return lhs.start[v] < rhs.start[v];
+
+				if(lhs.count != rhs.count)
+					return lhs.count < rhs.count;
+
+				return lhs.start[lhs.axis] < rhs.start[lhs.axis];
+			}
+		};
+
+		size_type dimensions[3];		//Columns, height and rows, so that dimension i runs along world axis i
+		vector<uint8_t> occupied;
+		Vector4 corner;					//The lowest corner of the cell at height, row and column 0
+		GLfloat blockSize;
+
+		//A position and a face normal for each vertex of the degenerate quads on every boundary edge
+		vector<GLfloat> edgeQuads;
+		vector<Brick> bricks;
+
+		//The ranges of the buffer to draw for the view and light they were found for
+		mutable BrickCuller culler;
+		mutable Vector4 culledLightPosition;
+		mutable bool culled;
+		mutable vector<GLint> firsts;
+		mutable vector<GLsizei> counts;
+
+		mutable GLuint quadArray, quadBuffer;
+		mutable unique_ptr<ShaderProgram> program;
+		mutable bool failed;
+
+		//The silhouette found on the CPU when the shader is not available.  Each vertex has four components so the extruded vertices can sit at infinity.
+		mutable vector<GLfloat> vertices;
+		mutable Vector4 lightPosition;
+
+		//Set when the silhouette must be found again before it is drawn
+		mutable bool changed;
+
+		mutable GLuint vertexArray, vertexBuffer;
+
+		StructureShadowVolume(const StructureShadowVolume&);
+		StructureShadowVolume& operator = (const StructureShadowVolume&);
+
+	public:
+		StructureShadowVolume() : blockSize(1.0), culled(false), quadArray(0), quadBuffer(0), failed(false), changed(false), vertexArray(0), vertexBuffer(0)
+		{
+			dimensions[x] = dimensions[y] = dimensions[z] = 0;
+		}
+
+		~StructureShadowVolume() { release(); }
+
+		/**
+		  * Replaces the grid with the blocks of structure.  This makes no GL calls.
+		  * @param structure any type providing getHeight(), getRows(), getColumns() and hasBlock(height, row, column)
+		  * @param origin the center of the cell at height, row and column 0
+		  */
+		template<typename Structure>
+		void build(const Structure& structure, const Vector4& origin, GLfloat blockSize)
+		{
+			dimensions[x] = structure.getColumns();
+			dimensions[y] = structure.getHeight();
+			dimensions[z] = structure.getRows();
+
+			this -> blockSize = blockSize;
+			corner = Vector4(origin[x] - blockSize / 2.0f, origin[y] - blockSize / 2.0f, origin[z] - blockSize / 2.0f, 1.0);
+
+			occupied.assign(dimensions[x] * dimensions[y] * dimensions[z], 0);
+
+			for(size_type i = 0; i < dimensions[y]; i++)
+				for(size_type j = 0; j < dimensions[z]; j++)
+					for(size_type k = 0; k < dimensions[x]; k++)
+						occupied[(i * dimensions[z] + j) * dimensions[x] + k] = structure.hasBlock(i, j, k);
+
+			buildEdgeQuads();
+			changed = true;
+			culled = false;
+		}
+
+		/**
+		  * Draws the shadow volume cast from lightPosition.  This must be called on the thread which owns the GL context.
+		  * @param lightPosition a positional light
+		  */
+		void draw(const Vector4& lightPosition) const
+		{
+			assert(lightPosition[w] == 1.0);
+
+			if(!failed && drawExtruded(lightPosition))
+				return;
+
+			if(changed || lightPosition != this -> lightPosition)
+			{
+				this -> lightPosition = lightPosition;
+				extrude();
+
+				if(vertexArray != 0)
+				{
+					glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+					glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+					glBindBuffer(GL_ARRAY_BUFFER, 0);
+				}
+
+				changed = false;
+			}
+
+			if(vertices.empty())
+				return;
+
+			if(vertexArray == 0)
+				upload();
+
+			glBindVertexArray(vertexArray);
+			glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(vertices.size() / 4));
+			glBindVertexArray(0);
+		}
+
+		/**
+		  * Frees the vertex buffers and the shader.  This must be called on the thread which owns the GL context.
+		  */
+		void release() const
+		{
+			if(quadArray != 0)
+				glDeleteVertexArrays(1, &quadArray);
+
+			if(quadBuffer != 0)
+				glDeleteBuffers(1, &quadBuffer);
+
+			quadArray = quadBuffer = 0;
+			program.reset();
+
+			if(vertexArray != 0)
+				glDeleteVertexArrays(1, &vertexArray);
+
+			if(vertexBuffer != 0)
+				glDeleteBuffers(1, &vertexBuffer);
+
+			vertexArray = vertexBuffer = 0;
+		}
+
+		/**
+		  * @return the number of triangles in the buffer of degenerate edge quads
+		  */
+		size_type getTriangleCount() const { return edgeQuads.size() / 18; }
+
+	private:
+		bool isOccupied(const size_type (&position)[3]) const { return occupied[(position[y] * dimensions[z] + position[z]) * dimensions[x] + position[x]] != 0; }
+
+		/**
+		  * @return true if position, which may lie outside the grid, holds a block
+		  */
+		bool isOccupied(const ptrdiff_t (&position)[3]) const
+		{
+			for(unsigned i = 0; i < 3; i++)
+				if(position[i] < 0 || position[i] >= (ptrdiff_t)dimensions[i])
+					return false;
+
+			const size_type cell[3] = { (size_type)position[x], (size_type)position[y], (size_type)position[z] };
+
+			return isOccupied(cell);
+		}
+
+		/**
+		  * @return true if the face of the cell at position which faces side along axis d borders empty space
+		  */
+		bool isBoundary(const size_type (&position)[3], unsigned d, int side) const
+		{
+			const ptrdiff_t next[3] = { (ptrdiff_t)position[x] + (d == x ? side : 0), (ptrdiff_t)position[y] + (d == y ? side : 0), (ptrdiff_t)position[z] + (d == z ? side : 0) };
+
+			return !isOccupied(next);
+		}
+
+		/**
+		  * Adds a degenerate quad to every edge of the boundary.  Each edge is added once, from the face which walks it towards increasing axis
+		  * when its corners are taken counterclockwise.  Where four cells meet along an edge, the faces are paired so the surface stays closed:
+		  * a face turns into a diagonal neighbour before continuing flat, and continues flat before turning around its own cell.
+		  */
+		void buildEdgeQuads()
+		{
+			size_type brickCounts[3];
+
+			edgeQuads.clear();
+			bricks.clear();
+
+			for(unsigned d = 0; d < 3; d++)
+				brickCounts[d] = (dimensions[d] + brickSize - 1) / brickSize;
+
+			for(size_type i = 0; i < brickCounts[y]; i++)
+				for(size_type j = 0; j < brickCounts[z]; j++)
+					for(size_type k = 0; k < brickCounts[x]; k++)
+					{
+						const size_type first[3] = { k * brickSize, i * brickSize, j * brickSize };
+						size_type last[3], position[3];
+						Brick brick;
+
+						brick.first = (GLint)(edgeQuads.size() / 6);
+
+						for(unsigned d = 0; d < 3; d++)
+						{
+							last[d] = min(first[d] + brickSize, dimensions[d]);
+							brick.bounds.minimum[d] = corner[d] + first[d] * blockSize;
+							brick.bounds.maximum[d] = corner[d] + last[d] * blockSize;
+						}
+
+						for(position[y] = first[y]; position[y] < last[y]; position[y]++)
+							for(position[z] = first[z]; position[z] < last[z]; position[z]++)
+								for(position[x] = first[x]; position[x] < last[x]; position[x]++)
+									if(isOccupied(position))
+										addEdgeQuads(position);
+
+						brick.count = (GLsizei)(edgeQuads.size() / 6) - brick.first;
+
+						if(brick.count > 0)
+							bricks.push_back(brick);
+					}
+		}
+
+		/**
+		  * Adds the quads on the boundary edges of the faces of the cell at position.
+		  */
+		void addEdgeQuads(const size_type (&position)[3])
+		{
+			const size_type cornerU[4] = { 0, 1, 1, 0 };
+			const size_type cornerV[4] = { 0, 0, 1, 1 };
+			const unsigned order[2][4] = { { 0, 3, 2, 1 }, { 0, 1, 2, 3 } };
+
+			for(unsigned d = 0; d < 3; d++)
+				for(int side = -1; side <= 1; side += 2)
+				{
+					if(!isBoundary(position, d, side))
+						continue;
+
+					const unsigned u = (d + 1) % 3, v = (d + 2) % 3;
+
+					for(unsigned l = 0; l < 4; l++)
+					{
+						const unsigned from = order[side > 0][l], to = order[side > 0][(l + 1) % 4];
+						const unsigned axis = cornerU[from] != cornerU[to] ? u : v;
+						const bool increasing = axis == u ? cornerU[from] < cornerU[to] : cornerV[from] < cornerV[to];
+
+						if(!increasing)
+							continue;
+
+						//The direction, within the face, from the face towards the edge
+						const unsigned across = axis == u ? v : u;
+						const int outward = (across == u ? cornerU[from] : cornerV[from]) == 1 ? 1 : -1;
+
+						ptrdiff_t diagonal[3] = { (ptrdiff_t)position[x], (ptrdiff_t)position[y], (ptrdiff_t)position[z] };
+
+						diagonal[across] += outward;
+
+						ptrdiff_t beside[3] = { diagonal[x], diagonal[y], diagonal[z] };
+
+						diagonal[d] += side;
+
+						GLfloat normal[3] = { 0.0, 0.0, 0.0 }, partnerNormal[3] = { 0.0, 0.0, 0.0 };
+
+						normal[d] = (GLfloat)side;
+
+						if(isOccupied(diagonal))
+							partnerNormal[across] = (GLfloat)-outward;
+						else if(isOccupied(beside))
+							partnerNormal[d] = (GLfloat)side;
+						else
+							partnerNormal[across] = (GLfloat)outward;
+
+						GLfloat start[3], end[3];
+
+						start[d] = end[d] = corner[d] + (position[d] + (side > 0 ? 1 : 0)) * blockSize;
+						start[u] = corner[u] + (position[u] + cornerU[from]) * blockSize;
+						start[v] = corner[v] + (position[v] + cornerV[from]) * blockSize;
+						end[u] = corner[u] + (position[u] + cornerU[to]) * blockSize;
+						end[v] = corner[v] + (position[v] + cornerV[to]) * blockSize;
+
+						//start and end on this face, then on its partner, wound so the quad faces out of the volume once it opens
+						const GLfloat* quad[4][2] = { { start, normal }, { start, partnerNormal }, { end, partnerNormal }, { end, normal } };
+						const unsigned triangles[6] = { 0, 1, 2, 0, 2, 3 };
+
+						for(unsigned m = 0; m < 6; m++)
+						{
+							edgeQuads.insert(edgeQuads.end(), quad[triangles[m]][0], quad[triangles[m]][0] + 3);
+							edgeQuads.insert(edgeQuads.end(), quad[triangles[m]][1], quad[triangles[m]][1] + 3);
+						}
+					}
+				}
+		}
+
+		/**
+		  * Draws the edge quads through the extruding shader.
+		  * @return false if the shader is not available, in which case nothing was drawn
+		  */
+		bool drawExtruded(const Vector4& lightPosition) const
+		{
+			if(edgeQuads.empty())
+				return true;
+
+			if(quadArray == 0 && !uploadEdgeQuads())
+				return false;
+
+			GLint previousProgram;
+
+			glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+			program -> use();
+			glUniform3f(program -> getUniformLocation("lightPosition"), lightPosition[x], lightPosition[y], lightPosition[z]);
+
+			if(culler.setView() || !culled || lightPosition != culledLightPosition)
+				findVisibleRanges(lightPosition);
+
+			glBindVertexArray(quadArray);
+			glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), (GLsizei)firsts.size());
+			glBindVertexArray(0);
+
+			glUseProgram(previousProgram);
+
+			return true;
+		}
+
+		/**
+		  * Finds the ranges of the buffer holding the bricks whose shadow can reach the view, joining neighbouring ranges.
+		  */
+		void findVisibleRanges(const Vector4& lightPosition) const
+		{
+			firsts.clear();
+			counts.clear();
+
+			for(vector<Brick>::const_iterator i = bricks.begin(); i != bricks.end(); i++)
+				if(culler.isShadowInFrustum(i -> bounds, lightPosition))
+				{
+					if(!firsts.empty() && firsts.back() + counts.back() == i -> first)
+						counts.back() += i -> count;
+					else
+					{
+						firsts.push_back(i -> first);
+						counts.push_back(i -> count);
+					}
+				}
+
+			culledLightPosition = lightPosition;
+			culled = true;
+		}
+
+		bool uploadEdgeQuads() const
+		{
+			try
+			{
+				ShaderProgram::AttributeList attributes;
+
+				attributes.push_back(make_pair((GLuint)positionAttribute, string("position")));
+				attributes.push_back(make_pair((GLuint)normalAttribute, string("normal")));
+
+				program.reset(new ShaderProgram(vertexSource, fragmentSource, attributes));
+			}
+			catch(const runtime_error& e)
+			{
+				cerr << e.what() << endl;
+				failed = true;
+
+				return false;
+			}
+
+			glGenVertexArrays(1, &quadArray);
+			glGenBuffers(1, &quadBuffer);
+
+			glBindVertexArray(quadArray);
+			glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+			glBufferData(GL_ARRAY_BUFFER, edgeQuads.size() * sizeof(GLfloat), edgeQuads.data(), GL_STATIC_DRAW);
+			glEnableVertexAttribArray(positionAttribute);
+			glVertexAttribPointer(positionAttribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)0);
+			glEnableVertexAttribArray(normalAttribute);
+			glVertexAttribPointer(normalAttribute, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (const void*)(3 * sizeof(GLfloat)));
+
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			return true;
+		}
+
+		uint64_t getLatticeIndex(const size_type (&point)[3]) const { return ((uint64_t)point[y] * (dimensions[z] + 1) + point[z]) * (dimensions[x] + 1) + point[x]; }
+
+		/**
+		  * Finds the silhouette of the lit boundary faces and extrudes it away from the light.
+		  */
+		void extrude() const
+		{
+			//For each unit edge of the lattice, keyed by its lower point and axis, the net number of times it was walked
+			unordered_map<uint64_t, int> counts;
+			vector<Edge> edges;
+
+			vertices.clear();
+
+			for(size_type i = 0; i < dimensions[y]; i++)
+				for(size_type j = 0; j < dimensions[z]; j++)
+					for(size_type k = 0; k < dimensions[x]; k++)
+					{
+						const size_type position[3] = { k, i, j };
+
+						if(!isOccupied(position))
+							continue;
+
+						for(unsigned d = 0; d < 3; d++)
+							for(int side = -1; side <= 1; side += 2)
+							{
+								if(isBoundary(position, d, side) && isLit(position, d, side))
+									addFace(counts, position, d, side);
+							}
+					}
+
+			for(unordered_map<uint64_t, int>::const_iterator i = counts.begin(); i != counts.end(); i++)
+				if(i -> second != 0)
+				{
+					Edge edge;
+					uint64_t point = i -> first / 3;
+
+					edge.axis = (unsigned)(i -> first % 3);
+					edge.start[x] = (size_type)(point % (dimensions[x] + 1));
+					point /= dimensions[x] + 1;
+					edge.start[z] = (size_type)(point % (dimensions[z] + 1));
+					edge.start[y] = (size_type)(point / (dimensions[z] + 1));
+					edge.length = 1;
+					edge.count = i -> second;
+
+					edges.push_back(edge);
+				}
+
+			sort(edges.begin(), edges.end(), EdgeLess());
+
+			//Join collinear runs, so a long straight silhouette is extruded as one quad
+			for(vector<Edge>::const_iterator i = edges.begin(); i != edges.end(); )
+			{
+				Edge run = *i;
+
+				for(i++; i != edges.end() && isContinuation(run, *i); i++)
+					run.length++;
+
+				addExtrusion(run);
+			}
+		}
+
+		/**
+		  * @return true if the face of the cell at position which faces side along axis d faces towards the light
+		  */
+		bool isLit(const size_type (&position)[3], unsigned d, int side) const
+		{
+			GLfloat faceCenter = corner[d] + (position[d] + (side > 0 ? 1 : 0)) * blockSize;
+
+			return side * (lightPosition[d] - faceCenter) > 0.0f;
+		}
+
+		/**
+		  * Walks the four edges of a face counterclockwise as seen from outside the structure.
+		  */
+		void addFace(unordered_map<uint64_t, int>& counts, const size_type (&position)[3], unsigned d, int side) const
+		{
+			const unsigned u = (d + 1) % 3, v = (d + 2) % 3;
+			const size_type cornerU[4] = { 0, 1, 1, 0 };
+			const size_type cornerV[4] = { 0, 0, 1, 1 };
+			const unsigned order[2][4] = { { 0, 3, 2, 1 }, { 0, 1, 2, 3 } };
+
+			for(unsigned k = 0; k < 4; k++)
+			{
+				const unsigned from = order[side > 0][k], to = order[side > 0][(k + 1) % 4];
+				size_type point[3];
+
+				point[d] = position[d] + (side > 0 ? 1 : 0);
+				point[u] = position[u] + min(cornerU[from], cornerU[to]);
+				point[v] = position[v] + min(cornerV[from], cornerV[to]);
+
+				//Consecutive corners differ along exactly one of u and v
+				const unsigned axis = cornerU[from] != cornerU[to] ? u : v;
+				const bool increasing = axis == u ? cornerU[from] < cornerU[to] : cornerV[from] < cornerV[to];
+
+				counts[getLatticeIndex(point) * 3 + axis] += increasing ? 1 : -1;
+			}
+		}
+
+		static bool isContinuation(const Edge& run, const Edge& edge)
+		{
+			const unsigned u = (run.axis + 1) % 3, v = (run.axis + 2) % 3;
+
+			return edge.axis == run.axis && edge.count == run.count && edge.start[u] == run.start[u] && edge.start[v] == run.start[v] && edge.start[run.axis] == run.start[run.axis] + run.length;
+		}
+
+		/**
+		  * Adds the quad swept by an edge moving away from the light, once for each time the edge was walked.
+		  */
+		void addExtrusion(const Edge& edge) const
+		{
+			Vector4 first(corner[x] + edge.start[x] * blockSize, corner[y] + edge.start[y] * blockSize, corner[z] + edge.start[z] * blockSize, 1.0);
+			Vector4 second(first);
+
+			second[edge.axis] += edge.length * blockSize;
+
+			//Follow the direction in which the lit faces walked the edge
+			if(edge.count < 0)
+				swap(first, second);
+
+			Vector4 firstAtInfinity = (first - lightPosition).normalize();
+			Vector4 secondAtInfinity = (second - lightPosition).normalize();
+
+			assert(firstAtInfinity[w] == 0.0 && secondAtInfinity[w] == 0.0);
+
+			const Vector4* quad[6] = { &first, &firstAtInfinity, &secondAtInfinity, &first, &secondAtInfinity, &second };
+
+			for(int i = 0; i < abs(edge.count); i++)
+				for(unsigned j = 0; j < 6; j++)
+					vertices.insert(vertices.end(), quad[j] -> begin(), quad[j] -> end());
+		}
+
+		void upload() const
+		{
+			glGenVertexArrays(1, &vertexArray);
+			glGenBuffers(1, &vertexBuffer);
+
+			glBindVertexArray(vertexArray);
+			glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+
+			glEnableClientState(GL_VERTEX_ARRAY);
+			glVertexPointer(4, GL_FLOAT, 4 * sizeof(GLfloat), (const void*)0);
+
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		static const char* const vertexSource;
+		static const char* const fragmentSource;
+};
+
+//A vertex stays where it is if its face looks towards the light and otherwise moves to infinity directly away from it
+const char* const StructureShadowVolume::vertexSource = R"(
+#version 130
+
+in vec3 position;
+in vec3 normal;
+
+uniform vec3 lightPosition;
+
+void main()
+{
+	vec3 toLight = lightPosition - position;
+
+	if(dot(normal, toLight) > 0.0)
+		gl_Position = gl_ModelViewProjectionMatrix * vec4(position, 1.0);
+	else
+		gl_Position = gl_ModelViewProjectionMatrix * vec4(-toLight, 0.0);
+}
+)";
+
+const char* const StructureShadowVolume::fragmentSource = R"(
+#version 130
+
+void main()
+{
+	gl_FragColor = vec4(0.0);
+}
+)";
+
+#endif /*STRUCTURESHADOWVOLUME_H_*/
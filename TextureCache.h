@@ -0,0 +1,326 @@
+#ifndef TEXTURECACHE_H_
+#define TEXTURECACHE_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint8_t and uint32_t
+#include <cstdio>		//FILE, fopen and fread
+#include <cstring>		//memcmp and memcpy
+#include <cmath>		//sqrt
+#include <vector>		//vector
+#include <deque>		//deque
+#include <map>			//map
+#include <string>		//string
+#include <thread>		//thread
+#include <mutex>		//mutex and lock_guard
+#include <condition_variable>	//condition_variable
+#include <stdexcept>	//runtime_error
+
+using namespace std;
+
+/**
+  * @brief This class loads textures by path and keeps them for the life of the program.
+  * Files are read and decoded on a worker thread; the render thread only copies finished pixels into a pixel buffer object
+  * and builds mipmaps, so a texture request never stalls a frame.  Until its pixels arrive a texture samples as mid-grey.
+  *
+  * A texture file starts with the TextureHeader below followed by the pixels, bottom row first.
+  * Files without the header are read as the legacy raw format: square, 8-bit RGB, with the size taken from the file length.
+  */
+class TextureCache
+{
+	public:
+		struct TextureHeader
+		{
+			char magic[4];			//"BLKT"
+			uint32_t width;
+			uint32_t height;
+			uint32_t channels;		//1, 3 or 4
+		};
+
+		static_assert(sizeof(TextureHeader) == 16, "TextureCache::TextureHeader must not contain padding");
+
+	private:
+		struct Texture
+		{
+			GLuint name;
+			bool ready;
+			string error;
+
+			Texture() : name(0), ready(false) {}
+		};
+
+		/**
+		  * Pixels decoded by the worker and waiting for the render thread.
+		  */
+		struct Image
+		{
+			string path;
+			GLsizei width, height;
+			GLenum format;
+			vector<uint8_t> pixels;
+			string error;
+		};
+
+		map<string, Texture> textures;
+
+		thread worker;
+		mutex queueMutex;
+		condition_variable queueChanged;
+		deque<string> requests;
+		vector<Image> decoded;
+		bool stopping;
+
+		TextureCache(const TextureCache&);
+		TextureCache& operator = (const TextureCache&);
+
+	public:
+		TextureCache() : stopping(false) { worker = thread(&TextureCache::run, this); }
+
+		~TextureCache()
+		{
+			{
+				lock_guard<mutex> lock(queueMutex);
+				stopping = true;
+			}
+
+			queueChanged.notify_one();
+			worker.join();
+
+			for(map<string, Texture>::iterator i = textures.begin(); i != textures.end(); i++)
+				glDeleteTextures(1, &i -> second.name);
+		}
+
+		/**
+		  * @return the texture for filePath, which can be bound at once.  The first request for a path starts loading it.
+		  */
+		GLuint get(const string& filePath, GLint wrap = GL_REPEAT)
+		{
+			map<string, Texture>::iterator existing = textures.find(filePath);
+
+			if(existing != textures.end())
+				return existing -> second.name;
+
+			Texture& texture = textures[filePath];
+			const uint8_t grey[3] = { 128, 128, 128 };
+
+			glGenTextures(1, &texture.name);
+			glBindTexture(GL_TEXTURE_2D, texture.name);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			{
+				lock_guard<mutex> lock(queueMutex);
+				requests.push_back(filePath);
+			}
+
+			queueChanged.notify_one();
+
+			return texture.name;
+		}
+
+		/**
+		  * Uploads textures which finished decoding since the last call.  This must be called on the thread which owns the GL context.
+		  */
+		void update()
+		{
+			vector<Image> finished;
+
+			{
+				lock_guard<mutex> lock(queueMutex);
+				finished.swap(decoded);
+			}
+
+			for(vector<Image>::iterator i = finished.begin(); i != finished.end(); i++)
+			{
+				Texture& texture = textures[i -> path];
+
+				if(!i -> error.empty())
+					texture.error = i -> error;
+				else
+					upload(texture, *i);
+			}
+		}
+
+		/**
+		  * @return true once the pixels of filePath have been uploaded
+		  */
+		bool isReady(const string& filePath) const
+		{
+			map<string, Texture>::const_iterator existing = textures.find(filePath);
+
+			return existing != textures.end() && existing -> second.ready;
+		}
+
+		/**
+		  * @return true while any texture requested so far has neither been uploaded nor failed
+		  */
+		bool isPending() const
+		{
+			for(map<string, Texture>::const_iterator i = textures.begin(); i != textures.end(); i++)
+				if(!i -> second.ready && i -> second.error.empty())
+					return true;
+
+			return false;
+		}
+
+		/**
+		  * @return the reason filePath could not be loaded, or an empty string if it has not failed
+		  */
+		string getError(const string& filePath) const
+		{
+			map<string, Texture>::const_iterator existing = textures.find(filePath);
+
+			return existing != textures.end() ? existing -> second.error : string();
+		}
+
+		/**
+		  * Reads and decodes a texture file.  This throws a runtime_error if the file is missing, truncated or malformed.
+		  */
+		static void decode(const string& filePath, GLsizei& width, GLsizei& height, GLenum& format, vector<uint8_t>& pixels)
+		{
+			FILE* file = fopen(filePath.c_str(), "rb");
+
+			if(file == NULL)
+				throw runtime_error("The specified file '" + filePath + "' does not exist.");
+
+			long size = -1;
+
+			if(fseek(file, 0, SEEK_END) == 0)
+			{
+				size = ftell(file);
+				fseek(file, 0, SEEK_SET);
+			}
+
+			TextureHeader header;
+			size_t channels, pixelBytes;
+
+			if(size >= (long)sizeof(header) && fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "BLKT", 4) == 0)
+			{
+				if(header.width == 0 || header.height == 0 || header.width > 16384 || header.height > 16384 || (header.channels != 1 && header.channels != 3 && header.channels != 4))
+				{
+					fclose(file);
+					throw runtime_error("The texture '" + filePath + "' has an invalid header.");
+				}
+
+				width = (GLsizei)header.width;
+				height = (GLsizei)header.height;
+				channels = header.channels;
+				pixelBytes = (size_t)width * height * channels;
+
+				if((size_t)size - sizeof(header) < pixelBytes)
+				{
+					fclose(file);
+					throw runtime_error("The texture '" + filePath + "' is truncated.");
+				}
+			}
+			else
+			{
+				//Legacy raw texture: square RGB with no header
+				size_t side = size > 0 ? (size_t)(sqrt((double)size / 3.0) + 0.5) : 0;
+
+				if(side == 0 || side * side * 3 != (size_t)size)
+				{
+					fclose(file);
+					throw runtime_error("The texture '" + filePath + "' has no header and is not a square RGB image.");
+				}
+
+				fseek(file, 0, SEEK_SET);
+
+				width = height = (GLsizei)side;
+				channels = 3;
+				pixelBytes = (size_t)size;
+			}
+
+			pixels.resize(pixelBytes);
+
+			size_t count = fread(pixels.data(), 1, pixelBytes, file);
+
+			fclose(file);
+
+			if(count != pixelBytes)
+				throw runtime_error("The texture '" + filePath + "' could not be read.");
+
+			format = channels == 1 ? GL_RED : channels == 3 ? GL_RGB : GL_RGBA;
+		}
+
+	private:
+		void run()
+		{
+			for(;;)
+			{
+				string filePath;
+
+				{
+					unique_lock<mutex> lock(queueMutex);
+
+					while(!stopping && requests.empty())
+						queueChanged.wait(lock);
+
+					if(stopping)
+						return;
+
+					filePath = requests.front();
+					requests.pop_front();
+				}
+
+				Image image;
+
+				image.path = filePath;
+
+				try
+				{
+					decode(filePath, image.width, image.height, image.format, image.pixels);
+				}
+				catch(const runtime_error& e)
+				{
+					image.error = e.what();
+				}
+
+				lock_guard<mutex> lock(queueMutex);
+				decoded.push_back(image);
+			}
+		}
+
+		/**
+		  * Streams the pixels through a pixel buffer object so the driver can copy them without another pass over client memory.
+		  */
+		static void upload(Texture& texture, const Image& image)
+		{
+			const GLsizeiptr size = (GLsizeiptr)image.pixels.size();
+			GLuint pixelBuffer;
+
+			glGenBuffers(1, &pixelBuffer);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+			void* mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+
+			if(mapped != NULL)
+			{
+				memcpy(mapped, image.pixels.data(), size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			}
+			else
+				glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, size, image.pixels.data());
+
+			glBindTexture(GL_TEXTURE_2D, texture.name);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, image.format == GL_RED ? GL_R8 : image.format == GL_RGB ? GL_RGB8 : GL_RGBA8, image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE, (const void*)0);
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glDeleteBuffers(1, &pixelBuffer);
+
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			texture.ready = true;
+		}
+};
+
+#endif /*TEXTURECACHE_H_*/
@@ -0,0 +1,678 @@
+#ifndef THUMBNAILCACHE_H_
+#define THUMBNAILCACHE_H_
+
+#include <cstddef>		//size_t
+#include <cstdint>		//uint8_t and uint64_t
+#include <cstdio>		//snprintf
+#include <cmath>		//sqrt
+#include <algorithm>	//max and min
+#include <vector>		//vector
+#include <deque>		//deque
+#include <map>			//map
+#include <set>			//set
+#include <string>		//string
+#include <thread>		//thread
+#include <mutex>		//mutex and lock_guard
+#include <condition_variable>	//condition_variable
+#include <chrono>		//steady_clock
+#include <memory>		//unique_ptr
+#include <exception>	//exception
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/stat.h>	//mkdir
+#endif
+
+#include "PuzzleCatalog.h"
+#include "StructureMesh.h"
+#include "SceneLighting.h"
+#include "TextureCache.h"
+#include "FrameWriter.h"
+#include "Block.h"
+
+using namespace std;
+
+/**
+  * @brief This class draws a small picture of each puzzle for the level menu and keeps the pictures in one texture atlas.
+  * Pictures are only made for the puzzles the menu asks for, which are those it shows.  A worker thread reads each one from a cache
+  * directory, where they are stored by the puzzle's content hash, or failing that parses the puzzle and meshes it.  The render thread
+  * then copies the pixels or draws the mesh into a free tile of the atlas, taking no more than frameBudget seconds a frame, and hands
+  * newly drawn pictures back to the worker to be saved.  When the atlas is full, the tile used least recently is reused.
+  * @see PuzzleCatalog
+  */
+class ThumbnailCache
+{
+	public:
+		enum { tileSize = 64 };
+
+		/**
+		  * @brief The texture coordinates of a picture within the atlas.  Rows run bottom up, as GL stores them.
+		  */
+		struct Tile
+		{
+			GLfloat left, bottom, right, top;
+		};
+
+	private:
+		enum { x, y, z, w };
+		enum { tilesPerSide = 16, tileCount = tilesPerSide * tilesPerSide };
+
+		//Meshes waiting to be drawn hold a whole puzzle's faces, so the worker stops meshing once this many are waiting
+		enum { maximumWaitingMeshes = 2 };
+
+		//Larger puzzles are drawn smaller, so that the game's lights, placed for puzzles of about this many blocks, still reach them
+		enum { maximumBlocksAcross = 10 };
+
+		static const double frameBudget;
+		static const GLfloat background[4];
+
+		struct Request
+		{
+			uint64_t hash;
+			string path;
+		};
+
+		/**
+		  * A picture read from the cache directory, or a mesh to draw one from, made by the worker for the render thread.
+		  */
+		struct Result
+		{
+			uint64_t hash;
+			vector<uint8_t> pixels;
+			StructureMesh* mesh;
+			Vector4 center;
+			GLfloat radius;
+			bool failed;
+		};
+
+		/**
+		  * A picture the render thread drew, waiting for the worker to save it.
+		  */
+		struct Picture
+		{
+			uint64_t hash;
+			vector<uint8_t> pixels;
+		};
+
+		struct Slot
+		{
+			uint64_t hash;
+			bool filled;
+			unsigned long lastUsed;
+		};
+
+		/**
+		  * Presents a puzzle's cells to StructureMesh::build, merging every group of scale cells along each side into one block.
+		  * A group holds a block if any of its cells does, and is impenetrable if any of them is, so small features are not lost.
+		  */
+		template<typename CellSource>
+		class ScaledCells
+		{
+			public:
+				struct Cell
+				{
+					unsigned paletteIndex;
+
+					unsigned getPaletteIndex() const { return paletteIndex; }
+				};
+
+			private:
+				const CellSource& source;
+				size_t scale;
+
+			public:
+				ScaledCells(const CellSource& source, size_t scale) : source(source), scale(scale) {}
+
+				size_t getHeight() const { return (source.getHeight() + scale - 1) / scale; }
+
+				size_t getRows() const { return (source.getRows() + scale - 1) / scale; }
+
+				size_t getColumns() const { return (source.getColumns() + scale - 1) / scale; }
+
+				bool hasBlock(size_t height, size_t row, size_t column) const { return getCellType(height, row, column) != BlockGrid::EMPTY; }
+
+				Cell getBlock(size_t height, size_t row, size_t column) const
+				{
+					Cell cell;
+
+					cell.paletteIndex = getCellType(height, row, column) == BlockGrid::IMPENETRABLE ? Block::IMPENETRABLE_COLOR : Block::UNTOUCHED_COLOR;
+
+					return cell;
+				}
+
+			private:
+				BlockGrid::CellType getCellType(size_t height, size_t row, size_t column) const
+				{
+					BlockGrid::CellType type = BlockGrid::EMPTY;
+
+					for(size_t i = height * scale; i < min((height + 1) * scale, (size_t)source.getHeight()); i++)
+						for(size_t j = row * scale; j < min((row + 1) * scale, (size_t)source.getRows()); j++)
+							for(size_t k = column * scale; k < min((column + 1) * scale, (size_t)source.getColumns()); k++)
+							{
+								const BlockGrid::CellType cell = source.getCellType(i, j, k);
+
+								if(cell == BlockGrid::IMPENETRABLE)
+									return cell;
+
+								if(cell != BlockGrid::EMPTY)
+									type = cell;
+							}
+
+					return type;
+				}
+		};
+
+		string directory;
+		GLfloat blockSize;
+		Vector4 base;
+
+		//Render thread only
+		GLuint atlas, framebuffer, colorBuffer, depthBuffer;
+		vector<Slot> slots;
+		map<uint64_t, size_t> slotOf;
+		set<uint64_t> failed;
+		vector<Request> wanted;
+		unsigned long frame;
+
+		//Shared with the worker
+		thread worker;
+		mutable mutex queueMutex;
+		condition_variable queueChanged;
+		vector<Request> requests;
+		deque<Result> results;
+		deque<Picture> pictures;
+		uint64_t working;
+		bool isWorking;
+		size_t waitingMeshes;
+		bool stopping;
+
+		ThumbnailCache(const ThumbnailCache&);
+		ThumbnailCache& operator = (const ThumbnailCache&);
+
+	public:
+		/**
+		  * @param directory where pictures are saved between runs; it is created when the first picture is saved
+		  * @param blockSize the size blocks are drawn at, which together with base places puzzles where the game's lights expect them
+		  */
+		ThumbnailCache(const string& directory, GLfloat blockSize, const Vector4& base) :	directory(directory), blockSize(blockSize), base(base),
+																						atlas(0), framebuffer(0), colorBuffer(0), depthBuffer(0),
+																						slots(tileCount), frame(0), working(0), isWorking(false), waitingMeshes(0), stopping(false)
+		{
+			for(vector<Slot>::iterator i = slots.begin(); i != slots.end(); i++)
+			{
+				i -> hash = 0;
+				i -> filled = false;
+				i -> lastUsed = 0;
+			}
+
+			worker = thread(&ThumbnailCache::run, this);
+		}
+
+		~ThumbnailCache()
+		{
+			{
+				lock_guard<mutex> lock(queueMutex);
+				stopping = true;
+			}
+
+			queueChanged.notify_one();
+			worker.join();
+
+			for(deque<Result>::iterator i = results.begin(); i != results.end(); i++)
+				delete i -> mesh;
+
+			if(atlas != 0)
+				glDeleteTextures(1, &atlas);
+
+			if(framebuffer != 0)
+				glDeleteFramebuffers(1, &framebuffer);
+
+			if(colorBuffer != 0)
+				glDeleteRenderbuffers(1, &colorBuffer);
+
+			if(depthBuffer != 0)
+				glDeleteRenderbuffers(1, &depthBuffer);
+		}
+
+		/**
+		  * Looks up the picture of a puzzle, asking for it to be made if there is none yet.  Call this for every puzzle shown in a frame.
+		  * @return true if the picture is in the atlas at tile
+		  */
+		bool get(const PuzzleCatalog::Entry& entry, Tile& tile)
+		{
+			if(!entry.valid)
+				return false;
+
+			map<uint64_t, size_t>::const_iterator found = slotOf.find(entry.hash);
+
+			if(found != slotOf.end())
+			{
+				slots[found -> second].lastUsed = frame;
+				tile = getTile(found -> second);
+
+				return true;
+			}
+
+			if(failed.count(entry.hash) != 0)
+				return false;
+
+			//A puzzle stored as both .block and .blockb is only drawn once
+			for(vector<Request>::const_iterator i = wanted.begin(); i != wanted.end(); i++)
+				if(i -> hash == entry.hash)
+					return false;
+
+			Request request;
+
+			request.hash = entry.hash;
+			request.path = entry.path;
+			wanted.push_back(request);
+
+			return false;
+		}
+
+		/**
+		  * Replaces the worker's requests with the pictures asked for since the last call, then fills tiles with the pictures
+		  * which are ready until frameBudget seconds have passed.  This must be called on the thread which owns the GL context,
+		  * outside of any other framebuffer pass.
+		  * @param lighting lights the puzzles drawn; its material should already be selected
+		  */
+		void update(SceneLighting& lighting)
+		{
+			{
+				lock_guard<mutex> lock(queueMutex);
+
+				requests.clear();
+
+				//Puzzles which are being worked on or are already done are not asked for again
+				for(vector<Request>::const_iterator i = wanted.begin(); i != wanted.end(); i++)
+				{
+					bool pending = isWorking && working == i -> hash;
+
+					for(deque<Result>::const_iterator j = results.begin(); j != results.end() && !pending; j++)
+						pending = j -> hash == i -> hash;
+
+					if(!pending)
+						requests.push_back(*i);
+				}
+			}
+
+			queueChanged.notify_one();
+			wanted.clear();
+
+			const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			//At least one picture is taken each frame, however long it takes
+			for(bool first = true; first || chrono::duration<double>(chrono::steady_clock::now() - start).count() < frameBudget; first = false)
+			{
+				Result result;
+
+				{
+					lock_guard<mutex> lock(queueMutex);
+
+					if(results.empty())
+						break;
+
+					result = results.front();
+					results.pop_front();
+
+					if(result.mesh != NULL)
+						waitingMeshes--;
+				}
+
+				if(result.mesh != NULL)
+					queueChanged.notify_one();
+
+				if(result.failed)
+					failed.insert(result.hash);
+				else if(slotOf.count(result.hash) == 0)
+					fill(result, lighting);
+
+				delete result.mesh;
+			}
+
+			frame++;
+		}
+
+		/**
+		  * @return true while a picture the menu asked for in the last frame has neither been made nor failed
+		  */
+		bool isPending() const
+		{
+			lock_guard<mutex> lock(queueMutex);
+
+			return !wanted.empty() || !results.empty();
+		}
+
+		/**
+		  * @return the atlas texture, or 0 before any picture was made
+		  */
+		GLuint getAtlas() const { return atlas; }
+
+	private:
+		Tile getTile(size_t slot) const
+		{
+			Tile tile;
+
+			tile.left = (GLfloat)(slot % tilesPerSide) / tilesPerSide;
+			tile.bottom = (GLfloat)(slot / tilesPerSide) / tilesPerSide;
+			tile.right = tile.left + 1.0f / tilesPerSide;
+			tile.top = tile.bottom + 1.0f / tilesPerSide;
+
+			return tile;
+		}
+
+		/**
+		  * Puts the picture of result into the atlas, evicting the picture used least recently if every tile is taken.
+		  */
+		void fill(const Result& result, SceneLighting& lighting)
+		{
+			size_t slot = tileCount;
+
+			for(size_t i = 0; i < slots.size(); i++)
+				if(!slots[i].filled)
+				{
+					slot = i;
+					break;
+				}
+				//Tiles shown in the frame just built stay
+				else if(slots[i].lastUsed + 1 < frame && (slot == tileCount || slots[i].lastUsed < slots[slot].lastUsed))
+					slot = i;
+
+			if(slot == tileCount)
+				return;
+
+			if(slots[slot].filled)
+				slotOf.erase(slots[slot].hash);
+
+			createAtlas();
+
+			const GLint left = (GLint)(slot % tilesPerSide) * tileSize, bottom = (GLint)(slot / tilesPerSide) * tileSize;
+
+			if(result.mesh != NULL)
+				draw(result, lighting, left, bottom);
+			else
+			{
+				glBindTexture(GL_TEXTURE_2D, atlas);
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, left, bottom, tileSize, tileSize, GL_RGB, GL_UNSIGNED_BYTE, result.pixels.data());
+				glBindTexture(GL_TEXTURE_2D, 0);
+			}
+
+			slots[slot].hash = result.hash;
+			slots[slot].filled = true;
+			slots[slot].lastUsed = frame;
+			slotOf[result.hash] = slot;
+		}
+
+		void createAtlas()
+		{
+			if(atlas != 0)
+				return;
+
+			glGenTextures(1, &atlas);
+			glBindTexture(GL_TEXTURE_2D, atlas);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, tilesPerSide * tileSize, tilesPerSide * tileSize, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			glGenRenderbuffers(1, &colorBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, tileSize, tileSize);
+
+			glGenRenderbuffers(1, &depthBuffer);
+			glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, tileSize, tileSize);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+			GLint previousFramebuffer;
+
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glGenFramebuffers(1, &framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		}
+
+		/**
+		  * Draws the mesh of result from above one corner into the tile framebuffer, copies it into the atlas at left and bottom
+		  * and queues its pixels to be saved.
+		  */
+		void draw(const Result& result, SceneLighting& lighting, GLint left, GLint bottom)
+		{
+			GLint previousFramebuffer;
+
+			glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+			glPushAttrib(GL_VIEWPORT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_POLYGON_BIT);
+
+			glViewport(0, 0, tileSize, tileSize);
+			glClearColor(background[0], background[1], background[2], background[3]);
+			glDepthMask(GL_TRUE);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			glEnable(GL_DEPTH_TEST);
+			glDepthFunc(GL_LEQUAL);
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_BACK);
+			glDisable(GL_BLEND);
+			glDisable(GL_STENCIL_TEST);
+			glDisable(GL_TEXTURE_2D);
+
+			//An orthographic view fits the bounding sphere whichever way the puzzle is shaped
+			glMatrixMode(GL_PROJECTION);
+			glPushMatrix();
+			glLoadIdentity();
+			glOrtho(-result.radius, result.radius, -result.radius, result.radius, -result.radius, result.radius);
+
+			glMatrixMode(GL_MODELVIEW);
+			glPushMatrix();
+			glLoadIdentity();
+			glRotatef(30.0, 1.0, 0.0, 0.0);
+			glRotatef(-45.0, 0.0, 1.0, 0.0);
+			glTranslatef(-result.center[x], -result.center[y], -result.center[z]);
+
+			lighting.use();
+			result.mesh -> draw(false);
+			glUseProgram(0);
+			result.mesh -> release();
+
+			glPopMatrix();
+			glMatrixMode(GL_PROJECTION);
+			glPopMatrix();
+			glMatrixMode(GL_MODELVIEW);
+
+			glPopAttrib();
+
+			glBindTexture(GL_TEXTURE_2D, atlas);
+			glCopyTexSubImage2D(GL_TEXTURE_2D, 0, left, bottom, 0, 0, tileSize, tileSize);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			Picture picture;
+
+			picture.hash = result.hash;
+			picture.pixels.resize(tileSize * tileSize * 3);
+
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, 0, tileSize, tileSize, GL_RGB, GL_UNSIGNED_BYTE, picture.pixels.data());
+
+			glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+			{
+				lock_guard<mutex> lock(queueMutex);
+				pictures.push_back(picture);
+			}
+
+			queueChanged.notify_one();
+		}
+
+		string getCachePath(uint64_t hash) const
+		{
+			char name[32];
+
+			snprintf(name, sizeof(name), "%016llx.raw", (unsigned long long)hash);
+
+			return directory + "/" + name;
+		}
+
+		void run()
+		{
+			for(;;)
+			{
+				Request request;
+				Picture picture;
+				bool saving = false;
+
+				{
+					unique_lock<mutex> lock(queueMutex);
+
+					while(!stopping && pictures.empty() && (requests.empty() || waitingMeshes >= maximumWaitingMeshes))
+						queueChanged.wait(lock);
+
+					if(stopping)
+						return;
+
+					//Saving is quick and frees the pixels, so it goes first
+					if(!pictures.empty())
+					{
+						picture.hash = pictures.front().hash;
+						picture.pixels.swap(pictures.front().pixels);
+						pictures.pop_front();
+						saving = true;
+					}
+					else
+					{
+						request = requests.front();
+						requests.erase(requests.begin());
+						working = request.hash;
+						isWorking = true;
+					}
+				}
+
+				if(saving)
+				{
+					save(picture);
+					continue;
+				}
+
+				Result result;
+
+				result.hash = request.hash;
+				result.mesh = NULL;
+				result.radius = 0.0;
+				result.failed = false;
+
+				try
+				{
+					if(!read(request.hash, result.pixels))
+						result.mesh = build(request.path, result.center, result.radius);
+				}
+				catch(const exception&)
+				{
+					result.failed = true;
+				}
+
+				lock_guard<mutex> lock(queueMutex);
+
+				if(result.mesh != NULL)
+					waitingMeshes++;
+
+				results.push_back(result);
+				isWorking = false;
+			}
+		}
+
+		/**
+		  * @return true if a saved picture of the puzzle with hash was read into pixels
+		  */
+		bool read(uint64_t hash, vector<uint8_t>& pixels) const
+		{
+			GLsizei width, height;
+			GLenum format;
+
+			try
+			{
+				TextureCache::decode(getCachePath(hash), width, height, format, pixels);
+			}
+			catch(const exception&)
+			{
+				return false;
+			}
+
+			//Pictures of another size, for instance from an older version, are drawn again
+			return width == tileSize && height == tileSize && format == GL_RGB;
+		}
+
+		/**
+		  * Meshes the puzzle at filePath, merging cells so that each covers at least two pixels of the tile.
+		  * This makes no GL calls.  This throws an exception if the puzzle cannot be read or is too large to mesh.
+		  */
+		StructureMesh* build(const string& filePath, Vector4& center, GLfloat& radius) const
+		{
+			if(BlockFile::isBinaryPath(filePath))
+			{
+				BlockFile file(filePath);
+
+				return build(file, center, radius);
+			}
+
+			BlockGrid grid;
+
+			filePath >> grid;
+
+			return build(grid, center, radius);
+		}
+
+		template<typename CellSource>
+		StructureMesh* build(const CellSource& source, Vector4& center, GLfloat& radius) const
+		{
+			const size_t largest = max(max((size_t)source.getHeight(), (size_t)source.getRows()), (size_t)source.getColumns());
+			const size_t scale = max((size_t)1, (largest + tileSize / 2 - 1) / (tileSize / 2));
+			const ScaledCells<CellSource> cells(source, scale);
+			const size_t cellsAcross = max(max(cells.getHeight(), cells.getRows()), cells.getColumns());
+			const GLfloat cellSize = blockSize * min((GLfloat)1.0, (GLfloat)maximumBlocksAcross / cellsAcross);
+			const GLfloat extent[3] = { cells.getColumns() * cellSize, cells.getHeight() * cellSize, cells.getRows() * cellSize };
+
+			//Stand the puzzle on base, as the game does
+			const Vector4 origin(base[x] - extent[x] / 2.0f + cellSize / 2.0f, base[y] + cellSize / 2.0f, base[z] - extent[z] / 2.0f + cellSize / 2.0f, 1.0);
+
+			center = Vector4(base[x], base[y] + extent[y] / 2.0f, base[z], 1.0);
+			radius = max(sqrt(extent[x] * extent[x] + extent[y] * extent[y] + extent[z] * extent[z]) / 2.0f, cellSize);
+
+			unique_ptr<StructureMesh> mesh(new StructureMesh());
+
+			mesh -> build(cells, origin, cellSize, Block::getPalette());
+
+			return mesh.release();
+		}
+
+		/**
+		  * Saves a drawn picture.  The directory is only a cache, so a picture which cannot be saved is simply drawn again next time.
+		  */
+		void save(const Picture& picture) const
+		{
+#ifdef _WIN32
+			CreateDirectoryA(directory.c_str(), NULL);
+#else
+			mkdir(directory.c_str(), 0755);
+#endif
+
+			try
+			{
+				FrameWriter::write(getCachePath(picture.hash), tileSize, tileSize, picture.pixels);
+			}
+			catch(const exception&)
+			{
+			}
+		}
+};
+
+const double ThumbnailCache::frameBudget = 0.004;
+const GLfloat ThumbnailCache::background[4] = { 0.1f, 0.1f, 0.15f, 1.0f };
+
+#endif /*THUMBNAILCACHE_H_*/
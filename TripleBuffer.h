@@ -0,0 +1,71 @@
+#ifndef TRIPLEBUFFER_H_
+#define TRIPLEBUFFER_H_
+
+#include <atomic>		//atomic
+
+using namespace std;
+
+/**
+  * @brief This class hands the latest value from one writing thread to one reading thread without locks.
+  * The writer fills the back slot and publishes it; the reader acquires the most recent published slot.  Neither ever waits on the other,
+  * and values the reader was too slow to see are simply overwritten.  Slots are reused, so the writer must set every part of the back slot
+  * before publishing it; containers in T keep their capacity from one use to the next.
+  */
+template<typename T>
+class TripleBuffer
+{
+	private:
+		//The slot shared between the threads, with this bit set until the reader has taken it
+		enum { indexMask = 3, freshBit = 4 };
+
+		T slots[3];
+		atomic<unsigned> middle;
+
+		//Each of these belongs to one thread
+		unsigned back, front;
+
+		TripleBuffer(const TripleBuffer&);
+		TripleBuffer& operator = (const TripleBuffer&);
+
+	public:
+		TripleBuffer() : middle(1), back(0), front(2) {}
+
+		/**
+		  * @return the slot to fill before calling publish().  Only the writing thread may call this.
+		  */
+		T& getBack() { return slots[back]; }
+
+		/**
+		  * Makes the back slot the latest value and takes another slot to fill next.  Only the writing thread may call this.
+		  * @return true if the reader took the value published before this one, or none was, and false if that value was overwritten unseen
+		  */
+		bool publish()
+		{
+			const unsigned previous = middle.exchange(back | freshBit, memory_order_acq_rel);
+
+			back = previous & indexMask;
+
+			return (previous & freshBit) == 0;
+		}
+
+		/**
+		  * Takes the latest published value, if there is one the reader has not seen.  Only the reading thread may call this.
+		  * @return true if getFront() now returns a newer value
+		  */
+		bool acquire()
+		{
+			if((middle.load(memory_order_relaxed) & freshBit) == 0)
+				return false;
+
+			front = middle.exchange(front, memory_order_acq_rel) & indexMask;
+
+			return true;
+		}
+
+		/**
+		  * @return the value last acquired.  Only the reading thread may call this.
+		  */
+		const T& getFront() const { return slots[front]; }
+};
+
+#endif /*TRIPLEBUFFER_H_*/
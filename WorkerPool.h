@@ -0,0 +1,167 @@
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include <cstddef>		//size_t
+#include <vector>		//vector
+#include <thread>		//thread
+#include <atomic>		//atomic
+#include <mutex>		//mutex, unique_lock and lock_guard
+#include <condition_variable>	//condition_variable
+#include <functional>	//function
+#include <exception>	//exception_ptr
+
+using namespace std;
+
+/**
+  * @brief This class runs the iterations of a loop on a fixed set of threads, one for each core, with the calling thread taking part.
+  * Only one loop runs on the pool at a time.  A loop started while another is running, including one started from inside a loop's
+  * body, runs on the calling thread alone, so a caller never waits for another caller's work.
+  */
+class WorkerPool
+{
+	private:
+		vector<thread> workers;
+
+		//Held by the caller of the loop running on the pool
+		mutex callMutex;
+
+		mutex jobMutex;
+		condition_variable jobStarted, jobFinished;
+		const function<void (size_t)>* body;
+		size_t count;
+		atomic<size_t> next;
+		unsigned long generation;
+		size_t finishedWorkers;
+		exception_ptr error;
+		bool stopping;
+
+		WorkerPool(const WorkerPool&);
+		WorkerPool& operator = (const WorkerPool&);
+
+	public:
+		/**
+		  * @param threadCount the number of threads which run loops, counting the caller
+		  */
+		WorkerPool(unsigned threadCount = thread::hardware_concurrency()) : body(NULL), count(0), next(0), generation(0), finishedWorkers(0), stopping(false)
+		{
+			for(unsigned i = 1; i < threadCount; i++)
+				workers.push_back(thread(&WorkerPool::run, this));
+		}
+
+		~WorkerPool()
+		{
+			{
+				lock_guard<mutex> lock(jobMutex);
+				stopping = true;
+			}
+
+			jobStarted.notify_all();
+
+			for(vector<thread>::iterator i = workers.begin(); i != workers.end(); i++)
+				i -> join();
+		}
+
+		/**
+		  * Calls body with every index from 0 to count, excluded, in no particular order, and returns once every call has.
+		  * If any call throws, the first exception caught is rethrown here after the rest have finished.
+		  */
+		void parallelFor(size_t count, const function<void (size_t)>& body)
+		{
+			unique_lock<mutex> call(callMutex, try_to_lock);
+
+			if(!call.owns_lock() || workers.empty() || count < 2)
+			{
+				for(size_t i = 0; i < count; i++)
+					body(i);
+
+				return;
+			}
+
+			{
+				lock_guard<mutex> lock(jobMutex);
+
+				this -> body = &body;
+				this -> count = count;
+				next = 0;
+				finishedWorkers = 0;
+				error = exception_ptr();
+				generation++;
+			}
+
+			jobStarted.notify_all();
+			work();
+
+			//Every worker checks in, even those which found nothing left, so none is still reading this loop when the next starts
+			unique_lock<mutex> lock(jobMutex);
+
+			while(finishedWorkers < workers.size())
+				jobFinished.wait(lock);
+
+			this -> body = NULL;
+
+			if(error)
+				rethrow_exception(error);
+		}
+
+		/**
+		  * @return the pool shared by the whole program, which is started the first time it is asked for
+		  */
+		static WorkerPool& getShared()
+		{
+			static WorkerPool pool;
+
+			return pool;
+		}
+
+		size_t getThreadCount() const { return workers.size() + 1; }
+
+	private:
+		void run()
+		{
+			unsigned long seen = 0;
+
+			for(;;)
+			{
+				{
+					unique_lock<mutex> lock(jobMutex);
+
+					while(!stopping && generation == seen)
+						jobStarted.wait(lock);
+
+					if(stopping)
+						return;
+
+					seen = generation;
+				}
+
+				work();
+
+				{
+					lock_guard<mutex> lock(jobMutex);
+					finishedWorkers++;
+				}
+
+				jobFinished.notify_one();
+			}
+		}
+
+		void work()
+		{
+			for(size_t i = next++; i < count; i = next++)
+			{
+				try
+				{
+					(*body)(i);
+				}
+				catch(...)
+				{
+					lock_guard<mutex> lock(jobMutex);
+
+					if(!error)
+						error = current_exception();
+				}
+			}
+		}
+};
+
+#endif /*WORKERPOOL_H_*/
@@ -8,20 +8,30 @@
 
 #include <stdio.h>
 #include <iostream>
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
 
 
 #include <string>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
 
 
 
 #include "BlockDriver.h"
 #include "BlockStructure.h"
+#include "BlockFile.h"
 #include "Matrix44.h"
 #include "Controller.h"
+#ifndef _WIN32
+#include "OffscreenContext.h"
+#include "FrameWriter.h"
+#endif
 
 
 
@@ -46,6 +56,13 @@ static GLfloat windowWidth = originalWindowWidth, windowHeight = originalWindowH
 static GLfloat eye[3] = {(cameraRadius*(cos(yRotation)))*cos(xzRotation), cameraRadius*sin(yRotation), (cameraRadius*(cos(yRotation)))*sin(xzRotation)};
 static GLint mouse[2] = {0, 0};
 
+//While nothing moves the loop sleeps until input arrives, but still wakes this often so the menu picks up puzzles added to the folder
+static const double idleRedrawSeconds = 0.5;
+
+//Frames still to draw at the display's rate after input, which ImGui needs to settle hover and click states
+static const int settleFrameCount = 3;
+static int settleFrames = 0;
+
 Controller* controller;
 
 static bool init()
@@ -55,6 +72,8 @@ static bool init()
 	cout << "Controls:\n\n";
 	cout << "F1:\t\t\tToggle full screen\n";
 	cout << "F2:\t\t\tToggle debug mode\n";
+	cout << "F3:\t\t\tToggle instanced block rendering\n";
+	cout << "F4:\t\t\tToggle between shadow volumes and a shadow map\n";
 	cout << "Arrows Keys:\t\tRotate the laser's direction (with respect to itself)\n";
 	cout << "w:\t\t\tZoom camera in\n";
 	cout << "s:\t\t\tZoom camera out\n";
@@ -102,6 +121,8 @@ static void rotateY(double radian)
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	settleFrames = settleFrameCount;
+
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		(window, GLFW_TRUE);
 	if (action == GLFW_PRESS)
@@ -113,6 +134,8 @@ int right_action = GLFW_RELEASE;
 
 static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 {
+	settleFrames = settleFrameCount;
+
 	int origmousex = mouse[X];
 	int origmousey = mouse[Y];
 	mouse[X] = (int) xpos;
@@ -141,6 +164,8 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
 
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
+	settleFrames = settleFrameCount;
+
 	if (button == GLFW_MOUSE_BUTTON_RIGHT)
 		right_action = action;
 	else if (button == GLFW_MOUSE_BUTTON_LEFT)
@@ -167,6 +192,8 @@ void perspectiveGL(GLdouble fovY, GLdouble aspect, GLdouble zNear, GLdouble zFar
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+	settleFrames = settleFrameCount;
+
 	windowWidth = width;
 	windowHeight = height;
 
@@ -251,10 +278,289 @@ void lookAt(GLdouble eyex, GLdouble eyey, GLdouble eyez, GLdouble centerx,
 }
 
 
+/**
+  * Draws every bundled puzzle with each shadow mode and prints the average time per frame,
+  * along with how many of the fixed-function state calls in a frame the state cache skipped.
+  * The laser is not moved, so every frame draws the same scene.
+  */
+static void benchmarkShadows(GLFWwindow* window, int frames)
+{
+	const Controller::ShadowMode modes[2] = { Controller::SHADOW_VOLUMES, Controller::SHADOW_MAP };
+	PuzzleCatalog catalog("puzzles");
+	const vector<PuzzleCatalog::Entry>& puzzles = catalog.getEntries();
+
+	catalog.finishReads();
+
+	cout << "Puzzle\tBlocks\tShadow volumes (ms)\tShadow map (ms)\tState calls skipped per frame" << endl;
+
+	controller->setManualStepping(true);
+
+	for (vector<PuzzleCatalog::Entry>::const_iterator i = puzzles.begin(); i != puzzles.end(); i++)
+	{
+		if (!i -> valid)
+			continue;
+
+		path = i -> path;
+		pathset = true;
+
+		while (controller->isMainMenuEnabled())
+			controller->update();
+
+		cout << i -> name << "\t" << i -> height << "x" << i -> rows << "x" << i -> columns;
+
+		GLStateCache::count_type issued = 0, skipped = 0;
+
+		for (int mode = 0; mode < 2; mode++)
+		{
+			controller->setShadowMode(modes[mode]);
+
+			chrono::steady_clock::time_point start;
+
+			//The first frames create buffers and compile shaders, so they are not timed
+			for (int frame = -2; frame < frames; frame++)
+			{
+				if (frame == 0)
+				{
+					start = chrono::steady_clock::now();
+					controller->getStateCache().resetCounters();
+				}
+
+				glViewport(0, 0, 640, 480);
+				glClear(GL_COLOR_BUFFER_BIT);
+				glMatrixMode(GL_MODELVIEW);
+				glLoadIdentity();
+				lookAt(eye[X], eye[Y], eye[Z], 0.0, 45.0, 0.0, 0, 1, 0);
+
+				controller->display();
+
+				glFinish();
+				glfwSwapBuffers(window);
+			}
+
+			cout << "\t" << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+
+			issued += controller->getStateCache().getIssuedCalls();
+			skipped += controller->getStateCache().getSkippedCalls();
+		}
+
+		cout << "\t" << skipped / (2 * frames) << " of " << (issued + skipped) / (2 * frames) << endl;
+
+		controller->sendKeyPress(GLFW_KEY_Q);
+	}
+}
+
+#ifndef _WIN32
+/**
+  * Renders a puzzle without a window and writes the frames to outputPath, as a PNG image or, if it ends in .raw, a raw texture.
+  * Options:
+  *   --size WxH						the size of the frames, 640x480 by default
+  *   --camera xzDegrees yDegrees radius	the camera's orbit about the puzzle, as the mouse and zoom keys would set it
+  *   --replay "30 R 60 U"				moves the laser: a number steps it that many times, U, D, L and R turn it as the arrow keys would
+  *   --every N							also writes a frame every N steps, to outputPath used as a printf pattern such as frame%04d.png
+  *   --shadow-map						draws shadows from a shadow map rather than shadow volumes
+  *   --instanced						draws the blocks instanced rather than batched
+  *   --debug							draws the debug view, as F2 shows it
+  * The laser is stepped rather than moved against the clock, so a replay draws the same frames on every run.
+  */
+static int renderHeadless(int argc, char** argv)
+{
+	if (argc < 4)
+	{
+		cerr << "usage: blocks --headless <puzzle> <output.png|output.raw> [--size WxH] [--camera xzDegrees yDegrees radius] [--replay \"30 R 60 U\"] [--every N] [--shadow-map] [--instanced] [--debug]" << endl;
+		return EXIT_FAILURE;
+	}
+
+	const string outputPath = argv[3];
+	int width = 640, height = 480, every = 0;
+	string replay;
+	bool shadowMap = false, instanced = false, debug = false;
+
+	for (int i = 4; i < argc; i++)
+	{
+		const string option = argv[i];
+
+		if (option == "--size" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+			i++;
+		else if (option == "--camera" && i + 3 < argc)
+		{
+			xzRotation = atof(argv[i + 1]) * PI / 180.0;
+			yRotation = atof(argv[i + 2]) * PI / 180.0;
+			cameraRadius = atof(argv[i + 3]);
+			i += 3;
+		}
+		else if (option == "--replay" && i + 1 < argc)
+			replay = argv[++i];
+		else if (option == "--every" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+			every = atoi(argv[++i]);
+		else if (option == "--shadow-map")
+			shadowMap = true;
+		else if (option == "--instanced")
+			instanced = true;
+		else if (option == "--debug")
+			debug = true;
+		else
+		{
+			cerr << "Unrecognised option '" << option << "'." << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	eye[X] = cameraRadius * cos(yRotation) * cos(xzRotation);
+	eye[Y] = cameraRadius * sin(yRotation);
+	eye[Z] = cameraRadius * cos(yRotation) * sin(xzRotation);
+
+	try
+	{
+		OffscreenContext context(width, height);
+
+		windowWidth = width;
+		windowHeight = height;
+		controller = new Controller(windowWidth, windowHeight);
+		controller->setManualStepping(true);
+
+		//The controller's buffers must be freed while the context is still current
+		try
+		{
+			path = argv[2];
+			pathset = true;
+
+			while (controller->isMainMenuEnabled())
+			{
+				controller->update();
+
+				if (!controller->getLoadError().empty())
+					throw runtime_error(controller->getLoadError());
+
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+
+			controller->waitForTextures();
+
+			if (shadowMap)
+				controller->setShadowMode(Controller::SHADOW_MAP);
+
+			if (instanced)
+				controller->sendKeyPress(GLFW_KEY_F3);
+
+			if (debug)
+				controller->sendKeyPress(GLFW_KEY_F2);
+
+			glViewport(0, 0, width, height);
+			glMatrixMode(GL_PROJECTION);
+			glLoadIdentity();
+			perspectiveGL(45.0, (double)width / height, 0.1, 2000.0);
+
+			vector<uint8_t> pixels;
+			int frames = 0, steps = 0;
+			double milliseconds = 0.0;
+
+			//Draws the current state and writes it to filePath
+			auto render = [&](const string& filePath)
+			{
+				const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+				glClear(GL_COLOR_BUFFER_BIT);
+				glMatrixMode(GL_MODELVIEW);
+				glLoadIdentity();
+				lookAt(eye[X], eye[Y], eye[Z], 0.0, 45.0, 0.0, 0, 1, 0);
+
+				controller->display();
+
+				glFinish();
+
+				milliseconds += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+				frames++;
+
+				context.readPixels(pixels);
+				FrameWriter::write(filePath, width, height, pixels);
+			};
+
+			auto framePath = [&outputPath](int step)
+			{
+				vector<char> buffer(outputPath.size() + 32);
+
+				snprintf(buffer.data(), buffer.size(), outputPath.c_str(), step);
+
+				return string(buffer.data());
+			};
+
+			istringstream tokens(replay);
+			string token;
+
+			while (tokens >> token)
+			{
+				if (token == "U" || token == "D" || token == "L" || token == "R")
+					controller->sendKeyPress(token == "U" ? GLFW_KEY_UP : token == "D" ? GLFW_KEY_DOWN : token == "L" ? GLFW_KEY_LEFT : GLFW_KEY_RIGHT);
+				else if (atoi(token.c_str()) > 0)
+				{
+					for (int count = atoi(token.c_str()); count > 0; count--)
+					{
+						controller->stepLaser();
+
+						if (every > 0 && ++steps % every == 0)
+							render(framePath(steps));
+					}
+				}
+				else
+					throw runtime_error("The replay step '" + token + "' is not a number of moves or one of U, D, L and R.");
+			}
+
+			//The last frame is always written, unless it already was
+			if (every == 0)
+				render(outputPath);
+			else if (steps == 0 || steps % every != 0)
+				render(framePath(steps));
+
+			cout << frames << " frames at " << width << "x" << height << ", " << milliseconds / frames << " ms per frame" << endl;
+		}
+		catch (...)
+		{
+			delete controller;
+			controller = NULL;
+			throw;
+		}
+
+		delete controller;
+		controller = NULL;
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+#endif
+
 int main(int argc, char** argv)
 {
 	GLFWwindow* window;
 
+	//Convert between the .block and .blockb puzzle formats without opening a window
+	if(argc >= 4 && string(argv[1]) == "--convert")
+	{
+		try
+		{
+			convertBlockFile(argv[2], argv[3], argc >= 5 && string(argv[4]) == "--rle");
+		}
+		catch(const exception& e)
+		{
+			cerr << e.what() << endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+#ifndef _WIN32
+	//Render a puzzle and a laser replay to image files without opening a window
+	if(argc >= 2 && string(argv[1]) == "--headless")
+		return renderHeadless(argc, argv);
+#endif
+
+	const bool benchmark = argc >= 2 && string(argv[1]) == "--benchmark-shadows";
+
 	// Initialize glut
 	
 	glfwSetErrorCallback(error_callback);
@@ -265,6 +571,9 @@ int main(int argc, char** argv)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
 
+	if (benchmark)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
 	window = glfwCreateWindow(640, 480, "Blocks", NULL, NULL);
 	if (!window)
 	{
@@ -295,6 +604,20 @@ int main(int argc, char** argv)
 
 	framebuffer_size_callback(NULL, 640, 480);
 
+	//The simulation thread wakes the loop below when the laser starts or stops, since that is not input
+	controller->setWakeCallback(glfwPostEmptyEvent);
+
+	if (benchmark)
+	{
+		glfwSwapInterval(0);
+		benchmarkShadows(window, argc >= 3 ? atoi(argv[2]) : 100);
+
+		glfwDestroyWindow(window);
+		glfwTerminate();
+
+		return EXIT_SUCCESS;
+	}
+
 	while (!glfwWindowShouldClose(window))
 	{
 		float ratio;
@@ -315,14 +638,21 @@ int main(int argc, char** argv)
 		controller->display();
 		//glutSolidTeapot(1.0);
 
-		glFinish();
-
+		//The laser moves on the controller's simulation thread, so this only picks up loads, textures and the end of a game
 		controller->update();
 
-		glFinish();
-
 		glfwSwapBuffers(window);
-		glfwPollEvents();
+
+		//Draw at the display's rate only while something moves; otherwise sleep until there is something new to draw
+		if (controller->isAnimating() || settleFrames > 0)
+		{
+			if (settleFrames > 0)
+				settleFrames--;
+
+			glfwPollEvents();
+		}
+		else
+			glfwWaitEventsTimeout(idleRedrawSeconds);
 	}
 
 	glfwDestroyWindow(window);